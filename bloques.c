@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mv.h"
+
+//-------------VARIABLES GLOBALES---------------
+uint32_t umbralPredecodificado = UMBRAL_PREDECODIFICADO;
+uint32_t umbralBloques = UMBRAL_BLOQUES;
+int informeNiveles = 0;
+
+//---------------TRADUCCION---------------
+static int cambiaFlujo(uint8_t codOp){
+    switch(codOp){
+        case OP_JMP: case OP_JZ: case OP_JP: case OP_JN:
+        case OP_JNZ: case OP_JNP: case OP_JNN:
+        case OP_CALL: case OP_RET: case OP_STOP: case OP_SYS:
+            return 1;
+    }
+    return 0;
+}
+
+static int terminaBloque(const InstruccionDecodificada *ins){
+    if (ins->estado != PRE_OK) {
+        return 1; //camino de referencia: despues hay que volver a mirar IP
+    }
+    if (cambiaFlujo(ins->codOp)) {
+        return 1;
+    }
+    // Una instruccion que escribe IP (MOV, POP, SWAP...) cambia el flujo
+    return (ins->tipoA == OP_REG && (ins->operandoA & 0x1F) == POS_IP) ||
+           (ins->tipoB == OP_REG && (ins->operandoB & 0x1F) == POS_IP);
+}
+
+// Entrada de la cache en offset, decodificada (y fusionada) si estaba vacia
+static InstruccionDecodificada *instruccionEn(MaquinaVirtual *mv, uint32_t offset){
+    InstruccionDecodificada *ins = &mv->cacheDecodificada[offset];
+    if (ins->estado == PRE_VACIA) {
+        decodificaInstruccion(mv, offset, ins);
+        if (ins->estado == PRE_OK) {
+            fusionaInstruccion(mv, mv->cacheDecodificada, mv->tamMapa, offset);
+        }
+    }
+    return ins;
+}
+
+static Bloque *traduceBloque(MaquinaVirtual *mv, uint32_t inicio){
+    uint32_t offset = inicio, cantidad = 0;
+    InstruccionDecodificada *ins;
+
+    // Primera pasada: hasta donde llega el bloque
+    do{
+        ins = instruccionEn(mv, offset);
+        cantidad++;
+        if (terminaBloque(ins)) {
+            break;
+        }
+        offset = ins->siguiente;
+    }while(offset < mv->tamMapa && cantidad < MAX_INSTRUCCIONES_BLOQUE);
+
+    Bloque *bloque = malloc(sizeof(Bloque) + (cantidad + 1) * sizeof(InstruccionDecodificada));
+    if (bloque == NULL) {
+        return NULL;
+    }
+    bloque->inicio = inicio;
+    bloque->cantidad = cantidad;
+    bloque->valido = 1;
+    bloque->sucesores[0] = bloque->sucesores[1] = NULL;
+    bloque->ejecuciones = 0;
+    bloque->nativo = NULL;
+    bloque->tamNativo = 0;
+
+    offset = inicio;
+    for (uint32_t i = 0; i < cantidad; i++) {
+        ins = &bloque->instrucciones[i];
+        *ins = mv->cacheDecodificada[offset];
+        // Una superinstruccion que se sale del bloque se ejecuta sin fusionar
+        if (i + instruccionesFusionadas(ins->manejador) > cantidad) {
+            ins->manejador = seleccionaManejador(ins);
+        }
+        offset = ins->estado == PRE_OK ? ins->siguiente : offset + 1;
+    }
+    // Una instruccion lenta se vuelve a leer de memoria al ejecutarla: alcanza con su primer byte
+    bloque->fin = offset < mv->tamMapa ? offset : mv->tamMapa;
+
+    // Centinela: al llegar sale del bloque y busca el siguiente por IP
+    memset(&bloque->instrucciones[cantidad], 0, sizeof(InstruccionDecodificada));
+    bloque->instrucciones[cantidad].manejador = MANEJ_FIN_BLOQUE;
+
+    bloque->siguienteLista = mv->bloquesVivos;
+    mv->bloquesVivos = bloque;
+    mv->mapaBloques[inicio] = bloque;
+    return bloque;
+}
+
+static void liberaLista(MaquinaVirtual *mv, Bloque *lista){
+    materializaInternos(mv); //la instruccion pendiente puede estar en un bloque de la lista
+    while (lista != NULL) {
+        Bloque *sig = lista->siguienteLista;
+        liberaCodigoNativo(lista);
+        free(lista);
+        lista = sig;
+    }
+}
+
+//---------------MANEJO DE LA CACHE DE BLOQUES---------------
+void preparaBloques(MaquinaVirtual *mv){
+    liberaBloques(mv);
+    if (mv->cacheDecodificada == NULL) {
+        return;
+    }
+    mv->tamMapa = mv->cacheFinCS - mv->cacheBaseCS;
+    mv->mapaBloques = calloc(mv->tamMapa, sizeof(Bloque *));
+    if (mv->mapaBloques == NULL) {
+        mv->tamMapa = 0;
+    } else if (motorEjecucion == MOTOR_NIVELES) {
+        mv->contadorEntradas = calloc(mv->tamMapa, sizeof(uint64_t));
+    }
+}
+
+// Bloque que empieza en offset. Se llama entre bloques, cuando no se esta
+// ejecutando ninguno: es el unico momento en que se liberan los retirados
+Bloque *encadenaBloque(MaquinaVirtual *mv, Bloque *actual, uint32_t offset){
+    int enlazar = actual != NULL && actual->valido;
+
+    if (offset >= mv->tamMapa) {
+        return NULL;
+    }
+    if (mv->bloquesRetirados != NULL) {
+        liberaLista(mv, mv->bloquesRetirados);
+        mv->bloquesRetirados = NULL;
+    }
+    Bloque *bloque = mv->mapaBloques[offset];
+    if (bloque == NULL) {
+        bloque = traduceBloque(mv, offset);
+    }
+    if (enlazar && bloque != NULL) {
+        actual->sucesores[1] = actual->sucesores[0];
+        actual->sucesores[0] = bloque;
+    }
+    return bloque;
+}
+
+void invalidaBloques(MaquinaVirtual *mv, uint32_t desde, uint32_t hasta){
+    Bloque **ant = &mv->bloquesVivos;
+    int retirados = 0;
+
+    while (*ant != NULL) {
+        Bloque *bloque = *ant;
+        if (bloque->inicio < hasta && bloque->fin > desde) {
+            *ant = bloque->siguienteLista;
+            // Si se esta ejecutando, lo que queda del bloque sale por el centinela
+            for (uint32_t i = 0; i <= bloque->cantidad; i++) {
+                bloque->instrucciones[i].manejador = MANEJ_FIN_BLOQUE;
+            }
+            bloque->valido = 0;
+            bloque->sucesores[0] = bloque->sucesores[1] = NULL;
+            mv->mapaBloques[bloque->inicio] = NULL;
+            // El offset conserva lo que se uso: al volver se traduce de nuevo
+            if (mv->contadorEntradas != NULL) {
+                mv->contadorEntradas[bloque->inicio] += bloque->ejecuciones;
+            }
+            bloque->siguienteLista = mv->bloquesRetirados;
+            mv->bloquesRetirados = bloque;
+            retirados = 1;
+        } else {
+            ant = &bloque->siguienteLista;
+        }
+    }
+    if (!retirados) {
+        return;
+    }
+    // Ningun bloque vigente puede quedar encadenado a uno retirado
+    for (Bloque *bloque = mv->bloquesVivos; bloque != NULL; bloque = bloque->siguienteLista) {
+        for (int i = 0; i < 2; i++) {
+            if (bloque->sucesores[i] != NULL && !bloque->sucesores[i]->valido) {
+                bloque->sucesores[i] = NULL;
+            }
+        }
+    }
+}
+
+void liberaBloques(MaquinaVirtual *mv){
+    liberaLista(mv, mv->bloquesVivos);
+    liberaLista(mv, mv->bloquesRetirados);
+    mv->bloquesVivos = mv->bloquesRetirados = NULL;
+    free(mv->mapaBloques);
+    free(mv->contadorEntradas);
+    mv->mapaBloques = NULL;
+    mv->contadorEntradas = NULL;
+    mv->tamMapa = 0;
+}
+
+//---------------EJECUCION POR NIVELES---------------
+// Cuenta una entrada al offset y devuelve el nivel con el que hay que ejecutarla.
+// La entrada que llega a umbralBloques ya la cuenta el bloque traducido
+uint8_t nivelEntrada(MaquinaVirtual *mv, uint32_t offset){
+    if (mv->contadorEntradas == NULL || offset >= mv->tamMapa || mv->mapaBloques[offset] != NULL) {
+        return NIVEL_BLOQUES;
+    }
+    if (mv->contadorEntradas[offset] + 1 >= umbralBloques) {
+        return NIVEL_BLOQUES;
+    }
+    mv->contadorEntradas[offset]++;
+    return mv->contadorEntradas[offset] >= umbralPredecodificado ? NIVEL_PREDECODIFICADO : NIVEL_INTERPRETE;
+}
+
+// Ejecuta sin traducir el bloque que empieza en offset, hasta donde terminaria
+// el bloque traducido (salto, CALL, RET, STOP o SYS) o hasta que IP sale del CS
+int ejecutaBloqueInterpretado(MaquinaVirtual *mv, uint32_t offset, uint8_t nivel){
+    uint32_t posCS = mv->Registros[POS_CS] >> 16;
+    uint32_t cantidad = 0;
+    uint8_t codOp;
+
+    do{
+        codOp = mv->MemoriaPrincipal[mv->cacheBaseCS + offset] & 0x1F;
+        if ((nivel == NIVEL_INTERPRETE ? ejecutarInstruccion(mv) : ejecutarDecodificada(mv)) != 0) {
+            return 1;
+        }
+        if (mv->cuota != SIN_CUOTA && mv->cuota > 0) {
+            mv->cuota--;
+        }
+        uint32_t ip = mv->Registros[POS_IP];
+        if (!mv->continuarEjecucion || (ip >> 16) != posCS || (ip & 0xFFFF) >= mv->tamMapa) {
+            break;
+        }
+        offset = ip & 0xFFFF;
+    }while(!cambiaFlujo(codOp) && ++cantidad < MAX_INSTRUCCIONES_BLOQUE);
+    return 0;
+}
+
+static const char *NOMBRES_NIVELES[] = { "interprete", "predecodificado", "bloques", "nativo" };
+
+void muestraNivelesBloques(MaquinaVirtual *mv, FILE *salida){
+    uint32_t porNivel[4] = {0};
+
+    if (mv->mapaBloques == NULL) {
+        return;
+    }
+    fprintf(salida, "\nNiveles: predecodificado desde %u entradas, bloques desde %u", umbralPredecodificado, umbralBloques);
+    if (jitActivo) {
+        fprintf(salida, ", nativo desde %u", umbralJit);
+    }
+    fprintf(salida, "\n  %-8s %12s  %s\n", "Bloque", "Entradas", "Nivel final");
+    for (uint32_t offset = 0; offset < mv->tamMapa; offset++) {
+        Bloque *bloque = mv->mapaBloques[offset];
+        uint64_t entradas = mv->contadorEntradas != NULL ? mv->contadorEntradas[offset] : 0;
+        uint8_t nivel;
+
+        if (bloque != NULL) {
+            entradas += bloque->ejecuciones;
+            nivel = bloque->nativo != NULL ? NIVEL_NATIVO : NIVEL_BLOQUES;
+        } else if (entradas == 0) {
+            continue;
+        } else if (entradas >= umbralBloques) {
+            nivel = NIVEL_BLOQUES; //traducido e invalidado despues por una escritura en el CS
+        } else {
+            nivel = entradas >= umbralPredecodificado ? NIVEL_PREDECODIFICADO : NIVEL_INTERPRETE;
+        }
+        porNivel[nivel]++;
+        fprintf(salida, "  %04X     %12llu  %s\n", offset, (unsigned long long)entradas, NOMBRES_NIVELES[nivel]);
+    }
+    fprintf(salida, "Bloques por nivel: interprete %u, predecodificado %u, bloques %u, nativo %u\n",
+            porNivel[NIVEL_INTERPRETE], porNivel[NIVEL_PREDECODIFICADO], porNivel[NIVEL_BLOQUES], porNivel[NIVEL_NATIVO]);
+}
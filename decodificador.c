@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mv.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define creaDirectorio(nombre) _mkdir(nombre)
+#define getpid _getpid
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#define creaDirectorio(nombre) mkdir(nombre, 0777)
+#endif
+
+//-------------VARIABLES GLOBALES---------------
+const char *dirCachePrograma = NULL; // se activa con cache=DIR
+
+//---------------FUNCIONES AUXILIARES DE DECODIFICACION---------------
+static int codigoValido(uint8_t codOp){
+    // Los codigos 0x09 y 0x0A no estan asignados
+    return codOp <= OP_NOT || (codOp >= OP_PUSH && codOp <= OP_STOP) || (codOp >= OP_MOV && codOp <= OP_RND);
+}
+
+// Decodifica un operando a partir de p[*pos]. Devuelve -1 si la instruccion
+// tiene que ir por el camino de referencia
+static int decodificaOperando(uint8_t tipo, const uint8_t *p, uint32_t *pos, uint32_t *operando, uint8_t *reg, uint8_t *tam, uint32_t *valorOP){
+    const uint8_t *b = p + *pos;
+
+    *tam = 4;
+    switch(tipo){
+        case OP_REG:{
+            *operando = b[0];
+            *valorOP = (OP_REG << 24) | b[0];
+            *pos += 1;
+            break;
+        }
+        case OP_INM:{
+            uint16_t inmediato = cargaBE16(b);
+            *operando = (uint32_t)(int32_t)(int16_t)inmediato;
+            *valorOP = (OP_INM << 24) | inmediato;
+            *pos += 2;
+            break;
+        }
+        case OP_MEM:{
+            switch((b[0] >> 6) & 0x03){
+                case MOD_LONG: *tam=4; break;
+                case MOD_WORD: *tam=2; break;
+                case MOD_BYTE: *tam=1; break;
+                default: return -1;
+            }
+            *reg = b[0] & 0x1F;
+            // IP, OPC, OP1 y OP2 cambian mientras se decodifica: la direccion
+            // no se puede calcular despues, queda para el camino de referencia
+            if (*reg >= POS_IP && *reg <= POS_OP2) {
+                return -1;
+            }
+            *operando = cargaBE16(b + 1);
+            *valorOP = (OP_MEM << 24) | (b[0] << 16) | *operando;
+            *pos += 3;
+            break;
+        }
+        default:
+            return -1; //el camino de referencia informa el error
+    }
+    return 0;
+}
+
+// Registros que se calculan recien cuando alguien los consulta
+static int registroDiferido(uint8_t reg){
+    return reg == POS_CC || reg == POS_LAR || reg == POS_MAR || reg == POS_MBR ||
+           reg == POS_OPC || reg == POS_OP1 || reg == POS_OP2;
+}
+
+// Verificador de carga: prueba sobre la instruccion ya decodificada lo que
+// calculaDireccionSalto y ejecutarCALL vuelven a comprobar en cada ejecucion.
+// Un destino inmediato no cambia mientras la entrada siga en la cache (una
+// escritura en el CS la invalida) y el tamanio del CS tampoco
+static uint8_t verificaInstruccion(MaquinaVirtual *mv, const InstruccionDecodificada *ins){
+    int transfiere = (ins->codOp >= OP_JMP && ins->codOp <= OP_JNN) || ins->codOp == OP_CALL;
+
+    if (transfiere && ins->tipoA == OP_INM && ins->operandoA < mv->cacheTamCS) {
+        return VERIF_DESTINO;
+    }
+    return 0;
+}
+
+//---------------DECODIFICACION---------------
+void decodificaInstruccion(MaquinaVirtual *mv, uint32_t offset, InstruccionDecodificada *ins){
+    const uint8_t *p = mv->MemoriaPrincipal + mv->cacheBaseCS + offset;
+    uint32_t pos = 1;
+    uint8_t codigo = p[0];
+
+    memset(ins, 0, sizeof(InstruccionDecodificada));
+    ins->estado = PRE_LENTA;
+    ins->manejador = MANEJ_REFERENCIA;
+    ins->codOp = codigo & 0x1F;
+
+    if (!codigoValido(ins->codOp)) {
+        return;
+    }
+    // Se necesitan los bytes completos dentro del CS para leerlos sin verificar
+    uint32_t necesarios = 1;
+    if (ins->codOp != OP_STOP && ins->codOp != OP_RET) {
+        if ((codigo >> 4) & 0x01) {
+            necesarios += operandoSize((codigo >> 6) & 0x03) + operandoSize((codigo >> 4) & 0x03);
+        } else {
+            necesarios += operandoSize((codigo >> 6) & 0x03);
+        }
+    }
+    if (offset + necesarios > mv->cacheTamCS) {
+        return;
+    }
+
+    if (ins->codOp == OP_STOP || ins->codOp == OP_RET) {
+        // Sin operandos, OP1 y OP2 quedan en 0
+    } else if ((codigo >> 4) & 0x01) {
+        ins->tipoB = (codigo >> 6) & 0x03;
+        ins->tipoA = (codigo >> 4) & 0x03;
+        if (decodificaOperando(ins->tipoB, p, &pos, &ins->operandoB, &ins->regB, &ins->tamB, &ins->valorOP2) != 0 ||
+            decodificaOperando(ins->tipoA, p, &pos, &ins->operandoA, &ins->regA, &ins->tamA, &ins->valorOP1) != 0) {
+            return;
+        }
+    } else {
+        ins->tipoA = (codigo >> 6) & 0x03;
+        if (decodificaOperando(ins->tipoA, p, &pos, &ins->operandoA, &ins->regA, &ins->tamA, &ins->valorOP1) != 0) {
+            return;
+        }
+    }
+
+    // Una escritura al registro CS cambia el segmento que se esta ejecutando:
+    // los motores que guardan el CS en locales tienen que volver a leerlo
+    if ((ins->tipoA == OP_REG && (ins->operandoA & 0x1F) == POS_CS) ||
+        (ins->codOp == OP_SWAP && ins->tipoB == OP_REG && (ins->operandoB & 0x1F) == POS_CS)) {
+        return;
+    }
+
+    // CC y los registros internos (LAR, MAR, MBR, OPC, OP1, OP2) pueden estar
+    // sin calcular: una instruccion que los nombra va por el camino de referencia,
+    // que los materializa antes de ejecutarla
+    if ((ins->tipoA == OP_REG && registroDiferido(ins->operandoA & 0x1F)) ||
+        (ins->tipoB == OP_REG && registroDiferido(ins->operandoB & 0x1F)) ||
+        (ins->tipoA == OP_MEM && registroDiferido(ins->regA)) ||
+        (ins->tipoB == OP_MEM && registroDiferido(ins->regB))) {
+        return;
+    }
+
+    ins->siguiente = offset + pos;
+    ins->verificada = verificaInstruccion(mv, ins);
+    ins->estado = PRE_OK;
+    ins->manejador = seleccionaManejador(ins);
+}
+
+//---------------CACHE EN DISCO---------------
+// Encabezado de un archivo .mvc, escrito tal como esta en memoria: solo lo lee
+// la misma MV que lo escribio (la firma cambia con la compilacion)
+typedef struct{
+    char identificador[5];   //"MVC25"
+    uint8_t version;         //VERSION_CACHE_PROGRAMA
+    uint16_t tamInstruccion; //sizeof(InstruccionDecodificada)
+    uint32_t firma;          //firmaMV() de quien lo escribio
+    uint32_t tamCS;
+    uint32_t sumaRegistros;  //sumaRegistros() de los registros que siguen al CS
+} EncabezadoCache;
+
+// Identifica la MV: formato de la cache, manejadores y fecha de compilacion
+static uint32_t firmaMV(void){
+    char texto[128];
+    uint32_t hash = 2166136261u;
+    int largo = snprintf(texto, sizeof(texto), "%d %d %d %s %s", VERSION_CACHE_PROGRAMA, CANT_MANEJADORES,
+                         (int)sizeof(InstruccionDecodificada), __DATE__, __TIME__);
+    for (int i = 0; i < largo; i++) {
+        hash = (hash ^ (uint8_t)texto[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// FNV-1a de los registros guardados: registrosValidos solo mira que los
+// indices esten en rango, un byte cambiado en un operando pasaria igual
+static uint32_t sumaRegistros(const uint8_t *datos, size_t largo){
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < largo; i++) {
+        hash = (hash ^ datos[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// DIR/<hash del CS>.mvc
+static void nombreCachePrograma(MaquinaVirtual *mv, char *nombre, size_t tam){
+    const uint8_t *cs = mv->MemoriaPrincipal + mv->cacheBaseCS;
+    uint64_t hash = 14695981039346656037ull;
+    for (uint32_t i = 0; i < mv->cacheTamCS; i++) {
+        hash = (hash ^ cs[i]) * 1099511628211ull;
+    }
+    snprintf(nombre, tam, "%s/%016llx.mvc", dirCachePrograma, (unsigned long long)hash);
+}
+
+// Un archivo danado no puede dejar indices fuera de rango en la cache
+static int registrosValidos(MaquinaVirtual *mv){
+    for (uint32_t offset = 0; offset < mv->cacheTamCS; offset++) {
+        const InstruccionDecodificada *ins = &mv->cacheDecodificada[offset];
+        if (ins->estado > PRE_LENTA || ins->manejador >= CANT_MANEJADORES || ins->manejador == MANEJ_FIN_BLOQUE ||
+            ins->regA >= NUM_REGISTROS || ins->regB >= NUM_REGISTROS) {
+            return 0;
+        }
+        if (ins->estado == PRE_OK && (ins->siguiente <= offset || ins->siguiente > mv->cacheTamCS)) {
+            return 0;
+        }
+        if (ins->verificada != 0 && ins->verificada != verificaInstruccion(mv, ins)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Devuelve 0 si la cache quedo cargada desde el archivo
+static int leeCachePrograma(MaquinaVirtual *mv, const char *nombre){
+    ArchivoMapeado archivo;
+    EncabezadoCache encabezado;
+    size_t tamRegistros = (size_t)mv->cacheTamCS * sizeof(InstruccionDecodificada);
+    int resultado = -1;
+
+    if (mapeaArchivo(nombre, &archivo) != 0) {
+        return -1;
+    }
+    if (archivo.tamanio == sizeof(EncabezadoCache) + mv->cacheTamCS + tamRegistros) {
+        memcpy(&encabezado, archivo.datos, sizeof(EncabezadoCache));
+        if (memcmp(encabezado.identificador, "MVC25", 5) == 0 && encabezado.version == VERSION_CACHE_PROGRAMA &&
+            encabezado.tamInstruccion == sizeof(InstruccionDecodificada) && encabezado.firma == firmaMV() &&
+            encabezado.tamCS == mv->cacheTamCS &&
+            encabezado.sumaRegistros == sumaRegistros(archivo.datos + sizeof(EncabezadoCache) + mv->cacheTamCS, tamRegistros) &&
+            memcmp(archivo.datos + sizeof(EncabezadoCache), mv->MemoriaPrincipal + mv->cacheBaseCS, mv->cacheTamCS) == 0) {
+            memcpy(mv->cacheDecodificada, archivo.datos + sizeof(EncabezadoCache) + mv->cacheTamCS, tamRegistros);
+            resultado = registrosValidos(mv) ? 0 : -1;
+        }
+    }
+    liberaArchivoMapeado(&archivo);
+    return resultado;
+}
+
+// Se escribe a un temporal propio y se renombra: otra MV (otro hilo del lote u
+// otro proceso) puede estar guardando el mismo archivo. Si falla no pasa nada
+static void guardaCachePrograma(MaquinaVirtual *mv, const char *nombre){
+    EncabezadoCache encabezado;
+    char temporal[4200];
+    FILE *arch;
+    int errores;
+
+    snprintf(temporal, sizeof(temporal), "%s.%ld.%p", nombre, (long)getpid(), (void *)mv);
+    arch = fopen(temporal, "wb");
+    if (arch == NULL) {
+        creaDirectorio(dirCachePrograma);
+        arch = fopen(temporal, "wb");
+        if (arch == NULL) {
+            return;
+        }
+    }
+    memcpy(encabezado.identificador, "MVC25", 5);
+    encabezado.version = VERSION_CACHE_PROGRAMA;
+    encabezado.tamInstruccion = sizeof(InstruccionDecodificada);
+    encabezado.firma = firmaMV();
+    encabezado.tamCS = mv->cacheTamCS;
+    encabezado.sumaRegistros = sumaRegistros((const uint8_t *)mv->cacheDecodificada,
+                                             (size_t)mv->cacheTamCS * sizeof(InstruccionDecodificada));
+    errores = fwrite(&encabezado, sizeof(EncabezadoCache), 1, arch) != 1;
+    errores |= fwrite(mv->MemoriaPrincipal + mv->cacheBaseCS, 1, mv->cacheTamCS, arch) != mv->cacheTamCS;
+    errores |= fwrite(mv->cacheDecodificada, sizeof(InstruccionDecodificada), mv->cacheTamCS, arch) != mv->cacheTamCS;
+    errores |= fclose(arch) != 0;
+#ifdef _WIN32
+    if (!errores) {
+        remove(nombre); //en Windows rename no reemplaza un archivo existente
+    }
+#endif
+    if (errores || rename(temporal, nombre) != 0) {
+        remove(temporal);
+    }
+}
+
+//---------------MANEJO DE LA CACHE---------------
+void preparaCacheDecodificada(MaquinaVirtual *mv){
+    char nombre[4096];
+
+    liberaCacheDecodificada(mv);
+
+    mv->cachePosCS = mv->Registros[POS_CS] >> 16;
+    if (mv->cachePosCS >= NUM_SEG || mv->tablaSegmentos[mv->cachePosCS].tamanio == 0) {
+        return;
+    }
+    mv->cacheTamCS = mv->tablaSegmentos[mv->cachePosCS].tamanio;
+    mv->cacheBaseCS = mv->tablaSegmentos[mv->cachePosCS].base;
+    if (mv->cacheBaseCS + mv->cacheTamCS > mv->TAMANIO_MEMORIA) {
+        mv->cacheTamCS = 0;
+        return;
+    }
+
+    mv->cacheDecodificada = calloc(mv->cacheTamCS, sizeof(InstruccionDecodificada));
+    if (mv->cacheDecodificada == NULL) {
+        mv->cacheTamCS = 0;
+        return; //sin cache se ejecuta todo por el camino de referencia
+    }
+    mv->cacheFinCS = mv->cacheBaseCS + mv->cacheTamCS;
+
+    if (dirCachePrograma != NULL) {
+        nombreCachePrograma(mv, nombre, sizeof(nombre));
+        if (leeCachePrograma(mv, nombre) == 0) {
+            return;
+        }
+        memset(mv->cacheDecodificada, 0, mv->cacheTamCS * sizeof(InstruccionDecodificada));
+    }
+
+    // Pasada lineal al cargar, que tambien verifica cada instruccion: lo que no
+    // quede alineado con el flujo real se decodifica cuando se ejecute por primera vez
+    uint32_t offset = 0;
+    while (offset < mv->cacheTamCS) {
+        InstruccionDecodificada *ins = &mv->cacheDecodificada[offset];
+        decodificaInstruccion(mv, offset, ins);
+        offset = (ins->estado == PRE_OK) ? ins->siguiente : offset + 1;
+    }
+    // Segunda pasada: superinstrucciones sobre el flujo ya decodificado
+    for (offset = 0; offset < mv->cacheTamCS; offset++) {
+        if (mv->cacheDecodificada[offset].estado == PRE_OK) {
+            fusionaInstruccion(mv, mv->cacheDecodificada, mv->cacheTamCS, offset);
+        }
+    }
+    if (dirCachePrograma != NULL) {
+        guardaCachePrograma(mv, nombre);
+    }
+}
+
+void invalidaCacheDecodificada(MaquinaVirtual *mv, uint32_t direccionFisica, uint32_t tamanio){
+    // Cualquier instruccion (o superinstruccion) que empiece hasta MAX_LONG_FUSION-1
+    // bytes antes puede incluir lo escrito
+    uint32_t desde = direccionFisica < mv->cacheBaseCS + MAX_LONG_FUSION - 1 ? mv->cacheBaseCS : direccionFisica - (MAX_LONG_FUSION - 1);
+    uint32_t hasta = direccionFisica + tamanio < mv->cacheFinCS ? direccionFisica + tamanio : mv->cacheFinCS;
+
+    // La instruccion pendiente del modo rapido puede ser una de las que se invalidan
+    materializaInternos(mv);
+    for (uint32_t dir = desde; dir < hasta; dir++) {
+        mv->cacheDecodificada[dir - mv->cacheBaseCS].estado = PRE_VACIA;
+        mv->cacheDecodificada[dir - mv->cacheBaseCS].manejador = MANEJ_DECODIFICAR;
+    }
+    // Los bloques traducidos guardan copias: se invalidan solo los que cubren lo escrito
+    desde = direccionFisica > mv->cacheBaseCS ? direccionFisica : mv->cacheBaseCS;
+    invalidaBloques(mv, desde - mv->cacheBaseCS, hasta - mv->cacheBaseCS);
+}
+
+void liberaCacheDecodificada(MaquinaVirtual *mv){
+    liberaBloques(mv);
+    free(mv->cacheDecodificada);
+    mv->cacheDecodificada = NULL;
+    mv->cacheBaseCS = mv->cacheFinCS = 0;
+    mv->cacheTamCS = 0;
+}
+
+//---------------EJECUCION DESDE LA CACHE---------------
+int ejecutarDecodificada(MaquinaVirtual *mv){
+    uint32_t ip = mv->Registros[POS_IP];
+    uint32_t offsetIP = ip & 0xFFFF;
+    uint8_t posCS = mv->Registros[POS_CS] >> 16;
+
+    // Verificar si IP está dentro del code segment
+    if (offsetIP >= mv->tablaSegmentos[posCS].tamanio) {
+        mv->continuarEjecucion = 0;
+        return 0;
+    }
+    if (posCS != mv->cachePosCS || (ip >> 16) != posCS || offsetIP >= mv->cacheTamCS) {
+        return ejecutarInstruccion(mv);
+    }
+
+    InstruccionDecodificada *ins = &mv->cacheDecodificada[offsetIP];
+    if (ins->estado == PRE_VACIA) {
+        decodificaInstruccion(mv, offsetIP, ins);
+    }
+    if (ins->estado != PRE_OK) {
+        return ejecutarInstruccion(mv);
+    }
+
+    materializaInternos(mv);
+    mv->Registros[POS_IP] = (ip & 0xFFFF0000) | ins->siguiente;
+    mv->Registros[POS_OPC] = ins->codOp;
+    mv->Registros[POS_OP1] = ins->valorOP1;
+    mv->Registros[POS_OP2] = ins->valorOP2;
+
+    uint32_t operandoA = ins->tipoA == OP_MEM ? direccionOperando(mv, ins->regA, ins->operandoA) : ins->operandoA;
+    uint32_t operandoB = ins->tipoB == OP_MEM ? direccionOperando(mv, ins->regB, ins->operandoB) : ins->operandoB;
+
+    return ejecutarOperacion(mv, ins->codOp, ins->tipoA, operandoA, ins->tipoB, operandoB, ins->tamA, ins->tamB);
+}
@@ -0,0 +1,614 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mv.h"
+
+#if IMAGEN_ASINCRONICA
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+//-------------VARIABLES GLOBALES---------------
+int imagenIncremental = 0; // se activa con -incremental
+int imagenComprimida = 0;  // se activa con -comprimir
+uint32_t imagenesAsincronicas = 0; // asincronico=N
+
+//---------------ARCHIVO DE DIFERENCIAS---------------
+// imagen.vmi.dif empieza con un VMIHeader ("VMD25") y sigue con un registro por
+// cada imagen guardada: cantidad de paginas (16 bits), registros y tabla de
+// segmentos como en la imagen y cada pagina con su numero (16 bits) delante.
+// Todo en big-endian
+#define VERSION_DIFERENCIAS 1
+
+static char *nombreDiferencias(const char *imagen){
+    char *nombre = malloc(strlen(imagen) + 5);
+    if (nombre != NULL) {
+        sprintf(nombre, "%s.dif", imagen);
+    }
+    return nombre;
+}
+
+static uint32_t cantidadPaginasImagen(MaquinaVirtual *mv){
+    return (mv->TAMANIO_MEMORIA + TAMANIO_PAGINA_IMAGEN - 1) >> BITS_PAGINA_IMAGEN;
+}
+
+// La ultima pagina es mas corta si la memoria no es multiplo de 4 KiB
+static uint32_t largoPaginaImagen(MaquinaVirtual *mv, uint32_t pagina){
+    uint32_t desde = pagina << BITS_PAGINA_IMAGEN;
+    return mv->TAMANIO_MEMORIA - desde < TAMANIO_PAGINA_IMAGEN ? mv->TAMANIO_MEMORIA - desde : TAMANIO_PAGINA_IMAGEN;
+}
+
+void descartaDiferenciasVMI(const char *filename){
+    char *nombre = nombreDiferencias(filename);
+    if (nombre != NULL) {
+        remove(nombre);
+        free(nombre);
+    }
+}
+
+//---------------GUARDADO INCREMENTAL---------------
+static uint32_t cantidadPaginasSucias(MaquinaVirtual *mv){
+    uint32_t paginas = cantidadPaginasImagen(mv), cantidad = 0;
+    for (uint32_t i = 0; i < paginas; i++) {
+        cantidad += mv->paginasSucias[i];
+    }
+    return cantidad;
+}
+
+// Bytes que agregaria una diferencia, o 0 si hay que guardar la imagen completa:
+// no hay una imagen de la que partir o las diferencias pesarian mas que la memoria
+static uint32_t largoDiferencia(MaquinaVirtual *mv){
+    uint32_t largo = 2 + TAMANIO_ESTADO_VMI + cantidadPaginasSucias(mv) * (2 + TAMANIO_PAGINA_IMAGEN);
+    if (!mv->cadenaImagen || mv->largoDiferencias + largo > mv->TAMANIO_MEMORIA) {
+        return 0;
+    }
+    return largo;
+}
+
+// Lo que queda despues de guardar una diferencia de largo bytes (0: la imagen completa)
+static void registraImagenGuardada(MaquinaVirtual *mv, uint32_t largo){
+    if (largo == 0) {
+        mv->largoDiferencias = 0;
+    } else {
+        if (mv->largoDiferencias == 0) {
+            mv->largoDiferencias = sizeof(VMIHeader);
+        }
+        mv->largoDiferencias += largo;
+    }
+    mv->cadenaImagen = 1;
+    memset(mv->paginasSucias, 0, sizeof(mv->paginasSucias));
+}
+
+// Agrega a las diferencias las paginas escritas desde la imagen anterior, o
+// guarda la imagen completa si no corresponde una diferencia
+int guardarImagenIncremental(MaquinaVirtual *mv, const char *filename){
+    uint32_t paginas = cantidadPaginasImagen(mv), cantidad = cantidadPaginasSucias(mv);
+    uint32_t largo = largoDiferencia(mv);
+
+    if (largo == 0) {
+        return guardarImagenVMI(mv, filename);
+    }
+
+    char *nombre = nombreDiferencias(filename);
+    FILE *arch = nombre != NULL ? fopen(nombre, mv->largoDiferencias == 0 ? "wb" : "ab") : NULL;
+    if (arch == NULL) {
+        fprintf(mv->salida, "Error: No se pudo crear el archivo \n");
+        free(nombre);
+        return -1;
+    }
+
+    int errores = 0;
+    if (mv->largoDiferencias == 0) {
+        VMIHeader encabezado;
+        memcpy(encabezado.identificador, "VMD25", 5);
+        encabezado.version = VERSION_DIFERENCIAS;
+        encabezado.tamanio_mem = convertirBigEndian16(mv->TAMANIO_MEMORIA / 1024);
+        errores |= fwrite(&encabezado, sizeof(VMIHeader), 1, arch) != 1;
+    }
+    uint16_t cantidad_be = convertirBigEndian16(cantidad);
+    errores |= fwrite(&cantidad_be, sizeof(uint16_t), 1, arch) != 1;
+    errores |= escribeEstadoVMI(mv, arch) != 0;
+    for (uint32_t i = 0; i < paginas && !errores; i++) {
+        if (mv->paginasSucias[i]) {
+            uint16_t pagina_be = convertirBigEndian16(i);
+            uint32_t largoPagina = largoPaginaImagen(mv, i);
+            errores |= fwrite(&pagina_be, sizeof(uint16_t), 1, arch) != 1;
+            errores |= fwrite(mv->MemoriaPrincipal + (i << BITS_PAGINA_IMAGEN), 1, largoPagina, arch) != largoPagina;
+        }
+    }
+    errores |= fclose(arch) != 0;
+    if (errores) {
+        // Puede haber quedado un registro a medias: la proxima imagen va completa
+        fprintf(mv->salida, "Error: No se pudieron guardar las diferencias en %s\n", nombre);
+        mv->cadenaImagen = 0;
+        free(nombre);
+        return -1;
+    }
+
+    registraImagenGuardada(mv, largo);
+    fprintf(mv->salida, "Estado de la MV guardado en %s (%u paginas cambiadas)\n", nombre, cantidad);
+    free(nombre);
+    return 0;
+}
+
+//---------------CARGA DE LAS DIFERENCIAS---------------
+// Lee un registro entero antes de aplicarlo: uno cortado (la maquina se detuvo
+// mientras lo escribia) se ignora. Devuelve los bytes leidos, o 0 si no habia
+// un registro completo
+static uint32_t aplicaRegistro(MaquinaVirtual *mv, FILE *arch, uint8_t *paginas){
+    uint16_t cantidad_be, pagina_be;
+    uint32_t registros[NUM_REGISTROS];
+    DescriptoresSegmentos segmentos[NUM_SEG];
+    uint32_t cantidad, leidos = 0;
+
+    if (fread(&cantidad_be, sizeof(uint16_t), 1, arch) != 1 ||
+        fread(registros, sizeof(uint32_t), NUM_REGISTROS, arch) != NUM_REGISTROS ||
+        fread(segmentos, sizeof(DescriptoresSegmentos), NUM_SEG, arch) != NUM_SEG) {
+        return 0;
+    }
+    cantidad = convertirBigEndian16(cantidad_be);
+    if (cantidad > cantidadPaginasImagen(mv)) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < cantidad; i++) {
+        if (fread(&pagina_be, sizeof(uint16_t), 1, arch) != 1) {
+            return 0;
+        }
+        uint32_t pagina = convertirBigEndian16(pagina_be);
+        if (pagina >= cantidadPaginasImagen(mv)) {
+            return 0;
+        }
+        uint32_t largo = largoPaginaImagen(mv, pagina);
+        memcpy(paginas + leidos, &pagina_be, sizeof(uint16_t));
+        if (fread(paginas + leidos + 2, 1, largo, arch) != largo) {
+            return 0;
+        }
+        leidos += 2 + largo;
+    }
+
+    // Registro completo: recien ahora se toca la maquina
+    for (uint32_t pos = 0; pos < leidos; ) {
+        uint32_t pagina = cargaBE16(paginas + pos);
+        uint32_t largo = largoPaginaImagen(mv, pagina);
+        memcpy(mv->MemoriaPrincipal + (pagina << BITS_PAGINA_IMAGEN), paginas + pos + 2, largo);
+        pos += 2 + largo;
+    }
+    memcpy(mv->Registros, registros, sizeof(registros));
+    memcpy(mv->tablaSegmentos, segmentos, sizeof(segmentos));
+    convierteEstadoVMI(mv);
+    return 2 + TAMANIO_ESTADO_VMI + leidos;
+}
+
+// Aplica sobre la imagen recien cargada sus diferencias, si tiene. Si todas se
+// pudieron aplicar, las proximas imagenes incrementales siguen la misma cadena
+void aplicaDiferenciasVMI(MaquinaVirtual *mv, const char *filename){
+    char *nombre = nombreDiferencias(filename);
+    FILE *arch = nombre != NULL ? fopen(nombre, "rb") : NULL;
+    VMIHeader encabezado;
+    uint32_t aplicados = 0, leidos;
+
+    memset(mv->paginasSucias, 0, sizeof(mv->paginasSucias));
+    mv->largoDiferencias = 0;
+    mv->cadenaImagen = nombre != NULL;
+    if (arch == NULL) {
+        free(nombre);
+        return;
+    }
+    if (fread(&encabezado, sizeof(VMIHeader), 1, arch) != 1 || memcmp(encabezado.identificador, "VMD25", 5) != 0 ||
+        encabezado.version != VERSION_DIFERENCIAS || convertirBigEndian16(encabezado.tamanio_mem) * 1024 != mv->TAMANIO_MEMORIA) {
+        fprintf(mv->salida, "Aviso: se ignoran las diferencias de %s (no corresponden a la imagen)\n", nombre);
+        mv->cadenaImagen = 0;
+        fclose(arch);
+        free(nombre);
+        return;
+    }
+
+    uint8_t *paginas = malloc(cantidadPaginasImagen(mv) * (2 + TAMANIO_PAGINA_IMAGEN));
+    mv->largoDiferencias = sizeof(VMIHeader);
+    while (paginas != NULL && (leidos = aplicaRegistro(mv, arch, paginas)) != 0) {
+        mv->largoDiferencias += leidos;
+        aplicados++;
+    }
+    // Si se leyo algo despues del ultimo registro completo, la cadena no se puede continuar
+    if (paginas == NULL || ftell(arch) != (long)mv->largoDiferencias || fgetc(arch) != EOF) {
+        fprintf(mv->salida, "Aviso: las diferencias de %s estan incompletas, se aplicaron %u\n", nombre, aplicados);
+        mv->cadenaImagen = 0;
+    } else if (aplicados > 0) {
+        fprintf(mv->salida, "Diferencias aplicadas: %u\n", aplicados);
+    }
+    free(paginas);
+    fclose(arch);
+    free(nombre);
+}
+
+//---------------COMPACTACION---------------
+// Reescribe completa una imagen ya cargada con sus diferencias. Las diferencias
+// se borran despues: si se cortara en el medio, volver a aplicarlas sobre la
+// imagen compactada deja el mismo estado
+int compactaImagenVMI(MaquinaVirtual *mv, const char *filename){
+    if (escribeImagenVMI(mv, filename) != 0) {
+        return -1;
+    }
+    descartaDiferenciasVMI(filename);
+    memset(mv->paginasSucias, 0, sizeof(mv->paginasSucias));
+    mv->cadenaImagen = 1;
+    mv->largoDiferencias = 0;
+    return 0;
+}
+
+//---------------IMAGENES COMPRIMIDAS---------------
+// Cada bloque se comprime por su cuenta con un LZ77 sencillo (al estilo LZ4):
+// secuencias de un byte de control (cantidad de literales en los 4 bits altos,
+// largo de la coincidencia menos 4 en los bajos; 15 sigue en bytes de 255),
+// los literales y la distancia hacia atras en 16 bits. La ultima secuencia
+// tiene solo literales
+#define MINIMO_COINCIDENCIA 4
+#define BITS_HASH 12
+
+static uint32_t sumaAdler32(const uint8_t *datos, uint32_t largo){
+    uint32_t a = 1, b = 0;
+    while (largo > 0) {
+        uint32_t tramo = largo < 5552 ? largo : 5552; //sin desbordar b antes del modulo
+        largo -= tramo;
+        while (tramo-- > 0) {
+            a += *datos++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+static uint8_t *emiteLargoExtendido(uint8_t *d, const uint8_t *fin, uint32_t largo){
+    for (; largo >= 255; largo -= 255) {
+        if (d >= fin) {
+            return NULL;
+        }
+        *d++ = 255;
+    }
+    if (d >= fin) {
+        return NULL;
+    }
+    *d++ = largo;
+    return d;
+}
+
+static uint8_t *emiteSecuencia(uint8_t *d, const uint8_t *fin, const uint8_t *literales, uint32_t cantidad,
+                               uint32_t distancia, uint32_t coincidencia){
+    uint32_t largo = coincidencia ? coincidencia - MINIMO_COINCIDENCIA : 0;
+
+    if (d >= fin) {
+        return NULL;
+    }
+    *d++ = ((cantidad < 15 ? cantidad : 15) << 4) | (largo < 15 ? largo : 15);
+    if (cantidad >= 15 && (d = emiteLargoExtendido(d, fin, cantidad - 15)) == NULL) {
+        return NULL;
+    }
+    if (cantidad > (uint32_t)(fin - d)) {
+        return NULL;
+    }
+    memcpy(d, literales, cantidad);
+    d += cantidad;
+    if (coincidencia == 0) {
+        return d;
+    }
+    if (fin - d < 2) {
+        return NULL;
+    }
+    guardaBE16(d, distancia);
+    d += 2;
+    if (largo >= 15 && (d = emiteLargoExtendido(d, fin, largo - 15)) == NULL) {
+        return NULL;
+    }
+    return d;
+}
+
+// Devuelve lo que ocupa el bloque comprimido en destino (con lugar para largo
+// bytes), o 0 si comprimido no queda mas chico que el original
+static uint32_t comprimeBloque(const uint8_t *origen, uint32_t largo, uint8_t *destino){
+    uint16_t tabla[1 << BITS_HASH]; //posicion + 1 de la ultima vez que se vio cada hash
+    const uint8_t *fin = destino + largo - 1;
+    uint32_t pos = 0, literales = 0;
+    uint8_t *d = destino;
+
+    memset(tabla, 0, sizeof(tabla));
+    while (pos + MINIMO_COINCIDENCIA <= largo) {
+        uint32_t cuatro = cargaBE32(origen + pos);
+        uint32_t hash = (cuatro * 2654435761u) >> (32 - BITS_HASH);
+        uint32_t candidato = tabla[hash];
+        tabla[hash] = pos + 1;
+        if (candidato == 0 || cargaBE32(origen + candidato - 1) != cuatro) {
+            pos++;
+            continue;
+        }
+        candidato--;
+        uint32_t coincidencia = MINIMO_COINCIDENCIA;
+        while (pos + coincidencia < largo && origen[candidato + coincidencia] == origen[pos + coincidencia]) {
+            coincidencia++;
+        }
+        d = emiteSecuencia(d, fin, origen + literales, pos - literales, pos - candidato, coincidencia);
+        if (d == NULL) {
+            return 0;
+        }
+        pos += coincidencia;
+        literales = pos;
+    }
+    d = emiteSecuencia(d, fin, origen + literales, largo - literales, 0, 0);
+    return d != NULL ? d - destino : 0;
+}
+
+static int leeLargoExtendido(const uint8_t *origen, uint32_t largo, uint32_t *i, uint32_t *valor){
+    uint8_t b;
+    do{
+        if (*i >= largo) {
+            return -1;
+        }
+        b = origen[(*i)++];
+        *valor += b;
+    }while(b == 255);
+    return 0;
+}
+
+// Devuelve 0 si el bloque se descomprimio justo en largoDestino bytes
+static int descomprimeBloque(const uint8_t *origen, uint32_t largo, uint8_t *destino, uint32_t largoDestino){
+    uint32_t i = 0, o = 0;
+
+    while (i < largo) {
+        uint8_t control = origen[i++];
+        uint32_t cantidad = control >> 4, coincidencia = control & 0x0F;
+        if (cantidad == 15 && leeLargoExtendido(origen, largo, &i, &cantidad) != 0) {
+            return -1;
+        }
+        if (cantidad > largo - i || cantidad > largoDestino - o) {
+            return -1;
+        }
+        memcpy(destino + o, origen + i, cantidad);
+        i += cantidad;
+        o += cantidad;
+        if (i == largo) {
+            break;
+        }
+        if (largo - i < 2) {
+            return -1;
+        }
+        uint32_t distancia = cargaBE16(origen + i);
+        i += 2;
+        if (coincidencia == 15 && leeLargoExtendido(origen, largo, &i, &coincidencia) != 0) {
+            return -1;
+        }
+        coincidencia += MINIMO_COINCIDENCIA;
+        if (distancia == 0 || distancia > o || coincidencia > largoDestino - o) {
+            return -1;
+        }
+        // Byte a byte: la coincidencia puede pisarse con lo que va copiando (corridas)
+        for (uint32_t k = 0; k < coincidencia; k++, o++) {
+            destino[o] = destino[o - distancia];
+        }
+    }
+    return o == largoDestino ? 0 : -1;
+}
+
+// Escribe, a partir de la posicion actual del archivo, el indice y los bloques
+int escribeMemoriaComprimida(MaquinaVirtual *mv, FILE *archivo){
+    uint32_t paginas = cantidadPaginasImagen(mv);
+    uint8_t *indice = malloc(paginas * TAMANIO_ENTRADA_INDICE);
+    uint8_t *datos = malloc(mv->TAMANIO_MEMORIA);
+    long inicio = ftell(archivo);
+    uint32_t ocupado = 0;
+    int errores = 0;
+
+    if (indice == NULL || datos == NULL || inicio < 0) {
+        free(indice);
+        free(datos);
+        return -1;
+    }
+    uint32_t desplazamiento = inicio + paginas * TAMANIO_ENTRADA_INDICE;
+    for (uint32_t i = 0; i < paginas; i++) {
+        const uint8_t *bloque = mv->MemoriaPrincipal + (i << BITS_PAGINA_IMAGEN);
+        uint32_t largo = largoPaginaImagen(mv, i), comprimido = 0;
+        uint8_t *entrada = indice + i * TAMANIO_ENTRADA_INDICE;
+
+        if (bloque[0] != 0 || memcmp(bloque, bloque + 1, largo - 1) != 0) {
+            comprimido = comprimeBloque(bloque, largo, datos + ocupado);
+            if (comprimido == 0) {
+                memcpy(datos + ocupado, bloque, largo);
+                comprimido = largo;
+            }
+        }
+        guardaBE32(entrada, comprimido ? desplazamiento + ocupado : 0);
+        guardaBE32(entrada + 4, comprimido);
+        guardaBE32(entrada + 8, sumaAdler32(bloque, largo));
+        ocupado += comprimido;
+    }
+    errores |= fwrite(indice, TAMANIO_ENTRADA_INDICE, paginas, archivo) != paginas;
+    errores |= fwrite(datos, 1, ocupado, archivo) != ocupado;
+    free(indice);
+    free(datos);
+    return errores ? -1 : 0;
+}
+
+int cargaMemoriaComprimida(MaquinaVirtual *mv, FILE *archivo){
+    uint32_t paginas = cantidadPaginasImagen(mv);
+    uint8_t *indice = malloc(paginas * TAMANIO_ENTRADA_INDICE);
+    uint8_t bloque[TAMANIO_PAGINA_IMAGEN];
+    int resultado = 0;
+
+    if (indice == NULL || fread(indice, TAMANIO_ENTRADA_INDICE, paginas, archivo) != paginas) {
+        fprintf(mv->salida, "Error: No se pudo leer el indice de la imagen \n");
+        free(indice);
+        return -1;
+    }
+    for (uint32_t i = 0; i < paginas && resultado == 0; i++) {
+        const uint8_t *entrada = indice + i * TAMANIO_ENTRADA_INDICE;
+        uint32_t desplazamiento = cargaBE32(entrada), comprimido = cargaBE32(entrada + 4);
+        uint32_t largo = largoPaginaImagen(mv, i);
+        uint8_t *destino = mv->MemoriaPrincipal + (i << BITS_PAGINA_IMAGEN);
+
+        if (comprimido == 0) {
+            continue; //la memoria recien inicializada ya esta en cero
+        }
+        if (comprimido > largo || fseek(archivo, desplazamiento, SEEK_SET) != 0 ||
+            fread(bloque, 1, comprimido, archivo) != comprimido) {
+            resultado = -1;
+        } else if (comprimido == largo) {
+            memcpy(destino, bloque, largo);
+        } else {
+            resultado = descomprimeBloque(bloque, comprimido, destino, largo);
+        }
+        if (resultado != 0 || sumaAdler32(destino, largo) != cargaBE32(entrada + 8)) {
+            fprintf(mv->salida, "Error: El bloque %u de la imagen esta danado \n", i);
+            resultado = -1;
+        }
+    }
+    free(indice);
+    return resultado;
+}
+
+//---------------IMAGENES EN SEGUNDO PLANO---------------
+static int guardarImagenSincronica(MaquinaVirtual *mv){
+    return imagenIncremental ? guardarImagenIncremental(mv, mv->archivo_vmi) : guardarImagenVMI(mv, mv->archivo_vmi);
+}
+
+#if IMAGEN_ASINCRONICA
+// Codigos de salida del hijo
+#define IMAGEN_GUARDADA 0
+#define IMAGEN_FALLIDA 1
+#define IMAGEN_COMPLETA 2   //iba a ser una diferencia, pero el anterior no dejo la cadena esperada
+
+static uint64_t relojNanosegundos(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + t.tv_nsec;
+}
+
+// Recoge al hijo i si ya termino (o lo espera, con opciones = 0). Si no pudo
+// seguir la cadena que el padre supone, la proxima imagen va completa
+static int terminaImagen(MaquinaVirtual *mv, uint32_t i, int opciones){
+    int estado, codigo = IMAGEN_FALLIDA;
+    pid_t pid;
+
+    do{
+        pid = waitpid(mv->pidImagenes[i], &estado, opciones);
+    }while(pid < 0 && errno == EINTR);
+    if (pid == 0) {
+        return 0;
+    }
+    if (pid > 0 && WIFEXITED(estado)) {
+        codigo = WEXITSTATUS(estado);
+    }
+    if (codigo != IMAGEN_FALLIDA) {
+        mv->imagenesGuardadas++;
+    } else {
+        mv->imagenesFallidas++;
+    }
+    if (codigo != IMAGEN_GUARDADA) {
+        mv->cadenaImagen = 0;
+    }
+    mv->imagenesEnCurso--;
+    memmove(&mv->pidImagenes[i], &mv->pidImagenes[i + 1], (mv->imagenesEnCurso - i) * sizeof(int));
+    if (mv->imagenesEnCurso == 0) {
+        close(mv->avisoUltimaImagen);
+    }
+    return 1;
+}
+
+static void guardaEnHijo(MaquinaVirtual *mv, uint32_t largo, int aviso){
+    char anterior = '1';
+
+    // El anterior avisa con un byte cuando dejo la cadena como la supone el padre
+    if (mv->imagenesEnCurso > 0 && read(mv->avisoUltimaImagen, &anterior, 1) != 1) {
+        anterior = 0;
+    }
+    if (anterior != '1') {
+        mv->cadenaImagen = 0;
+    }
+    mv->salida = stderr;
+    if (guardarImagenSincronica(mv) != 0) {
+        _exit(IMAGEN_FALLIDA);
+    }
+    if (largo != 0 && anterior != '1') {
+        _exit(IMAGEN_COMPLETA);
+    }
+    if (write(aviso, "1", 1) != 1) {
+        _exit(IMAGEN_FALLIDA);
+    }
+    _exit(IMAGEN_GUARDADA);
+}
+
+static int guardarImagenAsincronica(MaquinaVirtual *mv){
+    uint64_t inicio = relojNanosegundos();
+    int aviso[2];
+
+    for (uint32_t i = 0; i < mv->imagenesEnCurso; ) {
+        if (!terminaImagen(mv, i, WNOHANG)) {
+            i++;
+        }
+    }
+    while (mv->imagenesEnCurso >= imagenesAsincronicas) {
+        terminaImagen(mv, 0, 0);
+    }
+    // El hijo decide con el mismo estado: el padre sabe si sera una diferencia
+    uint32_t largo = imagenIncremental ? largoDiferencia(mv) : 0;
+
+    if (pipe(aviso) != 0) {
+        return guardarImagenSincronica(mv);
+    }
+    fflush(NULL); //lo pendiente de la salida no se tiene que repetir en el hijo
+    int pid = fork();
+    if (pid < 0) {
+        close(aviso[0]);
+        close(aviso[1]);
+        return guardarImagenSincronica(mv);
+    }
+    if (pid == 0) {
+        close(aviso[0]);
+        guardaEnHijo(mv, largo, aviso[1]);
+    }
+
+    close(aviso[1]);
+    if (mv->imagenesEnCurso > 0) {
+        close(mv->avisoUltimaImagen); //ahora lo tiene el hijo nuevo
+    }
+    mv->avisoUltimaImagen = aviso[0];
+    mv->pidImagenes[mv->imagenesEnCurso++] = pid;
+    registraImagenGuardada(mv, largo);
+
+    uint64_t pausa = relojNanosegundos() - inicio;
+    mv->pausaImagenes += pausa;
+    if (pausa > mv->pausaMaximaImagen) {
+        mv->pausaMaximaImagen = pausa;
+    }
+    return 0;
+}
+#endif
+
+int guardarImagenBreakpoint(MaquinaVirtual *mv){
+#if IMAGEN_ASINCRONICA
+    if (imagenesAsincronicas > 0) {
+        return guardarImagenAsincronica(mv);
+    }
+#endif
+    return guardarImagenSincronica(mv);
+}
+
+void esperaImagenesEnCurso(MaquinaVirtual *mv){
+#if IMAGEN_ASINCRONICA
+    while (mv->imagenesEnCurso > 0) {
+        terminaImagen(mv, 0, 0);
+    }
+#endif
+}
+
+void muestraImagenesAsincronicas(MaquinaVirtual *mv, FILE *salida){
+    uint32_t cantidad = mv->imagenesGuardadas + mv->imagenesFallidas;
+
+    if (cantidad == 0) {
+        return;
+    }
+    fprintf(salida, "\nImagenes en segundo plano: %u guardadas, %u con error; pausa media %.1f us, maxima %.1f us\n",
+            mv->imagenesGuardadas, mv->imagenesFallidas,
+            mv->pausaImagenes / 1000.0 / cantidad, mv->pausaMaximaImagen / 1000.0);
+}
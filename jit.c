@@ -0,0 +1,711 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "mv.h"
+
+//-------------VARIABLES GLOBALES---------------
+int jitActivo = 0; // se activa con -jit
+uint32_t umbralJit = UMBRAL_JIT; // entradas al bloque antes de compilarlo
+
+#if JIT_DISPONIBLE
+#include <sys/mman.h>
+
+//---------------REGISTROS DEL HOST---------------
+// Numeracion de x86-64
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RBP 5
+#define RSI 6
+#define RDI 7
+#define R12 12
+#define R13 13
+#define R14 14
+#define R15 15
+
+// Registros de la MV que viven en registros del host durante el bloque.
+// rbp apunta a Registros, rsi a MemoriaPrincipal y rdi a la traduccion de segmentos;
+// rax, rcx y rdx son auxiliares
+static int registroHost(uint8_t reg){
+    switch(reg){
+        case POS_EAX: return 8;
+        case POS_EBX: return 9;
+        case POS_ECX: return 10;
+        case POS_EDX: return 11;
+        case POS_EEX: return R12;
+        case POS_EFX: return R13;
+        case POS_AC: return R14;
+        case POS_CC: return R15;
+        case POS_SP: return RBX;
+        default: return -1;
+    }
+}
+
+//---------------EMISION DE CODIGO---------------
+typedef struct{
+    uint8_t *codigo;
+    uint32_t pos, capacidad;
+    int error;
+} Emisor;
+
+static void emiteByte(Emisor *e, uint8_t b){
+    if (e->pos == e->capacidad) {
+        uint32_t capacidad = e->capacidad ? 2 * e->capacidad : 1024;
+        uint8_t *codigo = realloc(e->codigo, capacidad);
+        if (codigo == NULL) {
+            e->error = 1;
+            return;
+        }
+        e->codigo = codigo;
+        e->capacidad = capacidad;
+    }
+    e->codigo[e->pos++] = b;
+}
+
+static void emite32(Emisor *e, uint32_t v){
+    for (int i = 0; i < 4; i++) {
+        emiteByte(e, (v >> (8 * i)) & 0xFF);
+    }
+}
+
+static void emiteRex(Emisor *e, int w, int r, int x, int b){
+    uint8_t rex = 0x40 | (w << 3) | ((r >> 3) << 2) | ((x >> 3) << 1) | (b >> 3);
+    if (rex != 0x40) {
+        emiteByte(e, rex);
+    }
+}
+
+static void emiteModRM(Emisor *e, int mod, int reg, int rm){
+    emiteByte(e, (mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+// op r/m32, r32 (o r32, r/m32 segun el codigo) entre registros
+static void emiteRR(Emisor *e, uint8_t op, int rm, int reg){
+    emiteRex(e, 0, reg, 0, rm);
+    emiteByte(e, op);
+    emiteModRM(e, 3, reg, rm);
+}
+
+// op con [rbp + 4*reg]: carga (0x8B, 0x03...) o guarda (0x89) un registro de la MV
+static void emiteRegistroMV(Emisor *e, uint8_t op, int reg, uint8_t registroMV){
+    emiteRex(e, 0, reg, 0, RBP);
+    emiteByte(e, op);
+    emiteModRM(e, 2, reg, RBP);
+    emite32(e, 4 * registroMV);
+}
+
+// mov dword [rbp + 4*reg], imm32
+static void emiteGuardaConstante(Emisor *e, uint8_t registroMV, uint32_t valor){
+    emiteByte(e, 0xC7);
+    emiteModRM(e, 2, 0, RBP);
+    emite32(e, 4 * registroMV);
+    emite32(e, valor);
+}
+
+// Grupo 0x81: ADD /0, OR /1, AND /4, SUB /5, XOR /6, CMP /7
+static void emiteInmediato(Emisor *e, int ext, int rm, uint32_t valor){
+    emiteRex(e, 0, 0, 0, rm);
+    emiteByte(e, 0x81);
+    emiteModRM(e, 3, ext, rm);
+    emite32(e, valor);
+}
+
+static void emiteMovInmediato(Emisor *e, int reg, uint32_t valor){
+    emiteRex(e, 0, 0, 0, reg);
+    emiteByte(e, 0xB8 + (reg & 7));
+    emite32(e, valor);
+}
+
+// Grupo de desplazamientos: SHL /4, SHR /5, SAR /7
+static void emiteDesplazamiento(Emisor *e, int ext, int rm, int cantidad){
+    emiteRex(e, 0, 0, 0, rm);
+    if (cantidad < 0) {
+        emiteByte(e, 0xD3); //por CL
+        emiteModRM(e, 3, ext, rm);
+    } else {
+        emiteByte(e, 0xC1);
+        emiteModRM(e, 3, ext, rm);
+        emiteByte(e, cantidad);
+    }
+}
+
+static void emiteBswap(Emisor *e, int reg){
+    emiteRex(e, 0, 0, 0, reg);
+    emiteByte(e, 0x0F);
+    emiteByte(e, 0xC8 + (reg & 7));
+}
+
+// mov/guarda reg <-> [rsi + rcx]: 4 bytes de MemoriaPrincipal
+static void emiteMemoriaPrincipal(Emisor *e, uint8_t op, int reg){
+    emiteRex(e, 0, reg, RCX, RSI);
+    emiteByte(e, op);
+    emiteModRM(e, 0, reg, 4);
+    emiteByte(e, (0 << 6) | (RCX << 3) | RSI);
+}
+
+// Marca como sucia la pagina de la direccion fisica en eax:
+// mov byte [rbp + rax + desplazamiento], 1, con rbp en Registros
+static void emiteMarcaPagina(Emisor *e){
+    int32_t desplazamiento = offsetof(MaquinaVirtual, paginasSucias) - offsetof(MaquinaVirtual, Registros);
+    emiteDesplazamiento(e, 5, RAX, BITS_PAGINA_IMAGEN);   // shr eax, BITS_PAGINA_IMAGEN
+    emiteByte(e, 0xC6);
+    emiteModRM(e, 2, 0, 4);
+    emiteByte(e, (0 << 6) | (RAX << 3) | RBP);
+    emite32(e, desplazamiento);
+    emiteByte(e, 1);
+}
+
+// Salto condicional (o incondicional con cc < 0) de 32 bits; devuelve donde parchear
+#define CC_O 0x0
+#define CC_B 0x2
+#define CC_AE 0x3
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_A 0x7
+static uint32_t emiteSalto(Emisor *e, int cc){
+    if (cc < 0) {
+        emiteByte(e, 0xE9);
+    } else {
+        emiteByte(e, 0x0F);
+        emiteByte(e, 0x80 + cc);
+    }
+    emite32(e, 0);
+    return e->pos - 4;
+}
+
+static void parcheaSalto(Emisor *e, uint32_t parche, uint32_t destino){
+    if (e->error) {
+        return;
+    }
+    uint32_t rel = destino - (parche + 4);
+    memcpy(e->codigo + parche, &rel, 4);
+}
+
+//---------------COMPILACION DE UN BLOQUE---------------
+typedef struct{
+    MaquinaVirtual *mv;
+    Emisor e;
+    Bloque *bloque;
+    uint32_t *offsets;      // offset en el CS de cada instruccion (y del final)
+    uint32_t *salidas;      // parches de los saltos a la salida de cada instruccion
+    uint32_t cantParches;
+    uint32_t modificados;   // registros de la MV escritos en el bloque
+    uint32_t usados;        // registros de la MV que se cargan en el host
+    uint32_t segmentoCS;
+} Compilacion;
+
+#define SIN_PARCHE 0xFFFFFFFF
+
+static int registroMV32(uint32_t operando){
+    return ((operando >> 6) & 0x03) == 0;
+}
+
+// Registros que no cambian mientras corre el codigo nativo (LAR..OP2 si)
+static int registroLegible(uint32_t operando){
+    uint8_t reg = operando & 0x1F;
+    return registroMV32(operando) && (reg > POS_OP2);
+}
+
+static int registroEscribible(uint32_t operando){
+    return registroMV32(operando) && registroHost(operando & 0x1F) >= 0;
+}
+
+static int memoriaLong(uint8_t tam, uint8_t reg){
+    return tam == 4 && reg > POS_OP2;
+}
+
+static int soportada(const InstruccionDecodificada *ins, int ultima){
+    if (ins->estado != PRE_OK) {
+        return 0;
+    }
+    switch(ins->codOp){
+        case OP_MOV: case OP_ADD: case OP_SUB: case OP_CMP:
+        case OP_AND: case OP_OR: case OP_XOR:{
+            if (ins->tipoA == OP_REG) {
+                int destinoValido = ins->codOp == OP_CMP ? registroLegible(ins->operandoA) : registroEscribible(ins->operandoA);
+                if (!destinoValido) {
+                    return 0;
+                }
+                return (ins->tipoB == OP_REG && registroLegible(ins->operandoB)) || ins->tipoB == OP_INM ||
+                       (ins->tipoB == OP_MEM && memoriaLong(ins->tamB, ins->regB));
+            }
+            if (ins->tipoA == OP_MEM && memoriaLong(ins->tamA, ins->regA)) {
+                return (ins->tipoB == OP_REG && registroLegible(ins->operandoB)) || ins->tipoB == OP_INM;
+            }
+            return 0;
+        }
+        case OP_SHL: case OP_SHR: case OP_SAR:{
+            if (ins->tipoA != OP_REG || !registroEscribible(ins->operandoA)) {
+                return 0;
+            }
+            // Un inmediato fuera de rango siempre es error: lo informa el interprete
+            return (ins->tipoB == OP_REG && registroLegible(ins->operandoB)) ||
+                   (ins->tipoB == OP_INM && ins->operandoB <= 31);
+        }
+        case OP_LDL: case OP_LDH:
+            return ins->tipoA == OP_REG && registroEscribible(ins->operandoA) &&
+                   ((ins->tipoB == OP_REG && registroLegible(ins->operandoB)) || ins->tipoB == OP_INM);
+        case OP_JMP: case OP_JZ: case OP_JP: case OP_JN:
+        case OP_JNZ: case OP_JNP: case OP_JNN:
+            return ultima && ins->tipoA == OP_INM;
+        default:
+            return 0;
+    }
+}
+
+static void marcaRegistro(Compilacion *c, uint8_t tipo, uint32_t operando, uint8_t regMemoria, int escrito){
+    if (tipo == OP_REG && registroHost(operando & 0x1F) >= 0) {
+        c->usados |= 1u << (operando & 0x1F);
+        if (escrito) {
+            c->modificados |= 1u << (operando & 0x1F);
+        }
+    }
+    if (tipo == OP_MEM && registroHost(regMemoria) >= 0) {
+        c->usados |= 1u << regMemoria;
+    }
+}
+
+// Salto a la salida que devuelve el control al interprete en la instruccion i
+static void saltaASalida(Compilacion *c, int cc, uint32_t i){
+    uint32_t parche = emiteSalto(&c->e, cc);
+    uint32_t *salidas = realloc(c->salidas, (c->cantParches + 1) * 2 * sizeof(uint32_t));
+    if (salidas == NULL) {
+        c->e.error = 1;
+        return;
+    }
+    c->salidas = salidas;
+    c->salidas[2 * c->cantParches] = parche;
+    c->salidas[2 * c->cantParches + 1] = i;
+    c->cantParches++;
+}
+
+// Operando de un registro de la MV como fuente: registro del host o [rbp+4*reg]
+static void emiteOperacionFuente(Compilacion *c, uint8_t op, int destino, uint8_t tipo, uint32_t operando){
+    Emisor *e = &c->e;
+    if (tipo == OP_INM) {
+        static const int extension[256] = { [0x03] = 0, [0x0B] = 1, [0x23] = 4, [0x2B] = 5, [0x33] = 6, [0x3B] = 7 };
+        if (op == 0x8B) {
+            emiteMovInmediato(e, destino, operando);
+        } else {
+            emiteInmediato(e, extension[op], destino, operando);
+        }
+        return;
+    }
+    int host = registroHost(operando & 0x1F);
+    if (host >= 0) {
+        emiteRR(e, op, host, destino); // op r32, r/m32 con r/m registro
+    } else {
+        emiteRegistroMV(e, op, destino, operando & 0x1F);
+    }
+}
+
+// CC: N y Z a partir de eax, los demas bits se conservan (igual que actualizaCC)
+static void emiteActualizaCC(Compilacion *c){
+    Emisor *e = &c->e;
+    emiteInmediato(e, 4, R15, ~(CC_N | CC_Z));
+    emiteRR(e, 0x89, RDX, RAX);                   // mov edx, eax
+    emiteInmediato(e, 4, RDX, CC_N);              // and edx, N
+    emiteRR(e, 0x09, R15, RDX);                   // or r15d, edx
+    emiteRR(e, 0x85, RAX, RAX);                   // test eax, eax
+    emiteByte(e, 0x0F); emiteByte(e, 0x94); emiteModRM(e, 3, 0, RDX); // setz dl
+    emiteByte(e, 0x0F); emiteByte(e, 0xB6); emiteModRM(e, 3, RDX, RDX); // movzx edx, dl
+    emiteDesplazamiento(e, 4, RDX, 30);           // shl edx, 30 (CC_Z)
+    emiteRR(e, 0x09, R15, RDX);                   // or r15d, edx
+}
+
+// "op eax, [rdi + rcx + campo]", con rcx ya multiplicado por sizeof(TraduccionSegmento)
+static void emiteCampoTraduccion(Emisor *e, uint8_t op, uint8_t campo){
+    emiteByte(e, op);
+    emiteModRM(e, 1, RAX, 4); emiteByte(e, (RCX << 3) | RDI); emiteByte(e, campo);
+}
+
+// Direccion de un operando de memoria long: deja la logica en edx y la fisica
+// en ecx, con las mismas verificaciones que calculaDireccionFisica y leerMemoria/
+// escribirMemoria. Cualquier falla (o una escritura sobre el CS) vuelve al
+// interprete antes de ejecutar la instruccion i
+static void emiteDireccion(Compilacion *c, uint32_t i, uint8_t reg, uint32_t desplazamiento, int escritura){
+    Emisor *e = &c->e;
+    int host = registroHost(reg);
+
+    if (host >= 0) {
+        emiteRR(e, 0x89, RCX, host);              // mov ecx, base
+    } else {
+        emiteRegistroMV(e, 0x8B, RCX, reg);
+    }
+    // direccionOperando: (R & 0xFFFF0000) | (desplazamiento + (R & 0xFFFF))
+    emiteRR(e, 0x89, RDX, RCX);                   // mov edx, ecx
+    emiteInmediato(e, 4, RCX, 0xFFFF0000);        // and ecx, 0xFFFF0000
+    emiteByte(e, 0x0F); emiteByte(e, 0xB7); emiteModRM(e, 3, RDX, RDX); // movzx edx, dx
+    emiteInmediato(e, 0, RDX, desplazamiento);    // add edx, desplazamiento
+    emiteRR(e, 0x09, RDX, RCX);                   // or edx, ecx
+    // Traduccion del segmento (TRADUCCION DE DIRECCIONES): una sola comparacion
+    // cubre el segmento, el offset y los 4 bytes dentro de la memoria
+    emiteRR(e, 0x89, RCX, RDX);                   // mov ecx, edx
+    emiteDesplazamiento(e, 5, RCX, 16);           // shr ecx, 16
+    emiteInmediato(e, 4, RCX, NUM_SEG - 1);       // and ecx, NUM_SEG - 1
+    emiteByte(e, 0x6B); emiteModRM(e, 3, RCX, RCX); // imul ecx, ecx, sizeof(TraduccionSegmento)
+    emiteByte(e, sizeof(TraduccionSegmento));
+    emiteRR(e, 0x89, RAX, RDX);                   // mov eax, edx
+    emiteCampoTraduccion(e, 0x2B, offsetof(TraduccionSegmento, inicio));  // sub eax, inicio
+    emiteCampoTraduccion(e, 0x3B, offsetof(TraduccionSegmento, limite));  // cmp eax, limite
+    saltaASalida(c, CC_AE, i);
+    emiteCampoTraduccion(e, 0x03, offsetof(TraduccionSegmento, base));    // add eax, base
+    emiteRR(e, 0x89, RCX, RAX);                   // mov ecx, eax (fisica)
+    // Una escritura sobre el CS la hace el interprete, que invalida lo traducido
+    if (escritura && c->mv->cacheFinCS > c->mv->cacheBaseCS) {
+        uint32_t desde = c->mv->cacheBaseCS >= 3 ? c->mv->cacheBaseCS - 3 : 0;
+        emiteRR(e, 0x89, RAX, RCX);
+        emiteInmediato(e, 5, RAX, desde);
+        emiteInmediato(e, 7, RAX, c->mv->cacheFinCS - desde);
+        saltaASalida(c, CC_B, i);
+    }
+    // Y una sobre las paginas compartidas (-compartir), que el interprete copia antes
+    if (escritura && c->mv->finCompartido > c->mv->inicioCompartido) {
+        uint32_t desde = c->mv->inicioCompartido >= 3 ? c->mv->inicioCompartido - 3 : 0;
+        emiteRR(e, 0x89, RAX, RCX);
+        emiteInmediato(e, 5, RAX, desde);
+        emiteInmediato(e, 7, RAX, c->mv->finCompartido - desde);
+        saltaASalida(c, CC_B, i);
+    }
+    // LAR y MAR como los deja el acceso
+    emiteRegistroMV(e, 0x89, RDX, POS_LAR);
+    emiteByte(e, 0x0F); emiteByte(e, 0xB7); emiteModRM(e, 3, RDX, RCX); // movzx edx, cx
+    emiteInmediato(e, 1, RDX, 4 << 16);
+    emiteRegistroMV(e, 0x89, RDX, POS_MAR);
+    // Paginas del primer y el ultimo byte, solo para las imagenes incrementales
+    if (escritura && imagenIncremental) {
+        emiteRR(e, 0x89, RAX, RCX);                   // mov eax, ecx
+        emiteMarcaPagina(e);
+        emiteByte(e, 0x8D); emiteModRM(e, 1, RAX, RCX); emiteByte(e, 3); // lea eax, [rcx + 3]
+        emiteMarcaPagina(e);
+    }
+}
+
+// Codigos x86 de la forma "op r32, r/m32" de cada instruccion
+static uint8_t codigoHost(uint8_t codOp){
+    switch(codOp){
+        case OP_MOV: return 0x8B;
+        case OP_ADD: return 0x03;
+        case OP_SUB: case OP_CMP: return 0x2B;
+        case OP_AND: return 0x23;
+        case OP_OR: return 0x0B;
+        default: return 0x33; //XOR
+    }
+}
+
+static int modificaCC(uint8_t codOp){
+    return codOp != OP_MOV && codOp != OP_LDL && codOp != OP_LDH;
+}
+
+static void emiteInstruccion(Compilacion *c, uint32_t i, const InstruccionDecodificada *ins){
+    Emisor *e = &c->e;
+    uint8_t op = codigoHost(ins->codOp);
+    int desborda = ins->codOp == OP_ADD || ins->codOp == OP_SUB;
+
+    if (ins->codOp == OP_LDL || ins->codOp == OP_LDH) {
+        // LDL: parte baja de A con los 16 bits bajos de B. LDH: parte alta
+        int destino = registroHost(ins->operandoA & 0x1F);
+        int alta = ins->codOp == OP_LDH;
+        emiteOperacionFuente(c, 0x8B, RCX, ins->tipoB, ins->operandoB);
+        if (alta) {
+            emiteDesplazamiento(e, 4, RCX, 16);
+        } else {
+            emiteInmediato(e, 4, RCX, 0x0000FFFF);
+        }
+        emiteInmediato(e, 4, destino, alta ? 0x0000FFFF : 0xFFFF0000);
+        emiteRR(e, 0x09, destino, RCX);
+        return;
+    }
+
+    if (ins->codOp == OP_SHL || ins->codOp == OP_SHR || ins->codOp == OP_SAR) {
+        int ext = ins->codOp == OP_SHL ? 4 : ins->codOp == OP_SHR ? 5 : 7;
+        int destino = registroHost(ins->operandoA & 0x1F);
+        if (ins->tipoB == OP_REG) {
+            emiteOperacionFuente(c, 0x8B, RCX, OP_REG, ins->operandoB);
+            emiteInmediato(e, 7, RCX, 31);
+            saltaASalida(c, CC_A, i); // fuera de 0..31 (con signo) es error
+        }
+        emiteRR(e, 0x89, RAX, destino);
+        emiteDesplazamiento(e, ext, RAX, ins->tipoB == OP_REG ? -1 : (int)ins->operandoB);
+        emiteRR(e, 0x89, destino, RAX);
+        emiteActualizaCC(c);
+        return;
+    }
+
+    if (ins->tipoA == OP_REG) {
+        uint8_t tipoFuente = ins->tipoB;
+        uint32_t fuente = ins->operandoB;
+        if (ins->tipoB == OP_MEM) {
+            emiteDireccion(c, i, ins->regB, ins->operandoB, 0);
+            emiteMemoriaPrincipal(e, 0x8B, RAX);
+            emiteBswap(e, RAX);
+            emiteRegistroMV(e, 0x89, RAX, POS_MBR);
+            emiteRR(e, 0x89, RCX, RAX);
+            // La fuente queda en ecx: se usa como registro del host
+            tipoFuente = 0xFF;
+        }
+        int destino = registroHost(ins->operandoA & 0x1F);
+        if (ins->codOp == OP_MOV) {
+            if (tipoFuente == 0xFF) {
+                emiteRR(e, 0x89, destino, RCX);
+            } else {
+                emiteOperacionFuente(c, 0x8B, destino, tipoFuente, fuente);
+            }
+            return;
+        }
+        if (destino >= 0) {
+            emiteRR(e, 0x89, RAX, destino);
+        } else {
+            emiteRegistroMV(e, 0x8B, RAX, ins->operandoA & 0x1F); // CMP con un registro no mapeado
+        }
+        if (tipoFuente == 0xFF) {
+            emiteRR(e, op, RCX, RAX);
+        } else {
+            emiteOperacionFuente(c, op, RAX, tipoFuente, fuente);
+        }
+        if (desborda) {
+            saltaASalida(c, CC_O, i);
+        }
+        if (ins->codOp != OP_CMP) {
+            emiteRR(e, 0x89, destino, RAX);
+        }
+        emiteActualizaCC(c);
+        return;
+    }
+
+    // Destino en memoria
+    emiteDireccion(c, i, ins->regA, ins->operandoA, ins->codOp != OP_CMP);
+    if (ins->codOp == OP_MOV) {
+        emiteOperacionFuente(c, 0x8B, RAX, ins->tipoB, ins->operandoB);
+    } else {
+        emiteMemoriaPrincipal(e, 0x8B, RAX);
+        emiteBswap(e, RAX);
+        if (ins->codOp == OP_CMP) {
+            emiteRegistroMV(e, 0x89, RAX, POS_MBR);
+        }
+        emiteOperacionFuente(c, op, RAX, ins->tipoB, ins->operandoB);
+        if (desborda) {
+            saltaASalida(c, CC_O, i);
+        }
+    }
+    if (ins->codOp != OP_CMP) {
+        emiteRegistroMV(e, 0x89, RAX, POS_MBR);
+    }
+    if (ins->codOp != OP_MOV) {
+        emiteActualizaCC(c);
+    }
+    if (ins->codOp != OP_CMP) {
+        emiteBswap(e, RAX);
+        emiteMemoriaPrincipal(e, 0x89, RAX);
+    }
+}
+
+// Estado que deja el interprete luego de ejecutar la instruccion ins
+static void emiteEstado(Compilacion *c, const InstruccionDecodificada *ins, uint32_t ip){
+    emiteGuardaConstante(&c->e, POS_IP, c->segmentoCS | ip);
+    if (ins != NULL) {
+        emiteGuardaConstante(&c->e, POS_OPC, ins->codOp);
+        emiteGuardaConstante(&c->e, POS_OP1, ins->valorOP1);
+        emiteGuardaConstante(&c->e, POS_OP2, ins->valorOP2);
+    }
+}
+
+// Devuelve al interprete el indice de la instruccion por la que sigue
+static uint32_t emiteRetorno(Compilacion *c, uint32_t indice){
+    emiteMovInmediato(&c->e, RAX, indice);
+    return emiteSalto(&c->e, -1);
+}
+
+static const int registrosPreservados[] = { RBX, RBP, R12, R13, R14, R15 };
+
+int compilaBloque(MaquinaVirtual *mv, Bloque *bloque){
+    Compilacion c;
+    uint32_t cantidad = 0;
+
+    memset(&c, 0, sizeof(c));
+    c.mv = mv;
+    c.bloque = bloque;
+    c.segmentoCS = mv->Registros[POS_CS] & 0xFFFF0000;
+
+    while (cantidad < bloque->cantidad && soportada(&bloque->instrucciones[cantidad], cantidad + 1 == bloque->cantidad)) {
+        cantidad++;
+    }
+    if (cantidad == 0) {
+        return -1;
+    }
+    c.offsets = malloc((cantidad + 1) * sizeof(uint32_t));
+    uint32_t *retornos = malloc((cantidad + 3) * sizeof(uint32_t));
+    if (c.offsets == NULL || retornos == NULL) {
+        free(c.offsets);
+        free(retornos);
+        return -1;
+    }
+    c.offsets[0] = bloque->inicio;
+    for (uint32_t i = 0; i < cantidad; i++) {
+        const InstruccionDecodificada *ins = &bloque->instrucciones[i];
+        c.offsets[i + 1] = ins->siguiente;
+        if (ins->codOp >= OP_JMP && ins->codOp <= OP_JNN) {
+            continue;
+        }
+        marcaRegistro(&c, ins->tipoA, ins->operandoA, ins->regA, ins->codOp != OP_CMP);
+        marcaRegistro(&c, ins->tipoB, ins->operandoB, ins->regB, 0);
+        if (modificaCC(ins->codOp)) {
+            c.usados |= 1u << POS_CC;
+            c.modificados |= 1u << POS_CC;
+        }
+    }
+    const InstruccionDecodificada *ultima = &bloque->instrucciones[cantidad - 1];
+    int terminaEnSalto = ultima->codOp >= OP_JMP && ultima->codOp <= OP_JNN;
+    if (terminaEnSalto && ultima->codOp != OP_JMP) {
+        c.usados |= 1u << POS_CC;
+    }
+
+    // Prologo: registros preservados y los de la MV que usa el bloque
+    Emisor *e = &c.e;
+    for (int i = 0; i < 6; i++) {
+        emiteRex(e, 0, 0, 0, registrosPreservados[i]);
+        emiteByte(e, 0x50 + (registrosPreservados[i] & 7));
+    }
+    emiteByte(e, 0x48); emiteByte(e, 0x89); emiteModRM(e, 3, RDI, RBP); // mov rbp, rdi
+    emiteByte(e, 0x48); emiteByte(e, 0x89); emiteModRM(e, 3, RDX, RDI); // mov rdi, rdx
+    for (uint8_t reg = 0; reg < NUM_REGISTROS; reg++) {
+        if (c.usados & (1u << reg)) {
+            emiteRegistroMV(e, 0x8B, registroHost(reg), reg);
+        }
+    }
+    uint32_t inicioBucle = e->pos;
+
+    uint32_t cantRetornos = 0;
+    uint32_t cuerpo = terminaEnSalto ? cantidad - 1 : cantidad;
+    for (uint32_t i = 0; i < cuerpo; i++) {
+        emiteInstruccion(&c, i, &bloque->instrucciones[i]);
+    }
+    if (terminaEnSalto) {
+        // Igual que calculaDireccionSalto: fuera del CS (destino sin verificar) no salta
+        uint32_t destino = ultima->operandoA;
+        int salta = (ultima->verificada & VERIF_DESTINO) != 0;
+        uint32_t parcheTomado = SIN_PARCHE;
+        if (salta) {
+            int bits = 0, siCero = 0;
+            switch(ultima->codOp){
+                case OP_JZ: bits = CC_Z; siCero = 0; break;
+                case OP_JNZ: bits = CC_Z; siCero = 1; break;
+                case OP_JN: bits = CC_N; siCero = 0; break;
+                case OP_JNN: bits = CC_N; siCero = 1; break;
+                case OP_JP: bits = CC_N | CC_Z; siCero = 1; break;
+                case OP_JNP: bits = CC_N | CC_Z; siCero = 0; break;
+            }
+            if (ultima->codOp == OP_JMP) {
+                parcheTomado = emiteSalto(e, -1);
+            } else {
+                emiteRex(e, 0, 0, 0, R15);
+                emiteByte(e, 0xF7); emiteModRM(e, 3, 0, R15); emite32(e, bits); // test r15d, bits
+                parcheTomado = emiteSalto(e, siCero ? CC_E : CC_NE);
+            }
+        }
+        // No tomado
+        if (ultima->codOp != OP_JMP || !salta) {
+            emiteEstado(&c, ultima, ultima->siguiente);
+            retornos[cantRetornos++] = emiteRetorno(&c, cantidad);
+        }
+        if (parcheTomado != SIN_PARCHE) {
+            if (destino == bloque->inicio && cantidad == bloque->cantidad && mv->cuota == SIN_CUOTA) {
+                // Bucle sobre el mismo bloque: sigue en codigo nativo. Con cuota
+                // cada vuelta vuelve al interprete, que descuenta el bloque y cede
+                // cuando se agota (las caches son de una sola maquina, y en un lote
+                // todas sus ejecuciones tienen cuota)
+                parcheaSalto(e, parcheTomado, inicioBucle);
+            } else {
+                parcheaSalto(e, parcheTomado, e->pos);
+                emiteEstado(&c, ultima, destino);
+                retornos[cantRetornos++] = emiteRetorno(&c, cantidad);
+            }
+        }
+    } else {
+        // La instruccion cantidad la ejecuta el interprete (o es el centinela)
+        emiteEstado(&c, &bloque->instrucciones[cantidad - 1], c.offsets[cantidad]);
+        retornos[cantRetornos++] = emiteRetorno(&c, cantidad);
+    }
+
+    // Salidas por falla: el interprete vuelve a ejecutar la instruccion i
+    for (uint32_t i = 0; i < cuerpo; i++) {
+        uint32_t inicioSalida = SIN_PARCHE;
+        for (uint32_t p = 0; p < c.cantParches; p++) {
+            if (c.salidas[2 * p + 1] != i) {
+                continue;
+            }
+            if (inicioSalida == SIN_PARCHE) {
+                inicioSalida = e->pos;
+                emiteEstado(&c, i > 0 ? &bloque->instrucciones[i - 1] : NULL, c.offsets[i]);
+                uint32_t *mas = realloc(retornos, (cantRetornos + 1) * sizeof(uint32_t));
+                if (mas == NULL) {
+                    e->error = 1;
+                    break;
+                }
+                retornos = mas;
+                retornos[cantRetornos++] = emiteRetorno(&c, i);
+            }
+            parcheaSalto(e, c.salidas[2 * p], inicioSalida);
+        }
+    }
+
+    // Epilogo comun: registros de la MV modificados y restaurar los del host
+    uint32_t epilogo = e->pos;
+    for (uint8_t reg = 0; reg < NUM_REGISTROS; reg++) {
+        if (c.modificados & (1u << reg)) {
+            emiteRegistroMV(e, 0x89, registroHost(reg), reg);
+        }
+    }
+    for (int i = 5; i >= 0; i--) {
+        emiteRex(e, 0, 0, 0, registrosPreservados[i]);
+        emiteByte(e, 0x58 + (registrosPreservados[i] & 7));
+    }
+    emiteByte(e, 0xC3);
+    for (uint32_t r = 0; r < cantRetornos; r++) {
+        parcheaSalto(e, retornos[r], epilogo);
+    }
+
+    free(c.offsets);
+    free(c.salidas);
+    free(retornos);
+    if (e->error) {
+        free(e->codigo);
+        return -1;
+    }
+
+    // Se escribe con permiso de escritura y despues se deja solo ejecutable
+    void *nativo = mmap(NULL, e->pos, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (nativo == MAP_FAILED) {
+        free(e->codigo);
+        return -1;
+    }
+    memcpy(nativo, e->codigo, e->pos);
+    free(e->codigo);
+    if (mprotect(nativo, e->pos, PROT_READ | PROT_EXEC) != 0) {
+        munmap(nativo, e->pos);
+        return -1;
+    }
+    bloque->nativo = (CodigoNativo)nativo;
+    bloque->tamNativo = e->pos;
+    return 0;
+}
+
+void liberaCodigoNativo(Bloque *bloque){
+    if (bloque->nativo != NULL) {
+        munmap((void *)bloque->nativo, bloque->tamNativo);
+        bloque->nativo = NULL;
+    }
+}
+
+#else //sin JIT: todo lo ejecuta el interprete
+
+int compilaBloque(MaquinaVirtual *mv, Bloque *bloque){
+    return -1;
+}
+
+void liberaCodigoNativo(Bloque *bloque){
+}
+
+#endif
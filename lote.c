@@ -0,0 +1,636 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include "mv.h"
+
+// Entrada de los trabajos que no tienen archivo de entrada
+#ifdef _WIN32
+#define ARCHIVO_VACIO "NUL"
+#else
+#define ARCHIVO_VACIO "/dev/null"
+#endif
+
+//-------------TRABAJOS DEL LOTE---------------
+typedef struct{
+    char *programa;         //en las copias de una plantilla es el nombre de la entrada
+    char *entrada;          //archivo con la entrada del programa (NULL: sin entrada)
+    char **parametros;
+    int cantParam;
+    uint32_t tamanioMemoria;
+    int resultado;          //0 si termino bien, 1 si no se pudo cargar o fallo
+    int codigoError;        //COD_ERR_* que detuvo el programa, -1 si no hubo
+    uint32_t paginasResidentes, paginasTotales; //memoria que uso el programa (con -memoria)
+    MaquinaVirtual *mv;     //maquina del trabajo mientras esta en curso
+    char *bufferSalida;     //salida acumulada hasta que el trabajo termina
+    size_t tamSalida;
+} TrabajoLote;
+
+// Cola de un hilo: el duenio toma del frente y devuelve al final las maquinas
+// que cedieron (ronda entre ellas); los hilos sin trabajo roban del final
+typedef struct{
+    pthread_mutex_t cerrojo;
+    uint32_t *indices;      //anillo con lugar para todo el lote
+    uint32_t frente, cantidad;
+} ColaTrabajos;
+
+typedef struct{
+    TrabajoLote *trabajos;
+    uint32_t cantidad;
+    const char *dirSalidas;
+    uint32_t cuota;         //instrucciones por turno
+    int hilos;
+    ColaTrabajos *colas;    //una por hilo
+    atomic_uint terminados;
+    FILE *vacio;            //entrada compartida de los trabajos sin archivo de entrada
+    const PlantillaMaquina *plantilla; //si no es NULL, cada trabajo es una copia de la plantilla
+    char *prefijo;          //lo que escribio la plantilla antes del punto de copia
+    size_t tamPrefijo;
+} Lote;
+
+typedef struct{
+    Lote *lote;
+    int numero;
+} Trabajador;
+
+static int agregaTrabajo(Lote *lote, uint32_t *capacidad, const char *programa){
+    if (lote->cantidad == *capacidad) {
+        *capacidad = *capacidad ? *capacidad * 2 : 64;
+        TrabajoLote *nuevos = realloc(lote->trabajos, *capacidad * sizeof(TrabajoLote));
+        if (nuevos == NULL) {
+            return -1;
+        }
+        lote->trabajos = nuevos;
+    }
+    TrabajoLote *t = &lote->trabajos[lote->cantidad++];
+    memset(t, 0, sizeof(TrabajoLote));
+    t->programa = strdup(programa);
+    t->tamanioMemoria = 16384;
+    t->codigoError = -1;
+    return t->programa != NULL ? 0 : -1;
+}
+
+// Cada linea de la lista es un trabajo: programa.vmx [m=M] [entrada=archivo] [-p param...]
+// Las lineas vacias y las que empiezan con # se ignoran
+static int leeListaLote(Lote *lote, const char *nombreLista){
+    FILE *lista = fopen(nombreLista, "r");
+    char linea[4096];
+    uint32_t capacidad = 0;
+
+    if (lista == NULL) {
+        fprintf(stderr, "Error: no se pudo abrir la lista de trabajos '%s'\n", nombreLista);
+        return -1;
+    }
+    while (fgets(linea, sizeof(linea), lista) != NULL) {
+        char *guardado;
+        char *palabra = strtok_r(linea, " \t\r\n", &guardado);
+        if (palabra == NULL || palabra[0] == '#') {
+            continue;
+        }
+        if (agregaTrabajo(lote, &capacidad, palabra) != 0) {
+            fclose(lista);
+            return -1;
+        }
+        TrabajoLote *t = &lote->trabajos[lote->cantidad - 1];
+        int enParametros = 0; //despues de -p todo es parametro del programa
+        while ((palabra = strtok_r(NULL, " \t\r\n", &guardado)) != NULL) {
+            if (enParametros) {
+                t->parametros = realloc(t->parametros, (t->cantParam + 1) * sizeof(char *));
+                t->parametros[t->cantParam++] = strdup(palabra);
+            } else if (strcmp(palabra, "-p") == 0) {
+                enParametros = 1;
+            } else if (strncmp(palabra, "m=", 2) == 0) {
+                int kib = atoi(palabra + 2);
+                if (kib < 1 || kib > 1024) {
+                    fprintf(stderr, "Error: tamanio de memoria invalido en '%s'\n", t->programa);
+                    fclose(lista);
+                    return -1;
+                }
+                t->tamanioMemoria = kib * 1024;
+            } else if (strncmp(palabra, "entrada=", 8) == 0) {
+                t->entrada = strdup(palabra + 8);
+            } else {
+                fprintf(stderr, "Error: opcion desconocida '%s' en la lista de trabajos\n", palabra);
+                fclose(lista);
+                return -1;
+            }
+        }
+    }
+    fclose(lista);
+    return 0;
+}
+
+static int comparaTrabajos(const void *a, const void *b){
+    return strcmp(((const TrabajoLote *)a)->programa, ((const TrabajoLote *)b)->programa);
+}
+
+// Cada linea de la lista de copias es el archivo de entrada de una copia
+static int leeListaCopias(Lote *lote, const char *nombreLista){
+    FILE *lista = fopen(nombreLista, "r");
+    char linea[4096];
+    uint32_t capacidad = 0;
+
+    if (lista == NULL) {
+        fprintf(stderr, "Error: no se pudo abrir la lista de entradas '%s'\n", nombreLista);
+        return -1;
+    }
+    while (fgets(linea, sizeof(linea), lista) != NULL) {
+        char *guardado;
+        char *palabra = strtok_r(linea, "\r\n", &guardado);
+        if (palabra == NULL || palabra[0] == '#') {
+            continue;
+        }
+        if (agregaTrabajo(lote, &capacidad, palabra) != 0) {
+            fclose(lista);
+            return -1;
+        }
+        lote->trabajos[lote->cantidad - 1].entrada = strdup(palabra);
+    }
+    fclose(lista);
+    return 0;
+}
+
+// Todos los .vmx del directorio, en orden alfabetico. Si existe programa.in
+// se usa como entrada del programa. Para las copias de una plantilla son los
+// .in del directorio, uno por copia
+static int leeDirectorioLote(Lote *lote, const char *nombreDir){
+    DIR *dir = opendir(nombreDir);
+    struct dirent *ent;
+    uint32_t capacidad = 0;
+    char ruta[4096];
+    const char *extension = lote->plantilla != NULL ? ".in" : ".vmx";
+    size_t largoExtension = strlen(extension);
+
+    if (dir == NULL) {
+        return -1;
+    }
+    while ((ent = readdir(dir)) != NULL) {
+        size_t largo = strlen(ent->d_name);
+        if (largo <= largoExtension || strcmp(ent->d_name + largo - largoExtension, extension) != 0) {
+            continue;
+        }
+        snprintf(ruta, sizeof(ruta), "%s/%s", nombreDir, ent->d_name);
+        if (agregaTrabajo(lote, &capacidad, ruta) != 0) {
+            closedir(dir);
+            return -1;
+        }
+        if (lote->plantilla == NULL) {
+            strcpy(ruta + strlen(ruta) - 4, ".in");
+        }
+        if (access(ruta, R_OK) == 0) {
+            lote->trabajos[lote->cantidad - 1].entrada = strdup(ruta);
+        }
+    }
+    closedir(dir);
+    qsort(lote->trabajos, lote->cantidad, sizeof(TrabajoLote), comparaTrabajos);
+    return 0;
+}
+
+static void liberaTrabajos(Lote *lote){
+    for (uint32_t i = 0; i < lote->cantidad; i++) {
+        TrabajoLote *t = &lote->trabajos[i];
+        for (int j = 0; j < t->cantParam; j++) {
+            free(t->parametros[j]);
+        }
+        free(t->parametros);
+        free(t->programa);
+        free(t->entrada);
+    }
+    free(lote->trabajos);
+}
+
+//-------------EJECUCION DE UN TRABAJO---------------
+static int archivoComun(FILE *archivo){
+    struct stat info;
+    return fstat(fileno(archivo), &info) != 0 || S_ISREG(info.st_mode);
+}
+
+// Un archivo comun nunca bloquea. En tuberias y FIFOs hay algo para leer si
+// poll lo indica (datos, fin o error: en los tres casos la lectura vuelve)
+int entradaDisponible(FILE *entrada){
+    struct pollfd descriptor;
+
+    if (archivoComun(entrada)) {
+        return 1;
+    }
+    descriptor.fd = fileno(entrada);
+    descriptor.events = POLLIN;
+    return poll(&descriptor, 1, 0) != 0;
+}
+
+// Abrir un FIFO sin escritor espera a que aparezca uno y deja parado al hilo:
+// se abre sin bloquear y queda como una entrada sin datos todavia, asi el SYS
+// READ cede hasta que entradaDisponible vea algo. Las lecturas vuelven a ser
+// bloqueantes (solo se hacen cuando poll avisa que no van a esperar)
+static FILE *abreEntrada(const char *nombre){
+    int descriptor = open(nombre, O_RDONLY | O_NONBLOCK);
+    FILE *archivo = NULL;
+
+    if (descriptor < 0) {
+        return NULL;
+    }
+    int banderas = fcntl(descriptor, F_GETFL);
+    if (banderas != -1 && fcntl(descriptor, F_SETFL, banderas & ~O_NONBLOCK) != -1) {
+        archivo = fdopen(descriptor, "r");
+    }
+    if (archivo == NULL) {
+        close(descriptor);
+    }
+    return archivo;
+}
+
+// Prepara la maquina del trabajo (la que dejo libre el ultimo trabajo del hilo
+// si hay una) y carga el programa o copia la plantilla
+static int iniciaTrabajo(Lote *lote, TrabajoLote *t, MaquinaVirtual **libre){
+    MaquinaVirtual *mv = *libre != NULL ? *libre : creaMaquinaVirtual();
+
+    *libre = NULL;
+    reiniciaMaquinaVirtual(mv);
+    t->mv = mv;
+    // La salida queda en memoria: miles de maquinas en curso no agotan los descriptores
+    mv->entrada = NULL;
+    mv->salida = open_memstream(&t->bufferSalida, &t->tamSalida);
+    if (mv->salida == NULL) {
+        return -1;
+    }
+    if (t->entrada == NULL) {
+        mv->entrada = lote->vacio; //un SYS READ termina con error de lectura
+    } else {
+        mv->entrada = abreEntrada(t->entrada);
+        if (mv->entrada == NULL) {
+            fprintf(mv->salida, "Error: no se pudo abrir la entrada '%s'\n", t->entrada);
+            return -1;
+        }
+        // Sin buffer entradaDisponible ve todo lo que falta leer de una tuberia
+        if (!archivoComun(mv->entrada)) {
+            setvbuf(mv->entrada, NULL, _IONBF, 0);
+        }
+    }
+    if (lote->plantilla != NULL) {
+        fwrite(lote->prefijo, 1, lote->tamPrefijo, mv->salida);
+        return clonaMaquinaVirtual(mv, lote->plantilla);
+    }
+    mv->TAMANIO_MEMORIA = t->tamanioMemoria;
+    inicializaMemoria(mv);
+    return cargaPrograma(mv, t->programa, t->parametros, t->cantParam);
+}
+
+// Nombre del archivo de salida: dirSalidas/NNNN_programa.out
+static void nombreSalida(const Lote *lote, uint32_t indice, char *nombre, size_t tam){
+    const char *base = strrchr(lote->trabajos[indice].programa, '/');
+    base = base != NULL ? base + 1 : lote->trabajos[indice].programa;
+    snprintf(nombre, tam, "%s/%04u_%.*s.out", lote->dirSalidas, indice + 1, (int)(strcspn(base, ".")), base);
+}
+
+// Escribe la salida del trabajo y deja su maquina para el proximo que empiece el hilo
+static void terminaTrabajo(Lote *lote, uint32_t indice, MaquinaVirtual **libre){
+    TrabajoLote *t = &lote->trabajos[indice];
+    MaquinaVirtual *mv = t->mv;
+    char nombre[4096];
+    FILE *archivo;
+
+    t->codigoError = mv->codigoError;
+    if (informeMemoria && mv->MemoriaPrincipal != NULL) {
+        t->paginasResidentes = paginasResidentes(mv, &t->paginasTotales);
+    }
+    if (mv->entrada != NULL && mv->entrada != lote->vacio) {
+        fclose(mv->entrada);
+    }
+    if (mv->salida != NULL) {
+        fclose(mv->salida);
+    }
+    mv->entrada = mv->salida = NULL;
+
+    nombreSalida(lote, indice, nombre, sizeof(nombre));
+    archivo = fopen(nombre, "w");
+    if (archivo == NULL || fwrite(t->bufferSalida, 1, t->tamSalida, archivo) != t->tamSalida) {
+        t->resultado = 1;
+    }
+    if (archivo != NULL) {
+        fclose(archivo);
+    }
+    free(t->bufferSalida);
+    t->bufferSalida = NULL;
+
+    if (*libre == NULL) {
+        *libre = mv;
+    } else {
+        liberaMaquinaVirtual(mv);
+    }
+    t->mv = NULL;
+    atomic_fetch_add(&lote->terminados, 1);
+}
+
+//-------------PLANIFICADOR---------------
+static void encolaTrabajo(ColaTrabajos *cola, uint32_t capacidad, uint32_t indice){
+    pthread_mutex_lock(&cola->cerrojo);
+    cola->indices[(cola->frente + cola->cantidad) % capacidad] = indice;
+    cola->cantidad++;
+    pthread_mutex_unlock(&cola->cerrojo);
+}
+
+static int tomaDelFrente(ColaTrabajos *cola, uint32_t capacidad, uint32_t *indice){
+    int hay;
+    pthread_mutex_lock(&cola->cerrojo);
+    hay = cola->cantidad > 0;
+    if (hay) {
+        *indice = cola->indices[cola->frente];
+        cola->frente = (cola->frente + 1) % capacidad;
+        cola->cantidad--;
+    }
+    pthread_mutex_unlock(&cola->cerrojo);
+    return hay;
+}
+
+static int robaDelFinal(ColaTrabajos *cola, uint32_t capacidad, uint32_t *indice){
+    int hay;
+    pthread_mutex_lock(&cola->cerrojo);
+    hay = cola->cantidad > 0;
+    if (hay) {
+        cola->cantidad--;
+        *indice = cola->indices[(cola->frente + cola->cantidad) % capacidad];
+    }
+    pthread_mutex_unlock(&cola->cerrojo);
+    return hay;
+}
+
+static int robaTrabajo(Lote *lote, int numero, uint32_t *indice){
+    for (int i = 1; i < lote->hilos; i++) {
+        if (robaDelFinal(&lote->colas[(numero + i) % lote->hilos], lote->cantidad, indice)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Nada para ejecutar ahora: no gastar el procesador mientras llega la entrada
+static void esperaUnPoco(){
+    struct timespec pausa = { 0, 100000 };
+    nanosleep(&pausa, NULL);
+}
+
+// Cada hilo ejecuta de a una cuota las maquinas de su cola y roba de las
+// otras cuando se queda sin nada
+static void *trabajadorLote(void *arg){
+    Trabajador *yo = arg;
+    Lote *lote = yo->lote;
+    ColaTrabajos *propia = &lote->colas[yo->numero];
+    MaquinaVirtual *libre = NULL;
+    uint32_t indice, esperando = 0; //maquinas seguidas que siguen sin entrada
+
+    while (atomic_load(&lote->terminados) < lote->cantidad) {
+        if (!tomaDelFrente(propia, lote->cantidad, &indice) && !robaTrabajo(lote, yo->numero, &indice)) {
+            esperaUnPoco();
+            continue;
+        }
+        TrabajoLote *t = &lote->trabajos[indice];
+        if (t->mv == NULL && iniciaTrabajo(lote, t, &libre) != 0) {
+            t->resultado = 1;
+            terminaTrabajo(lote, indice, &libre);
+            continue;
+        }
+        if (t->mv->pausa == PAUSA_ENTRADA && !entradaDisponible(t->mv->entrada)) {
+            encolaTrabajo(propia, lote->cantidad, indice);
+            // Solo se espera si se dio toda la vuelta sin nada para ejecutar
+            if (++esperando >= lote->cantidad - atomic_load(&lote->terminados)) {
+                esperaUnPoco();
+                esperando = 0;
+            }
+            continue;
+        }
+        esperando = 0;
+        int resultado = ejecutarCuota(t->mv, lote->cuota);
+        if (resultado == 0 && t->mv->pausa != PAUSA_NINGUNA) {
+            encolaTrabajo(propia, lote->cantidad, indice);
+            continue;
+        }
+        t->resultado = resultado != 0 || t->mv->codigoError >= 0;
+        terminaTrabajo(lote, indice, &libre);
+    }
+    if (libre != NULL) {
+        liberaMaquinaVirtual(libre);
+    }
+    return NULL;
+}
+
+//-------------EJECUCION DEL LOTE---------------
+// Ejecuta los trabajos ya leidos, informa el resultado de cada uno y los libera
+static int ejecutaTrabajos(Lote *lote, int hilos){
+    pthread_t *hilosCreados;
+    Trabajador *trabajadores;
+    int creados = 0, fallidos = 0;
+
+    if (hilos < 1) {
+        long procesadores = sysconf(_SC_NPROCESSORS_ONLN);
+        hilos = procesadores > 0 ? (int)procesadores : 1;
+    }
+    if ((uint32_t)hilos > lote->cantidad) {
+        hilos = lote->cantidad > 0 ? lote->cantidad : 1;
+    }
+    lote->hilos = hilos;
+
+    // Los trabajos se reparten en ronda entre las colas de los hilos
+    lote->colas = calloc(hilos, sizeof(ColaTrabajos));
+    trabajadores = calloc(hilos, sizeof(Trabajador));
+    hilosCreados = calloc(hilos, sizeof(pthread_t));
+    if (lote->colas == NULL || trabajadores == NULL || hilosCreados == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < hilos; i++) {
+        pthread_mutex_init(&lote->colas[i].cerrojo, NULL);
+        lote->colas[i].indices = malloc((lote->cantidad > 0 ? lote->cantidad : 1) * sizeof(uint32_t));
+        if (lote->colas[i].indices == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        trabajadores[i].lote = lote;
+        trabajadores[i].numero = i;
+    }
+    for (uint32_t i = 0; i < lote->cantidad; i++) {
+        encolaTrabajo(&lote->colas[i % hilos], lote->cantidad, i);
+    }
+
+    for (int i = 0; i < hilos; i++) {
+        if (pthread_create(&hilosCreados[i], NULL, trabajadorLote, &trabajadores[i]) != 0) {
+            break;
+        }
+        creados++;
+    }
+    if (creados < hilos) {
+        trabajadorLote(&trabajadores[creados]); //las colas sin hilo se vacian robando
+    }
+    for (int i = 0; i < creados; i++) {
+        pthread_join(hilosCreados[i], NULL);
+    }
+    for (int i = 0; i < hilos; i++) {
+        pthread_mutex_destroy(&lote->colas[i].cerrojo);
+        free(lote->colas[i].indices);
+    }
+    free(lote->colas);
+    free(trabajadores);
+    free(hilosCreados);
+
+    printf("Lote: %u trabajos, %d hilos, cuota de %u instrucciones\n", lote->cantidad, creados > 0 ? creados : 1, lote->cuota);
+    for (uint32_t i = 0; i < lote->cantidad; i++) {
+        TrabajoLote *t = &lote->trabajos[i];
+        char nombre[4096];
+        nombreSalida(lote, i, nombre, sizeof(nombre));
+        printf("  %04u %-32s %s", i + 1, t->programa, t->resultado == 0 ? "ok" : "error");
+        if (t->codigoError >= 0) {
+            printf(" (codigo %d)", t->codigoError);
+        }
+        if (informeMemoria) {
+            printf(" [%u de %u paginas residentes]", t->paginasResidentes, t->paginasTotales);
+        }
+        printf(" -> %s\n", nombre);
+        fallidos += t->resultado != 0;
+    }
+    printf("Correctos: %u, con error: %d\n", lote->cantidad - fallidos, fallidos);
+
+    liberaTrabajos(lote);
+    return fallidos != 0;
+}
+
+int ejecutarLote(const char *origen, const char *dirSalidas, int hilos, uint32_t cuota){
+    Lote lote;
+    int resultado;
+
+    memset(&lote, 0, sizeof(lote));
+    lote.dirSalidas = dirSalidas;
+    lote.cuota = cuota;
+    atomic_init(&lote.terminados, 0);
+
+    // origen puede ser un directorio con los programas o una lista de trabajos
+    if (leeDirectorioLote(&lote, origen) != 0 && leeListaLote(&lote, origen) != 0) {
+        liberaTrabajos(&lote);
+        return 1;
+    }
+    lote.vacio = fopen(ARCHIVO_VACIO, "r");
+    if (lote.vacio == NULL) {
+        liberaTrabajos(&lote);
+        return 1;
+    }
+    resultado = ejecutaTrabajos(&lote, hilos);
+    fclose(lote.vacio);
+    return resultado;
+}
+
+//-------------COPIAS DE UNA PLANTILLA---------------
+// Ejecuta la maquina ya cargada hasta el punto de copia y deja su memoria lista
+// para las copias. La plantilla pasa a ser duenia de mv. Devuelve 1 si el
+// programa fallo antes de llegar; si termino sin llegar las copias nacen terminadas
+int preparaPlantilla(PlantillaMaquina *plantilla, MaquinaVirtual *mv, uint8_t punto){
+    plantilla->mv = mv;
+    plantilla->descriptor = -1;
+    mv->puntoCopia = punto;
+    if (ejecutarPrograma(mv) != 0 || mv->codigoError >= 0) {
+        return 1;
+    }
+    mv->puntoCopia = PUNTO_NINGUNO;
+    // Las copias no heredan nada pendiente de calcular
+    materializaCC(mv);
+    materializaInternos(mv);
+    plantilla->descriptor = compartirMemoria(mv);
+    if (plantilla->descriptor >= 0) {
+        liberaMemoria(mv); //las copias usan la del archivo
+    }
+    return 0;
+}
+
+// Deja en mv una copia de la plantilla que sigue donde ella se detuvo. Conserva
+// la entrada y la salida de mv; las caches se arman de nuevo en cada copia
+int clonaMaquinaVirtual(MaquinaVirtual *mv, const PlantillaMaquina *plantilla){
+    const MaquinaVirtual *origen = plantilla->mv;
+
+    reiniciaMaquinaVirtual(mv);
+    mv->TAMANIO_MEMORIA = origen->TAMANIO_MEMORIA;
+    if (plantilla->descriptor >= 0) {
+        if (mapeaMemoriaCompartida(mv, plantilla->descriptor) != 0) {
+            fprintf(mv->salida, "Error: no se pudo mapear la memoria de la plantilla\n");
+            return -1;
+        }
+    } else {
+        inicializaMemoria(mv);
+        memcpy(mv->MemoriaPrincipal, origen->MemoriaPrincipal, origen->TAMANIO_MEMORIA);
+    }
+    memcpy(mv->Registros, origen->Registros, sizeof(mv->Registros));
+    memcpy(mv->tablaSegmentos, origen->tablaSegmentos, sizeof(mv->tablaSegmentos));
+    mv->entryPoint = origen->entryPoint;
+    mv->versionPrograma = origen->versionPrograma;
+    mv->continuarEjecucion = origen->continuarEjecucion;
+    mv->pausa = origen->pausa; //ejecutarCuota la reanuda
+    mv->resultadoCC = origen->resultadoCC;
+    mv->ccPendiente = origen->ccPendiente;
+    actualizaTraduccion(mv);
+    return 0;
+}
+
+void liberaPlantilla(PlantillaMaquina *plantilla){
+    if (plantilla->descriptor >= 0) {
+        close(plantilla->descriptor);
+        plantilla->descriptor = -1;
+    }
+    if (plantilla->mv != NULL) {
+        liberaMaquinaVirtual(plantilla->mv);
+        plantilla->mv = NULL;
+    }
+}
+
+// copias=RUTA: mv ya tiene el programa o la imagen cargada. La plantilla corre
+// sin entrada; lo que escribe hasta el punto de copia encabeza cada salida
+int ejecutarCopias(MaquinaVirtual *mv, uint8_t punto, const char *origen, const char *dirSalidas, int hilos, uint32_t cuota){
+    PlantillaMaquina plantilla;
+    Lote lote;
+    int resultado;
+
+    memset(&lote, 0, sizeof(lote));
+    lote.dirSalidas = dirSalidas;
+    lote.cuota = cuota;
+    lote.plantilla = &plantilla;
+    atomic_init(&lote.terminados, 0);
+
+    if (leeDirectorioLote(&lote, origen) != 0 && leeListaCopias(&lote, origen) != 0) {
+        liberaTrabajos(&lote);
+        liberaMaquinaVirtual(mv);
+        return 1;
+    }
+    lote.vacio = fopen(ARCHIVO_VACIO, "r");
+    if (lote.vacio == NULL) {
+        liberaTrabajos(&lote);
+        liberaMaquinaVirtual(mv);
+        return 1;
+    }
+    mv->entrada = lote.vacio;
+    mv->salida = open_memstream(&lote.prefijo, &lote.tamPrefijo);
+    if (mv->salida == NULL) {
+        fclose(lote.vacio);
+        liberaTrabajos(&lote);
+        liberaMaquinaVirtual(mv);
+        return 1;
+    }
+    mv->archivo_vmi = NULL; //los breakpoints de la plantilla no pisan la imagen
+
+    resultado = preparaPlantilla(&plantilla, mv, punto);
+    fclose(mv->salida);
+    mv->salida = NULL;
+    if (resultado != 0) {
+        fwrite(lote.prefijo, 1, lote.tamPrefijo, stdout);
+        fprintf(stderr, "Error: el programa fallo antes del punto de copia\n");
+        liberaTrabajos(&lote);
+    } else {
+        if (mv->pausa != PAUSA_PUNTO) {
+            fprintf(stderr, "Aviso: el programa termino antes del punto de copia\n");
+        }
+        resultado = ejecutaTrabajos(&lote, hilos);
+    }
+    liberaPlantilla(&plantilla);
+    fclose(lote.vacio);
+    free(lote.prefijo);
+    return resultado;
+}
@@ -4,11 +4,8 @@
 #include <time.h>
 #include "mv.h"
 
-uint8_t versionPrograma = 0;
-int continuarEjecucion = 1; //para controlar el bucle
-char *archivo_vmi=NULL;
-extern uint32_t TAMANIO_MEMORIA;
-extern uint32_t entryPoint;
+int motorEjecucion = MOTOR_NIVELES;
+int perfilActivo = 0;
 
 void mostrarUso() {
     printf("Uso: mvx [archivo.vmx] [-d] \n");
@@ -17,33 +14,141 @@ void mostrarUso() {
     printf("  archivo.vmi   : Guardar/Cargar estado de la MV \n");
     printf("  m=M           : Tamanio de la memoria principal (Opcional, 16KiB por defecto) \n");
     printf("  -d            : Mostrar desensamblado \n");
+    printf("  -perfil       : Informar los pares de instrucciones mas frecuentes \n");
+    printf("  motor=E       : Motor de ejecucion: ref, pre, hilado, bloques o niveles (Opcional, niveles por defecto) \n");
+    printf("  niveles=P,B,J : Entradas a un bloque para predecodificarlo, traducirlo y compilarlo (Opcional, %d,%d,%d por defecto) \n", UMBRAL_PREDECODIFICADO, UMBRAL_BLOQUES, UMBRAL_JIT);
+    printf("  -niveles      : Informar el nivel en el que termino cada bloque (usa el motor por niveles) \n");
+    printf("  -rapido       : No actualizar LAR, MAR, MBR, OPC, OP1 y OP2 en cada instruccion (se calculan al consultarlos) \n");
+    printf("  -memoria      : Informar cuantas paginas de la memoria principal se usaron \n");
+    printf("  -incremental  : Guardar en cada breakpoint solo las paginas que cambiaron (en archivo.vmi.dif) \n");
+    printf("  -compactar    : Juntar en archivo.vmi sus diferencias y terminar \n");
+    printf("  -comprimir    : Guardar las imagenes .vmi comprimidas (version 2) \n");
+    printf("  asincronico=N : Guardar las imagenes en un proceso hijo sin detener la ejecucion, hasta N a la vez (maximo %d) \n", MAX_IMAGENES_EN_CURSO);
+    printf("  cache=DIR     : Guardar y reutilizar en DIR los programas ya decodificados \n");
+    printf("  -compartir    : Compartir entre las maquinas del proceso las paginas del CS y el KS de un mismo programa \n");
+    printf("  -jit          : Compilar a codigo nativo los bloques mas ejecutados (usa el motor por bloques) \n");
+    printf("  lote=RUTA     : Ejecutar en paralelo los .vmx de un directorio o de una lista de trabajos \n");
+    printf("  hilos=N       : Hilos para el lote (Opcional, uno por procesador por defecto) \n");
+    printf("  salidas=DIR   : Directorio para la salida de cada trabajo del lote (Opcional, el actual por defecto) \n");
+    printf("  cuota=N       : Instrucciones que ejecuta cada programa del lote antes de ceder el hilo (Opcional, %d por defecto) \n", CUOTA_LOTE);
+    printf("  copias=RUTA   : Cargar el programa una vez y ejecutar una copia por cada entrada (los .in de un directorio o una lista) \n");
+    printf("  punto=P       : Donde se copia el programa: lectura (antes del primer SYS READ) o breakpoint (Opcional, lectura por defecto) \n");
     printf("  -p param...   : Parametros para el programa \n");
 }
 
 int main(int argc, char *argv[]) {
     //Procesamient de argumentos
     int desensamblar = 0;
+    int compactar = 0;
     const char *archivo_vmx = NULL;
     char **parametros = NULL;
     int cantParam = 0;
+    const char *lote = NULL;
+    const char *copias = NULL;
+    uint8_t punto = PUNTO_LECTURA;
+    const char *dirSalidas = ".";
+    int hilos = 0;
+    uint32_t cuota = CUOTA_LOTE;
     srand(time(NULL)); // Para la instruccion RND
+    MaquinaVirtual *mv = creaMaquinaVirtual();
 
-    uint32_t TAMANIO_MEMORIA_KiB; //acceso a la variable global
+    uint32_t TAMANIO_MEMORIA_KiB;
 
     printf("Maquina Virtual MV1 y MV2 - UNMDP - Arquitectura de Computadoras\n");
 
     for (int i = 1; i < argc; i++) {
         if(archivo_vmx == NULL && strstr(argv[i], ".vmx")){
             archivo_vmx = argv[i];
-        }else if(archivo_vmi == NULL && strstr(argv[i], ".vmi")){
-            archivo_vmi = argv[i];
+        }else if(mv->archivo_vmi == NULL && strstr(argv[i], ".vmi")){
+            mv->archivo_vmi = argv[i];
         }else if(strncmp(argv[i], "m=", 2) ==0){
             TAMANIO_MEMORIA_KiB = atoi(argv[i]+2);
             if(TAMANIO_MEMORIA_KiB < 1 || TAMANIO_MEMORIA_KiB > 1024){
                 fprintf(stderr, "Error: Tamanio de memoria invalido. Debe ser entre 1 y 1024 KiB.\n");
                 return 1;
             }
-            TAMANIO_MEMORIA = TAMANIO_MEMORIA_KiB * 1024; // Conversión a bytes
+            mv->TAMANIO_MEMORIA = TAMANIO_MEMORIA_KiB * 1024; // Conversión a bytes
+        }else if(strncmp(argv[i], "motor=", 6) == 0){
+            if(strcmp(argv[i]+6, "ref") == 0){
+                motorEjecucion = MOTOR_REFERENCIA;
+            }else if(strcmp(argv[i]+6, "pre") == 0){
+                motorEjecucion = MOTOR_PREDECODIFICADO;
+            }else if(strcmp(argv[i]+6, "hilado") == 0){
+                motorEjecucion = MOTOR_HILADO;
+            }else if(strcmp(argv[i]+6, "bloques") == 0){
+                motorEjecucion = MOTOR_BLOQUES;
+            }else if(strcmp(argv[i]+6, "niveles") == 0){
+                motorEjecucion = MOTOR_NIVELES;
+            }else{
+                fprintf(stderr, "Error: Motor de ejecucion invalido. Debe ser ref, pre, hilado, bloques o niveles.\n");
+                return 1;
+            }
+        }else if(strncmp(argv[i], "niveles=", 8) == 0){
+            // El umbral del JIT es opcional: niveles=P,B o niveles=P,B,J
+            unsigned int pre, bloq, jit = umbralJit;
+            int leidos = sscanf(argv[i]+8, "%u,%u,%u", &pre, &bloq, &jit);
+            if(leidos < 2 || pre < 1 || bloq < pre || jit < 1){
+                fprintf(stderr, "Error: Umbrales invalidos. Deben ser P,B[,J] con 1 <= P <= B y J >= 1.\n");
+                return 1;
+            }
+            umbralPredecodificado = pre;
+            umbralBloques = bloq;
+            umbralJit = jit;
+            motorEjecucion = MOTOR_NIVELES;
+        }else if(strcmp(argv[i], "-niveles") == 0){
+            informeNiveles = 1;
+            motorEjecucion = MOTOR_NIVELES;
+        }else if(strcmp(argv[i], "-rapido") == 0){
+            modoRapido = 1;
+        }else if(strcmp(argv[i], "-memoria") == 0){
+            informeMemoria = 1;
+        }else if(strcmp(argv[i], "-incremental") == 0){
+            imagenIncremental = 1;
+        }else if(strcmp(argv[i], "-compactar") == 0){
+            compactar = 1;
+        }else if(strcmp(argv[i], "-comprimir") == 0){
+            imagenComprimida = 1;
+        }else if(strncmp(argv[i], "asincronico=", 12) == 0){
+            imagenesAsincronicas = strtoul(argv[i]+12, NULL, 10);
+            if(imagenesAsincronicas < 1 || imagenesAsincronicas > MAX_IMAGENES_EN_CURSO){
+                fprintf(stderr, "Error: Cantidad de imagenes en curso invalida. Debe ser entre 1 y %d.\n", MAX_IMAGENES_EN_CURSO);
+                return 1;
+            }
+        }else if(strncmp(argv[i], "cache=", 6) == 0){
+            dirCachePrograma = argv[i]+6;
+        }else if(strcmp(argv[i], "-compartir") == 0){
+            segmentosCompartidos = 1;
+        }else if(strcmp(argv[i], "-jit") == 0){
+            jitActivo = 1;
+        }else if(strcmp(argv[i], "-perfil") == 0){
+            perfilActivo = 1;
+        }else if(strncmp(argv[i], "lote=", 5) == 0){
+            lote = argv[i]+5;
+        }else if(strncmp(argv[i], "copias=", 7) == 0){
+            copias = argv[i]+7;
+        }else if(strncmp(argv[i], "punto=", 6) == 0){
+            if(strcmp(argv[i]+6, "lectura") == 0){
+                punto = PUNTO_LECTURA;
+            }else if(strcmp(argv[i]+6, "breakpoint") == 0){
+                punto = PUNTO_BREAKPOINT;
+            }else{
+                fprintf(stderr, "Error: Punto de copia invalido. Debe ser lectura o breakpoint.\n");
+                return 1;
+            }
+        }else if(strncmp(argv[i], "hilos=", 6) == 0){
+            hilos = atoi(argv[i]+6);
+            if(hilos < 1){
+                fprintf(stderr, "Error: Cantidad de hilos invalida.\n");
+                return 1;
+            }
+        }else if(strncmp(argv[i], "cuota=", 6) == 0){
+            cuota = strtoul(argv[i]+6, NULL, 10);
+            if(cuota < 1 || cuota == SIN_CUOTA){
+                fprintf(stderr, "Error: Cuota invalida.\n");
+                return 1;
+            }
+        }else if(strncmp(argv[i], "salidas=", 8) == 0){
+            dirSalidas = argv[i]+8;
         }else if(strcmp(argv[i], "-d") == 0){
             desensamblar = 1;
         }else if(strcmp(argv[i], "-p") == 0){
@@ -56,16 +161,42 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    // El JIT compila bloques basicos: solo funciona sobre los motores por bloques
+    if (jitActivo) {
+        if (!JIT_DISPONIBLE) {
+            fprintf(stderr, "Aviso: JIT no disponible en esta plataforma, se usa el interprete\n");
+            jitActivo = 0;
+        }
+        if (motorEjecucion != MOTOR_NIVELES) {
+            motorEjecucion = MOTOR_BLOQUES;
+        }
+    }
+
+    if (imagenesAsincronicas && !IMAGEN_ASINCRONICA) {
+        fprintf(stderr, "Aviso: imagenes en segundo plano no disponibles en esta plataforma, se guardan en el breakpoint\n");
+        imagenesAsincronicas = 0;
+    }
+
+    // Modo lote: cada trabajo usa su propia maquina
+    if (lote != NULL) {
+        liberaMaquinaVirtual(mv);
+        return ejecutarLote(lote, dirSalidas, hilos, cuota);
+    }
+
     //Verifica que haya al menos un archivo de programa
-    if (archivo_vmx == NULL && archivo_vmi == NULL) {
+    if (archivo_vmx == NULL && mv->archivo_vmi == NULL) {
         mostrarUso();
         return 1;
     }
+    if (compactar && (archivo_vmx != NULL || mv->archivo_vmi == NULL)) {
+        fprintf(stderr, "Error: -compactar solo recibe una imagen .vmi\n");
+        return 1;
+    }
     
-    if(archivo_vmi !=NULL && archivo_vmx == NULL){
+    if(mv->archivo_vmi !=NULL && archivo_vmx == NULL){
         //Solo carga imagen
-        inicializaMemoria();
-        if(cargarImagenVMI(archivo_vmi) !=0){
+        inicializaMemoria(mv);
+        if(cargarImagenVMI(mv, mv->archivo_vmi) !=0){
             fprintf(stderr, "Error al cargar la imagen VMI \n");
             if(parametros!=NULL)
                 free(parametros);
@@ -73,8 +204,8 @@ int main(int argc, char *argv[]) {
         }
     }else{
         //Inicializar memoriay cargar programa
-        inicializaMemoria();
-        if (cargaPrograma(archivo_vmx, parametros, cantParam) != 0) {
+        inicializaMemoria(mv);
+        if (cargaPrograma(mv, archivo_vmx, parametros, cantParam) != 0) {
             fprintf(stderr, "Error al cargar el programa\n");
             if(parametros!=NULL)
                 free(parametros);
@@ -82,20 +213,44 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    // Compactacion: la imagen ya se cargo con sus diferencias
+    if (compactar) {
+        int resultado = compactaImagenVMI(mv, mv->archivo_vmi);
+        if(parametros!=NULL)
+            free(parametros);
+        liberaMaquinaVirtual(mv);
+        return resultado != 0;
+    }
+
+    // Copias: el programa ya cargado es la plantilla de todas
+    if (copias != NULL) {
+        if(parametros!=NULL)
+            free(parametros);
+        return ejecutarCopias(mv, punto, copias, dirSalidas, hilos, cuota);
+    }
+
     // Modo desensamblado
     if (desensamblar) {
-        muestraDesensamblador(versionPrograma);
+        muestraDesensamblador(mv, mv->versionPrograma);
         if(parametros!=NULL)
             free(parametros);
         return 0;
     }
     // Ejecutar
-    int resultado = ejecutarPrograma();
+    int resultado = ejecutarPrograma(mv);
+    if (informeMemoria) {
+        muestraMemoriaResidente(mv, stderr);
+    }
+    if (imagenesAsincronicas) {
+        esperaImagenesEnCurso(mv);
+        muestraImagenesAsincronicas(mv, stderr);
+    }
 
     // Limpieza
     if(parametros!=NULL){
         free(parametros);
     }
+    liberaMaquinaVirtual(mv);
 
     return resultado;
 }
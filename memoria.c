@@ -0,0 +1,424 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mv.h"
+
+//-------------VARIABLES GLOBALES---------------
+int informeMemoria = 0; // se activa con -memoria
+int segmentosCompartidos = 0; // se activa con -compartir
+
+#if MEMORIA_DIFERIDA
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#ifdef __APPLE__
+typedef char VectorResidencia;
+#else
+typedef unsigned char VectorResidencia;
+#endif
+#endif
+
+static size_t tamanioPagina(void){
+#if MEMORIA_DIFERIDA
+    long pagina = sysconf(_SC_PAGESIZE);
+    if (pagina > 0) {
+        return (size_t)pagina;
+    }
+#endif
+    return 4096;
+}
+
+static size_t redondeaAPaginas(uint32_t tamanio){
+    size_t pagina = tamanioPagina();
+    return (tamanio + pagina - 1) / pagina * pagina;
+}
+
+//---------------RESERVA DE LA MEMORIA PRINCIPAL---------------
+// La memoria se pide al sistema sin tocarla: cada pagina se reserva y se pone
+// en cero recien cuando el programa la usa por primera vez
+uint8_t *reservaMemoria(uint32_t tamanio){
+#if MEMORIA_DIFERIDA
+    void *memoria = mmap(NULL, redondeaAPaginas(tamanio), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return memoria != MAP_FAILED ? memoria : NULL;
+#else
+    return calloc(1, tamanio);
+#endif
+}
+
+#if MEMORIA_DIFERIDA
+static void desligaCompartidos(MaquinaVirtual *mv);
+#endif
+
+void liberaMemoria(MaquinaVirtual *mv){
+    if (mv->MemoriaPrincipal == NULL) {
+        return;
+    }
+#if MEMORIA_DIFERIDA
+    desligaCompartidos(mv);
+    if (mv->mapeoImagen != NULL) {
+        munmap(mv->mapeoImagen, mv->tamMapeoImagen);
+    } else {
+        munmap(mv->MemoriaPrincipal, redondeaAPaginas(mv->memoriaReservada));
+    }
+#else
+    free(mv->MemoriaPrincipal);
+#endif
+    mv->MemoriaPrincipal = NULL;
+    mv->mapeoImagen = NULL;
+    mv->tamMapeoImagen = 0;
+}
+
+// Vuelve a poner la memoria en cero para reutilizarla. En Linux las paginas se
+// devuelven al sistema y vuelven en cero la proxima vez que se usen
+void limpiaMemoria(MaquinaVirtual *mv){
+#if MEMORIA_DIFERIDA && defined(__linux__)
+    if (madvise(mv->MemoriaPrincipal, redondeaAPaginas(mv->memoriaReservada), MADV_DONTNEED) == 0) {
+        return;
+    }
+#endif
+    memset(mv->MemoriaPrincipal, 0, mv->memoriaReservada);
+}
+
+// Mapea la memoria guardada en una imagen .vmi a partir de desplazamiento.
+// El mapeo es privado: las paginas se leen del archivo cuando se usan y se
+// copian recien cuando el programa las escribe. Devuelve -1 si no se puede
+// (el archivo es corto o no se puede mapear) y la memoria queda como estaba
+int mapeaMemoriaImagen(MaquinaVirtual *mv, const char *nombre, uint32_t desplazamiento){
+#if MEMORIA_DIFERIDA
+    int descriptor = open(nombre, O_RDONLY);
+    struct stat estado;
+    size_t largo = (size_t)desplazamiento + mv->TAMANIO_MEMORIA;
+
+    if (descriptor < 0) {
+        return -1;
+    }
+    if (fstat(descriptor, &estado) != 0 || !S_ISREG(estado.st_mode) || (size_t)estado.st_size < largo) {
+        close(descriptor);
+        return -1;
+    }
+    // Se mapea desde el principio del archivo: el desplazamiento no esta alineado a pagina
+    void *mapeo = mmap(NULL, largo, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (mapeo == MAP_FAILED) {
+        return -1;
+    }
+    liberaMemoria(mv);
+    mv->mapeoImagen = mapeo;
+    mv->tamMapeoImagen = largo;
+    mv->MemoriaPrincipal = (uint8_t *)mapeo + desplazamiento;
+    mv->memoriaReservada = mv->TAMANIO_MEMORIA;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+//---------------MEMORIA DE LAS PLANTILLAS---------------
+#if MEMORIA_DIFERIDA
+// Archivo de largo bytes (en cero) que desaparece al cerrar el descriptor
+static int creaArchivoSinNombre(size_t largo){
+    int descriptor;
+#ifdef MFD_CLOEXEC
+    descriptor = memfd_create("mv", MFD_CLOEXEC);
+#else
+    char nombre[] = "/tmp/mv-XXXXXX";
+    descriptor = mkstemp(nombre);
+    if (descriptor >= 0) {
+        unlink(nombre);
+    }
+#endif
+    if (descriptor >= 0 && ftruncate(descriptor, largo) != 0) {
+        close(descriptor);
+        return -1;
+    }
+    return descriptor;
+}
+#endif
+
+// Copia la memoria a un archivo sin nombre para que las copias de una plantilla
+// la mapeen. Las paginas en cero no se escriben: el archivo queda con huecos.
+// Devuelve el descriptor, o -1 si no se puede (las copias usan memcpy)
+int compartirMemoria(MaquinaVirtual *mv){
+#if MEMORIA_DIFERIDA
+    size_t pagina = tamanioPagina();
+    int descriptor = creaArchivoSinNombre(redondeaAPaginas(mv->TAMANIO_MEMORIA));
+
+    if (descriptor < 0) {
+        return -1;
+    }
+    for (size_t desde = 0; desde < mv->TAMANIO_MEMORIA; desde += pagina) {
+        size_t cantidad = mv->TAMANIO_MEMORIA - desde < pagina ? mv->TAMANIO_MEMORIA - desde : pagina;
+        const uint8_t *datos = mv->MemoriaPrincipal + desde;
+        size_t i = 0;
+        while (i < cantidad && datos[i] == 0) {
+            i++;
+        }
+        if (i < cantidad && pwrite(descriptor, datos, cantidad, desde) != (ssize_t)cantidad) {
+            close(descriptor);
+            return -1;
+        }
+    }
+    return descriptor;
+#else
+    return -1;
+#endif
+}
+
+// Mapea de forma privada la memoria que dejo compartirMemoria
+int mapeaMemoriaCompartida(MaquinaVirtual *mv, int descriptor){
+#if MEMORIA_DIFERIDA
+    size_t largo = redondeaAPaginas(mv->TAMANIO_MEMORIA);
+    void *mapeo = mmap(NULL, largo, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+    if (mapeo == MAP_FAILED) {
+        return -1;
+    }
+    liberaMemoria(mv);
+    mv->mapeoImagen = mapeo;
+    mv->tamMapeoImagen = largo;
+    mv->MemoriaPrincipal = mapeo;
+    mv->memoriaReservada = mv->TAMANIO_MEMORIA;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+//---------------SEGMENTOS COMPARTIDOS---------------
+#if MEMORIA_DIFERIDA
+// Paginas compartidas por contenido y posicion, con las maquinas que las mapean
+typedef struct SegmentosCompartidos{
+    struct SegmentosCompartidos *siguiente;
+    int descriptor;
+    uint32_t inicio, largo;     //rango fisico, en paginas enteras
+    const uint8_t *contenido;   //mapeo propio del archivo para comparar y copiar
+    uint32_t maquinas;
+} SegmentosCompartidos;
+
+static SegmentosCompartidos *listaCompartidos = NULL;
+static pthread_mutex_t cerrojoCompartidos = PTHREAD_MUTEX_INITIALIZER;
+
+// Devuelve las paginas con ese contenido en esa posicion, creandolas si no
+// estan. NULL si no se pudo crear el archivo
+static SegmentosCompartidos *tomaCompartidos(const uint8_t *datos, uint32_t inicio, uint32_t largo){
+    SegmentosCompartidos *s;
+
+    pthread_mutex_lock(&cerrojoCompartidos);
+    for (s = listaCompartidos; s != NULL; s = s->siguiente) {
+        if (s->inicio == inicio && s->largo == largo && memcmp(s->contenido, datos, largo) == 0) {
+            s->maquinas++;
+            pthread_mutex_unlock(&cerrojoCompartidos);
+            return s;
+        }
+    }
+    s = calloc(1, sizeof(SegmentosCompartidos));
+    if (s != NULL) {
+        s->descriptor = creaArchivoSinNombre(largo);
+        void *mapeo = MAP_FAILED;
+        if (s->descriptor >= 0 && pwrite(s->descriptor, datos, largo, 0) == (ssize_t)largo) {
+            mapeo = mmap(NULL, largo, PROT_READ, MAP_SHARED, s->descriptor, 0);
+        }
+        if (mapeo == MAP_FAILED) {
+            if (s->descriptor >= 0) {
+                close(s->descriptor);
+            }
+            free(s);
+            s = NULL;
+        } else {
+            s->contenido = mapeo;
+            s->inicio = inicio;
+            s->largo = largo;
+            s->maquinas = 1;
+            s->siguiente = listaCompartidos;
+            listaCompartidos = s;
+        }
+    }
+    pthread_mutex_unlock(&cerrojoCompartidos);
+    return s;
+}
+
+static void sueltaCompartidos(SegmentosCompartidos *s){
+    pthread_mutex_lock(&cerrojoCompartidos);
+    if (--s->maquinas == 0) {
+        SegmentosCompartidos **anterior = &listaCompartidos;
+        while (*anterior != s) {
+            anterior = &(*anterior)->siguiente;
+        }
+        *anterior = s->siguiente;
+        munmap((void *)s->contenido, s->largo);
+        close(s->descriptor);
+        free(s);
+    }
+    pthread_mutex_unlock(&cerrojoCompartidos);
+}
+
+// La maquina deja de usar las paginas compartidas (su rango queda sin tocar)
+static void desligaCompartidos(MaquinaVirtual *mv){
+    if (mv->compartidos != NULL) {
+        sueltaCompartidos(mv->compartidos);
+        mv->compartidos = NULL;
+        mv->inicioCompartido = mv->finCompartido = 0;
+    }
+}
+
+// Vuelve a poner memoria anonima propia de la maquina en el rango compartido
+static uint8_t *reponePaginas(MaquinaVirtual *mv){
+    uint8_t *inicio = mv->MemoriaPrincipal + mv->inicioCompartido;
+    if (mmap(inicio, mv->finCompartido - mv->inicioCompartido, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0) == MAP_FAILED) {
+        exit(EXIT_FAILURE);
+    }
+    return inicio;
+}
+#endif
+
+// El KS y el CS ocupan [inicio, fin) de la memoria, ya cargados. Solo se
+// comparten las paginas que quedan enteras dentro del rango
+void compartirSegmentos(MaquinaVirtual *mv, uint32_t inicio, uint32_t fin){
+#if MEMORIA_DIFERIDA
+    size_t pagina = tamanioPagina();
+    uint32_t desde = (inicio + pagina - 1) / pagina * pagina;
+    uint32_t hasta = fin / pagina * pagina;
+    SegmentosCompartidos *s;
+
+    // La memoria de una imagen mapeada no esta alineada a pagina
+    if (!segmentosCompartidos || mv->compartidos != NULL || mv->mapeoImagen != NULL || hasta <= desde) {
+        return;
+    }
+    s = tomaCompartidos(mv->MemoriaPrincipal + desde, desde, hasta - desde);
+    if (s == NULL) {
+        return;
+    }
+    mv->compartidos = s;
+    mv->inicioCompartido = desde;
+    mv->finCompartido = hasta;
+    if (mmap(mv->MemoriaPrincipal + desde, hasta - desde, PROT_READ, MAP_SHARED | MAP_FIXED, s->descriptor, 0) == MAP_FAILED) {
+        privatizaSegmentos(mv);
+    }
+#endif
+}
+
+// Antes de escribir sobre las paginas compartidas la maquina se queda con una copia
+void privatizaSegmentos(MaquinaVirtual *mv){
+#if MEMORIA_DIFERIDA
+    if (mv->compartidos != NULL) {
+        memcpy(reponePaginas(mv), mv->compartidos->contenido, mv->finCompartido - mv->inicioCompartido);
+        desligaCompartidos(mv);
+    }
+#endif
+}
+
+// Para reutilizar la memoria: el rango compartido vuelve a ser memoria en cero
+void liberaSegmentosCompartidos(MaquinaVirtual *mv){
+#if MEMORIA_DIFERIDA
+    if (mv->compartidos != NULL) {
+        reponePaginas(mv);
+        desligaCompartidos(mv);
+    }
+#endif
+}
+
+// Paginas de la memoria que ocupan memoria real. Sin mincore se informan todas
+uint32_t paginasResidentes(MaquinaVirtual *mv, uint32_t *total){
+#if MEMORIA_DIFERIDA
+    const uint8_t *memoria = mv->mapeoImagen != NULL ? mv->mapeoImagen : mv->MemoriaPrincipal;
+    size_t pagina = tamanioPagina();
+    size_t largo = redondeaAPaginas(mv->mapeoImagen != NULL ? mv->tamMapeoImagen : mv->memoriaReservada);
+    uint32_t cantidad = largo / pagina, residentes = 0;
+    VectorResidencia *vector = malloc(cantidad);
+
+    *total = cantidad;
+    if (vector == NULL || mincore((void *)memoria, largo, vector) != 0) {
+        free(vector);
+        return cantidad;
+    }
+    for (uint32_t i = 0; i < cantidad; i++) {
+        residentes += vector[i] & 1;
+    }
+    free(vector);
+    return residentes;
+#else
+    *total = redondeaAPaginas(mv->memoriaReservada) / tamanioPagina();
+    return *total;
+#endif
+}
+
+void muestraMemoriaResidente(MaquinaVirtual *mv, FILE *salida){
+    uint32_t total, residentes;
+
+    if (mv->MemoriaPrincipal == NULL) {
+        return;
+    }
+    residentes = paginasResidentes(mv, &total);
+    fprintf(salida, "\nMemoria: %u de %u paginas residentes (%u KiB de %u KiB)\n",
+            residentes, total, (uint32_t)(residentes * tamanioPagina() / 1024), mv->memoriaReservada / 1024);
+}
+
+//---------------ARCHIVOS MAPEADOS---------------
+// El archivo se mapea de solo lectura: si ya esta en la cache de paginas del
+// sistema, cargarlo no hace lecturas. Lo que no se puede mapear (una tuberia,
+// un archivo vacio) se lee entero a un buffer
+int mapeaArchivo(const char *nombre, ArchivoMapeado *archivo){
+    memset(archivo, 0, sizeof(ArchivoMapeado));
+#if MEMORIA_DIFERIDA
+    int descriptor = open(nombre, O_RDONLY);
+    struct stat estado;
+
+    if (descriptor < 0) {
+        return -1;
+    }
+    if (fstat(descriptor, &estado) == 0 && S_ISREG(estado.st_mode) && estado.st_size > 0) {
+        void *mapeo = mmap(NULL, estado.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (mapeo != MAP_FAILED) {
+            close(descriptor);
+            archivo->datos = mapeo;
+            archivo->tamanio = estado.st_size;
+            archivo->mapeado = 1;
+            return 0;
+        }
+    }
+    close(descriptor);
+#endif
+    FILE *arch = fopen(nombre, "rb");
+    size_t capacidad = 0;
+    uint8_t *datos = NULL;
+
+    if (arch == NULL) {
+        return -1;
+    }
+    for (;;) {
+        if (archivo->tamanio == capacidad) {
+            capacidad = capacidad ? 2 * capacidad : 4096;
+            uint8_t *nuevos = realloc(datos, capacidad);
+            if (nuevos == NULL) {
+                free(datos);
+                fclose(arch);
+                return -1;
+            }
+            datos = nuevos;
+        }
+        size_t leidos = fread(datos + archivo->tamanio, 1, capacidad - archivo->tamanio, arch);
+        if (leidos == 0) {
+            break;
+        }
+        archivo->tamanio += leidos;
+    }
+    fclose(arch);
+    archivo->datos = datos;
+    return 0;
+}
+
+void liberaArchivoMapeado(ArchivoMapeado *archivo){
+#if MEMORIA_DIFERIDA
+    if (archivo->mapeado) {
+        munmap((void *)archivo->datos, archivo->tamanio);
+        archivo->datos = NULL;
+        return;
+    }
+#endif
+    free((void *)archivo->datos);
+    archivo->datos = NULL;
+}
@@ -0,0 +1,569 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "mv.h"
+
+// Con GCC/Clang cada manejador salta directamente al siguiente (goto computado).
+// Otros compiladores usan el mismo codigo despachado desde un switch.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(MV_SIN_GOTO_COMPUTADO)
+#define USA_GOTO_COMPUTADO 1
+#else
+#define USA_GOTO_COMPUTADO 0
+#endif
+
+//---------------SELECCION DE MANEJADOR---------------
+//Formas de operandos, en el orden de FORMAS_COMPLETAS
+#define FORMA_RR 0
+#define FORMA_RI 1
+#define FORMA_RM 2
+#define FORMA_MR 3
+#define FORMA_MI 4
+
+static int formaOperandos(const InstruccionDecodificada *ins){
+    int registroA = ins->tipoA == OP_REG && ((ins->operandoA >> 6) & 0x03) == 0;
+    int memoriaA = ins->tipoA == OP_MEM && ins->tamA == 4;
+
+    if (ins->tipoB == OP_REG && ((ins->operandoB >> 6) & 0x03) == 0) {
+        return registroA ? FORMA_RR : memoriaA ? FORMA_MR : -1;
+    }
+    if (ins->tipoB == OP_INM) {
+        return registroA ? FORMA_RI : memoriaA ? FORMA_MI : -1;
+    }
+    if (ins->tipoB == OP_MEM && ins->tamB == 4 && registroA) {
+        return FORMA_RM;
+    }
+    return -1;
+}
+
+static uint8_t especializado(int forma, int cantFormas, uint8_t primero, uint8_t generico){
+    return (forma >= 0 && forma < cantFormas) ? primero + forma : generico;
+}
+
+uint8_t seleccionaManejador(const InstruccionDecodificada *ins){
+    int forma = formaOperandos(ins);
+
+    switch(ins->codOp){
+        case OP_MOV: return especializado(forma, 5, MANEJ_MOV_RR, MANEJ_MOV);
+        case OP_ADD: return especializado(forma, 5, MANEJ_ADD_RR, MANEJ_ADD);
+        case OP_SUB: return especializado(forma, 5, MANEJ_SUB_RR, MANEJ_SUB);
+        case OP_MUL: return especializado(forma, 5, MANEJ_MUL_RR, MANEJ_MUL);
+        case OP_DIV: return MANEJ_DIV;
+        case OP_CMP: return especializado(forma, 5, MANEJ_CMP_RR, MANEJ_CMP);
+        case OP_SHL: return especializado(forma, 2, MANEJ_SHL_RR, MANEJ_SHL);
+        case OP_SHR: return especializado(forma, 2, MANEJ_SHR_RR, MANEJ_SHR);
+        case OP_SAR: return especializado(forma, 2, MANEJ_SAR_RR, MANEJ_SAR);
+        case OP_AND: return especializado(forma, 5, MANEJ_AND_RR, MANEJ_AND);
+        case OP_OR: return especializado(forma, 5, MANEJ_OR_RR, MANEJ_OR);
+        case OP_XOR: return especializado(forma, 5, MANEJ_XOR_RR, MANEJ_XOR);
+        case OP_SWAP: return MANEJ_SWAP;
+        case OP_LDL: return MANEJ_LDL;
+        case OP_LDH: return MANEJ_LDH;
+        case OP_RND: return MANEJ_RND;
+        case OP_SYS: return MANEJ_SYS;
+        case OP_NOT: return MANEJ_NOT;
+        case OP_RET: return MANEJ_RET;
+        case OP_STOP: return MANEJ_STOP;
+        case OP_JMP: case OP_JZ: case OP_JP: case OP_JN:
+        case OP_JNZ: case OP_JNP: case OP_JNN:
+            // Los saltos por registro o inmediato no pueden fallar y no verifican continuarEjecucion
+            if (ins->tipoA == OP_MEM) {
+                return MANEJ_GENERICO;
+            }
+            return MANEJ_JMP + (ins->codOp - OP_JMP);
+        case OP_CALL:
+            // CALL por registro o memoria, o con destino fuera del CS: camino comun
+            return (ins->verificada & VERIF_DESTINO) ? MANEJ_CALL : MANEJ_GENERICO;
+        default:
+            return MANEJ_GENERICO; //PUSH y POP
+    }
+}
+
+//---------------FUSION DE SUPERINSTRUCCIONES---------------
+// Instruccion que sigue a ins en el flujo secuencial, decodificada si hace falta
+static InstruccionDecodificada *siguienteDecodificada(MaquinaVirtual *mv, InstruccionDecodificada *cache, uint32_t tamCS, const InstruccionDecodificada *ins){
+    if (ins->siguiente >= tamCS) {
+        return NULL;
+    }
+    InstruccionDecodificada *sig = &cache[ins->siguiente];
+    if (sig->estado == PRE_VACIA) {
+        decodificaInstruccion(mv, ins->siguiente, sig);
+    }
+    return sig->estado == PRE_OK ? sig : NULL;
+}
+
+// Solo se fusionan saltos con el destino verificado al decodificar
+static int esSaltoInmediato(const InstruccionDecodificada *ins){
+    return ins != NULL && ins->codOp >= OP_JMP && ins->codOp <= OP_JNN && ins->tipoA == OP_INM &&
+           (ins->verificada & VERIF_DESTINO);
+}
+
+void fusionaInstruccion(MaquinaVirtual *mv, InstruccionDecodificada *cache, uint32_t tamCS, uint32_t offset){
+    InstruccionDecodificada *ins = &cache[offset];
+    InstruccionDecodificada *seg = siguienteDecodificada(mv, cache, tamCS, ins);
+    uint8_t manejador = seleccionaManejador(ins);
+
+    ins->manejador = manejador;
+    if (seg == NULL) {
+        return;
+    }
+    // Se compara contra el manejador sin fusionar: seg puede ser a su vez el inicio de otra superinstruccion
+    uint8_t manejadorSeg = seleccionaManejador(seg);
+
+    switch(manejador){
+        case MANEJ_CMP_RR:
+        case MANEJ_CMP_RI:{
+            if (esSaltoInmediato(seg)) {
+                uint8_t primero = manejador == MANEJ_CMP_RR ? MANEJ_CMP_RR_JMP : MANEJ_CMP_RI_JMP;
+                ins->manejador = primero + (seg->codOp - OP_JMP);
+            }
+            break;
+        }
+        case MANEJ_ADD_RI:
+        case MANEJ_SUB_RI:{
+            if (manejadorSeg == MANEJ_CMP_RR || manejadorSeg == MANEJ_CMP_RI) {
+                InstruccionDecodificada *ter = siguienteDecodificada(mv, cache, tamCS, seg);
+                if (esSaltoInmediato(ter)) {
+                    uint8_t primero;
+                    if (manejador == MANEJ_ADD_RI) {
+                        primero = manejadorSeg == MANEJ_CMP_RR ? MANEJ_ADD_CMP_RR_JMP : MANEJ_ADD_CMP_RI_JMP;
+                    } else {
+                        primero = manejadorSeg == MANEJ_CMP_RR ? MANEJ_SUB_CMP_RR_JMP : MANEJ_SUB_CMP_RI_JMP;
+                    }
+                    ins->manejador = primero + (ter->codOp - OP_JMP);
+                }
+            }
+            break;
+        }
+        case MANEJ_MOV_RR:
+        case MANEJ_MOV_RI:
+        case MANEJ_MOV_RM:{
+            if ((manejadorSeg == MANEJ_ADD_RR || manejadorSeg == MANEJ_ADD_RI) &&
+                (seg->operandoA & 0x1F) == (ins->operandoA & 0x1F)) {
+                ins->manejador = MANEJ_MOV_RR_ADD_RR + 2*(manejador - MANEJ_MOV_RR) + (manejadorSeg - MANEJ_ADD_RR);
+            }
+            break;
+        }
+    }
+}
+
+// Cantidad de instrucciones que ejecuta el manejador (1 si no es una superinstruccion)
+int instruccionesFusionadas(uint8_t manejador){
+    if (manejador >= MANEJ_CMP_RR_JMP && manejador <= MANEJ_CMP_RI_JNN) {
+        return 2;
+    }
+    if (manejador >= MANEJ_ADD_CMP_RR_JMP && manejador <= MANEJ_SUB_CMP_RI_JNN) {
+        return 3;
+    }
+    if (manejador >= MANEJ_MOV_RR_ADD_RR && manejador <= MANEJ_MOV_RM_ADD_RI) {
+        return 2;
+    }
+    return 1;
+}
+
+//---------------PERFIL DE PARES DE INSTRUCCIONES---------------
+// Cuenta los pares de instrucciones consecutivas (sin salto entre ellas) para
+// decidir que secuencias conviene fusionar
+int ejecutarProgramaPerfilado(MaquinaVirtual *mv){
+    InstruccionDecodificada *cache = mv->cacheDecodificada;
+    uint8_t posCS = mv->Registros[POS_CS] >> 16;
+    uint32_t tamCS = cache != NULL ? mv->cacheFinCS - mv->cacheBaseCS : 0;
+    uint32_t ipEsperado = 0xFFFFFFFF;
+    int anterior = -1;
+
+    while(mv->continuarEjecucion){
+        uint32_t ip = mv->Registros[POS_IP];
+        InstruccionDecodificada *ins = NULL;
+
+        if (cuotaAgotada(mv, 1)) {
+            break;
+        }
+
+        if ((ip >> 16) == posCS && (ip & 0xFFFF) < tamCS) {
+            ins = &cache[ip & 0xFFFF];
+            if (ins->estado == PRE_VACIA) {
+                decodificaInstruccion(mv, ip & 0xFFFF, ins);
+            }
+        }
+        if (ins != NULL && ins->estado == PRE_OK) {
+            if (anterior >= 0 && ip == ipEsperado) {
+                mv->perfilPares[anterior][ins->codOp]++;
+            }
+            anterior = ins->codOp;
+            ipEsperado = (ip & 0xFFFF0000) | ins->siguiente;
+            mv->perfilInstrucciones++;
+        } else {
+            anterior = -1;
+        }
+
+        if(ejecutarDecodificada(mv)!=0)
+            return 1;
+    }
+    return 0;
+}
+
+static const char *fusionDelPar(uint8_t primera, uint8_t segunda){
+    if (primera == OP_CMP && segunda >= OP_JMP && segunda <= OP_JNN) {
+        return "si (CMP reg + salto inmediato)";
+    }
+    if ((primera == OP_ADD || primera == OP_SUB) && segunda == OP_CMP) {
+        return "si (reg,inm + CMP reg + salto)";
+    }
+    if (primera == OP_MOV && segunda == OP_ADD) {
+        return "si, si es el mismo registro de 32 bits";
+    }
+    return "no";
+}
+
+void muestraPerfilPares(MaquinaVirtual *mv, FILE *salida){
+    #define CANT_PARES_INFORME 15
+    uint64_t totalPares = 0;
+    int mostrados = 0;
+    uint64_t ultimo = UINT64_MAX;
+
+    for (int i = 0; i < 32; i++)
+        for (int j = 0; j < 32; j++)
+            totalPares += mv->perfilPares[i][j];
+
+    fprintf(salida, "\nPerfil: %llu instrucciones, %llu pares consecutivos\n", (unsigned long long)mv->perfilInstrucciones, (unsigned long long)totalPares);
+    fprintf(salida, "  %-12s %12s %7s  %s\n", "Par", "Cantidad", "%", "Fusionado");
+    // Los pares de mayor a menor, sin ordenar la tabla
+    while (mostrados < CANT_PARES_INFORME && totalPares > 0) {
+        uint64_t maximo = 0;
+        for (int i = 0; i < 32; i++)
+            for (int j = 0; j < 32; j++)
+                if (mv->perfilPares[i][j] < ultimo && mv->perfilPares[i][j] > maximo)
+                    maximo = mv->perfilPares[i][j];
+        if (maximo == 0) {
+            break;
+        }
+        for (int i = 0; i < 32 && mostrados < CANT_PARES_INFORME; i++) {
+            for (int j = 0; j < 32 && mostrados < CANT_PARES_INFORME; j++) {
+                if (mv->perfilPares[i][j] == maximo) {
+                    char par[16];
+                    snprintf(par, sizeof(par), "%s+%s", MNEMONICOS[i] ? MNEMONICOS[i] : "??", MNEMONICOS[j] ? MNEMONICOS[j] : "??");
+                    fprintf(salida, "  %-12s %12llu %6.2f%%  %s\n", par, (unsigned long long)maximo, 100.0 * maximo / totalPares, fusionDelPar(i, j));
+                    mostrados++;
+                }
+            }
+        }
+        ultimo = maximo;
+    }
+}
+
+//---------------MOTOR HILADO---------------
+#if USA_GOTO_COMPUTADO
+#define MANEJADOR(m) L_##m
+#define ETIQUETA_MANEJADOR(m) [MANEJ_##m] = &&L_##m,
+#define ETIQUETA_ESPECIALIZADO(op, forma) [MANEJ_##op##_##forma] = &&L_##op##_##forma,
+#define ETIQUETA_FUSION(primera, ultima) [MANEJ_##primera##_##ultima] = &&L_##primera##_##ultima,
+#define SALTAR_A_MANEJADOR() goto *tablaManejadores[ins->manejador]
+#else
+#define MANEJADOR(m) case MANEJ_##m
+#define SALTAR_A_MANEJADOR() goto despachar
+#endif
+
+// Despacho directo: solo para manejadores que no pueden detener la ejecucion
+#define DESPACHAR_DIRECTO() AVANZAR(1)
+// Despacho luego de algo que pudo detectar un error o un STOP
+#define DESPACHAR() do{ if (!mv->continuarEjecucion) goto fin; DESPACHAR_DIRECTO(); }while(0)
+
+// OPC, OP1 y OP2 como los deja ejecutarInstruccion. En modo rapido solo se
+// recuerda la instruccion: materializaInternos los calcula si alguien los mira
+#define REGISTROS_OP(x) do{ \
+        if (rapido) { \
+            mv->instruccionPendiente = (x); \
+        } else { \
+            mv->Registros[POS_OPC] = (x)->codOp; \
+            mv->Registros[POS_OP1] = (x)->valorOP1; \
+            mv->Registros[POS_OP2] = (x)->valorOP2; \
+        } \
+    }while(0)
+
+// Avanza IP y deja OPC, OP1 y OP2 como los deja ejecutarInstruccion. Lo que
+// sigue es el camino comun (ejecutarXXX), que actualiza todo en cada acceso
+#define PROLOGO() do{ \
+        if (rapido) materializaInternos(mv); \
+        mv->Registros[POS_IP] = segmentoCS | ins->siguiente; \
+        mv->Registros[POS_OPC] = ins->codOp; \
+        mv->Registros[POS_OP1] = ins->valorOP1; \
+        mv->Registros[POS_OP2] = ins->valorOP2; \
+        operandoA = ins->tipoA == OP_MEM ? direccionOperando(mv, ins->regA, ins->operandoA) : ins->operandoA; \
+        operandoB = ins->tipoB == OP_MEM ? direccionOperando(mv, ins->regB, ins->operandoB) : ins->operandoB; \
+    }while(0)
+
+#define MANEJADOR_DOS_OPERANDOS(m) \
+    MANEJADOR(m): \
+        PROLOGO(); \
+        ejecutar##m(mv, ins->tipoA, operandoA, ins->tipoB, operandoB, ins->tamA, ins->tamB); \
+        DESPACHAR();
+
+//---------------MANEJADORES ESPECIALIZADOS---------------
+// Acceso a memoria de 4 bytes con el mismo efecto sobre LAR, MAR y MBR que
+// obtenerValorOperando/escribirValorOperando, sin ramificar por tipo ni tamanio
+// En modo rapido solo se recuerda la direccion logica del acceso
+static inline void registraAccesoLong(MaquinaVirtual *mv, uint32_t direccionLogica, uint32_t direccionFisica, int32_t valor, int rapido){
+    if (rapido) {
+        mv->accesoPendienteLAR = direccionLogica;
+        mv->accesoPendiente = 1;
+    } else {
+        mv->Registros[POS_LAR] = direccionLogica;
+        mv->Registros[POS_MAR] = (4 << 16) | (direccionFisica & 0x0000FFFF);
+        mv->Registros[POS_MBR] = valor;
+    }
+}
+
+static inline int32_t leeMemoriaLong(MaquinaVirtual *mv, uint32_t direccionLogica, int rapido){
+    uint32_t direccionFisica = traduceAcceso(mv, direccionLogica, 4);
+    int32_t valor = leeMemoriaTraducida(mv, direccionFisica, 4);
+    registraAccesoLong(mv, direccionLogica, direccionFisica, valor, rapido);
+    return valor;
+}
+
+static inline void escribeMemoriaLong(MaquinaVirtual *mv, uint32_t direccionLogica, int32_t valor, int rapido){
+    uint32_t direccionFisica = traduceAcceso(mv, direccionLogica, 4);
+    escribeMemoriaTraducida(mv, direccionFisica, valor, 4);
+    registraAccesoLong(mv, direccionLogica, direccionFisica, valor, rapido);
+}
+
+static inline void actualizaCC(MaquinaVirtual *mv, int32_t resultado){
+    mv->resultadoCC = resultado;
+    mv->ccPendiente = 1;
+}
+
+// Operando fuente (B) de cada forma para la instruccion x
+#define FUENTE_RR(x) ((int32_t)mv->Registros[(x)->operandoB & 0x1F])
+#define FUENTE_RI(x) ((int32_t)(x)->operandoB)
+#define FUENTE_RM(x) leeMemoriaLong(mv, direccionOperando(mv, (x)->regB, (x)->operandoB), rapido)
+#define FUENTE_MR(x) FUENTE_RR(x)
+#define FUENTE_MI(x) FUENTE_RI(x)
+
+// Destino (A) de cada forma: registro de 32 bits o memoria long
+#define DESTINO_RR 0
+#define DESTINO_RI 0
+#define DESTINO_RM 0
+#define DESTINO_MR 1
+#define DESTINO_MI 1
+#define LEER_DESTINO(mem) ((mem) ? leeMemoriaLong(mv, dirA, rapido) : (int32_t)mv->Registros[regA])
+#define ESCRIBIR_DESTINO(mem, v) do{ if (mem) escribeMemoriaLong(mv, dirA, v, rapido); else mv->Registros[regA] = (v); }while(0)
+
+// Verificaciones de desborde de ADD y SUB (las mismas que ejecutarADD/ejecutarSUB)
+#define DESBORDA_ADD(a, b) ((b > 0 && a > INT32_MAX - b) || (b < 0 && a < INT32_MIN - b))
+#define DESBORDA_SUB(a, b) ((b > 0 && a < INT32_MIN + b) || (b < 0 && a > INT32_MAX + b))
+// Resta sin desborde indefinido: el compilador no puede reemplazar (a-b)<0 por a<b
+#define RESTA(a, b) ((int32_t)((uint32_t)(a) - (uint32_t)(b)))
+
+// Semantica de cada operacion (misma verificacion y orden que ejecutarXXX)
+#define OPERA_MOV(mem, b) ESCRIBIR_DESTINO(mem, b)
+#define OPERA_ADD(mem, b) do{ int32_t a = LEER_DESTINO(mem); \
+        if (DESBORDA_ADD(a, b)) { detectaError(mv, COD_ERR_OVF, 0x0); break; } \
+        int32_t r = a + b; ESCRIBIR_DESTINO(mem, r); actualizaCC(mv, r); }while(0)
+#define OPERA_SUB(mem, b) do{ int32_t a = LEER_DESTINO(mem); \
+        if (DESBORDA_SUB(a, b)) { detectaError(mv, COD_ERR_OVF, 0x0); break; } \
+        int32_t r = a - b; ESCRIBIR_DESTINO(mem, r); actualizaCC(mv, r); }while(0)
+#define OPERA_MUL(mem, b) do{ int32_t a = LEER_DESTINO(mem); \
+        if ((b > 0 && a > INT32_MAX / b) || (b == -1 && a == INT32_MIN) || (b < -1 && a < INT32_MIN / b)) { \
+            detectaError(mv, COD_ERR_OVF, 0x0); break; } \
+        int32_t r = (int32_t)((uint32_t)a * (uint32_t)b); ESCRIBIR_DESTINO(mem, r); actualizaCC(mv, r); }while(0)
+#define OPERA_CMP(mem, b) do{ int32_t a = LEER_DESTINO(mem); actualizaCC(mv, RESTA(a, b)); }while(0)
+#define OPERA_AND(mem, b) do{ int32_t r = LEER_DESTINO(mem) & b; ESCRIBIR_DESTINO(mem, r); actualizaCC(mv, r); }while(0)
+#define OPERA_OR(mem, b) do{ int32_t r = LEER_DESTINO(mem) | b; ESCRIBIR_DESTINO(mem, r); actualizaCC(mv, r); }while(0)
+#define OPERA_XOR(mem, b) do{ int32_t r = LEER_DESTINO(mem) ^ b; ESCRIBIR_DESTINO(mem, r); actualizaCC(mv, r); }while(0)
+// Los desplazamientos solo tienen formas con destino registro: verificar B antes de leer A no cambia nada
+#define OPERA_SHL(mem, b) do{ if (b < 0 || b > 31) { detectaError(mv, COD_ERR_OPE, 0x00); break; } \
+        int32_t r = (int32_t)((uint32_t)LEER_DESTINO(mem) << b); ESCRIBIR_DESTINO(mem, r); actualizaCC(mv, r); }while(0)
+#define OPERA_SHR(mem, b) do{ if (b < 0 || b > 31) { detectaError(mv, COD_ERR_OPE, 0x0); break; } \
+        int32_t r = (int32_t)((uint32_t)LEER_DESTINO(mem) >> b); ESCRIBIR_DESTINO(mem, r); actualizaCC(mv, r); }while(0)
+#define OPERA_SAR(mem, b) do{ if (b < 0 || b > 31) { detectaError(mv, COD_ERR_OPE, 0x0); break; } \
+        int32_t r = LEER_DESTINO(mem) >> b; ESCRIBIR_DESTINO(mem, r); actualizaCC(mv, r); }while(0)
+
+// Operaciones que nunca detienen la ejecucion con operandos de registro/inmediato
+#define SIN_FALLA_MOV 1
+#define SIN_FALLA_CMP 1
+#define SIN_FALLA_AND 1
+#define SIN_FALLA_OR 1
+#define SIN_FALLA_XOR 1
+#define SIN_FALLA_ADD 0
+#define SIN_FALLA_SUB 0
+#define SIN_FALLA_MUL 0
+#define SIN_FALLA_SHL 0
+#define SIN_FALLA_SHR 0
+#define SIN_FALLA_SAR 0
+
+#define MANEJADOR_ESPECIALIZADO(op, forma) \
+    MANEJADOR(op##_##forma): { \
+        mv->Registros[POS_IP] = segmentoCS | ins->siguiente; \
+        REGISTROS_OP(ins); \
+        int32_t b = FUENTE_##forma(ins); \
+        uint8_t regA = ins->operandoA & 0x1F; \
+        uint32_t dirA = DESTINO_##forma ? direccionOperando(mv, ins->regA, ins->operandoA) : 0; \
+        (void)regA; (void)dirA; \
+        OPERA_##op(DESTINO_##forma, b); \
+        if (SIN_FALLA_##op && !DESTINO_##forma && FORMA_##forma != FORMA_RM) { \
+            DESPACHAR_DIRECTO(); \
+        } \
+        DESPACHAR(); \
+    }
+
+//---------------SUPERINSTRUCCIONES---------------
+// Deja IP, OPC, OP1 y OP2 como quedan luego de ejecutar la instruccion x
+#define ESTADO_LUEGO_DE(x) do{ \
+        mv->Registros[POS_IP] = segmentoCS | (x)->siguiente; \
+        REGISTROS_OP(x); \
+    }while(0)
+
+// Condicion de cada salto a partir del resultado que dejo los bits N y Z
+#define CONDICION_JMP(r) 1
+#define CONDICION_JZ(r) ((r) == 0)
+#define CONDICION_JP(r) ((r) > 0)
+#define CONDICION_JN(r) ((r) < 0)
+#define CONDICION_JNZ(r) ((r) != 0)
+#define CONDICION_JNP(r) ((r) <= 0)
+#define CONDICION_JNN(r) ((r) >= 0)
+
+// Salto inmediato con destino verificado (esSaltoInmediato): no hace falta
+// repetir el chequeo de calculaDireccionSalto
+#define SALTO_FUSIONADO(salto, sal, r) do{ \
+        ESTADO_LUEGO_DE(sal); \
+        if (CONDICION_##salto(r)) { \
+            mv->Registros[POS_IP] = ((uint32_t)posCS << 16) | (sal)->operandoA; \
+        } \
+    }while(0)
+
+#define FORMA_CMP_RR FORMA_RR
+#define FORMA_CMP_RI FORMA_RI
+#define FUENTE_CMP_RR(x) FUENTE_RR(x)
+#define FUENTE_CMP_RI(x) FUENTE_RI(x)
+
+// CMP reg,(reg|inm) + Jcc: ninguna de las dos puede fallar
+#define MANEJADOR_CMP_SALTO(cmp, salto) \
+    MANEJADOR(cmp##_##salto): { \
+        InstruccionDecodificada *sal = POSTERIOR(ins); \
+        int32_t r = RESTA(mv->Registros[ins->operandoA & 0x1F], FUENTE_##cmp(ins)); \
+        actualizaCC(mv, r); \
+        SALTO_FUSIONADO(salto, sal, r); \
+        AVANZAR(2); \
+    }
+
+// (ADD|SUB) reg,inm + CMP + Jcc: el CC que deja la suma lo pisa el CMP
+#define MANEJADOR_ARITMETICA_CMP_SALTO(op, cmp, salto) \
+    MANEJADOR(op##_##cmp##_##salto): { \
+        InstruccionDecodificada *comp = POSTERIOR(ins); \
+        InstruccionDecodificada *sal = POSTERIOR(comp); \
+        uint8_t regA = ins->operandoA & 0x1F; \
+        int32_t a = (int32_t)mv->Registros[regA], b = (int32_t)ins->operandoB; \
+        if (DESBORDA_##op(a, b)) { \
+            ESTADO_LUEGO_DE(ins); \
+            detectaError(mv, COD_ERR_OVF, 0x0); \
+            goto fin; \
+        } \
+        mv->Registros[regA] = OPERACION_##op(a, b); \
+        int32_t r = RESTA(mv->Registros[comp->operandoA & 0x1F], FUENTE_##cmp(comp)); \
+        actualizaCC(mv, r); \
+        SALTO_FUSIONADO(salto, sal, r); \
+        AVANZAR(3); \
+    }
+#define OPERACION_ADD(a, b) ((a) + (b))
+#define OPERACION_SUB(a, b) ((a) - (b))
+#define MANEJADOR_ADD_CMP_SALTO(cmp, salto) MANEJADOR_ARITMETICA_CMP_SALTO(ADD, cmp, salto)
+#define MANEJADOR_SUB_CMP_SALTO(cmp, salto) MANEJADOR_ARITMETICA_CMP_SALTO(SUB, cmp, salto)
+
+// MOV reg,x + ADD reg,y sobre el mismo registro de 32 bits
+#define MANEJADOR_MOV_ADD(mov, suma) \
+    MANEJADOR(mov##_##suma): { \
+        InstruccionDecodificada *sum = POSTERIOR(ins); \
+        uint8_t regA = ins->operandoA & 0x1F; \
+        mv->Registros[regA] = FUENTE_##mov(ins); \
+        if (FORMA_##mov == FORMA_RM && !mv->continuarEjecucion) { \
+            ESTADO_LUEGO_DE(ins); \
+            goto fin; \
+        } \
+        int32_t b = FUENTE_##suma(sum), a = (int32_t)mv->Registros[regA]; \
+        ESTADO_LUEGO_DE(sum); \
+        if (DESBORDA_ADD(a, b)) { \
+            detectaError(mv, COD_ERR_OVF, 0x0); \
+            goto fin; \
+        } \
+        mv->Registros[regA] = a + b; \
+        actualizaCC(mv, a + b); \
+        AVANZAR(2); \
+    }
+#define FORMA_MOV_RR FORMA_RR
+#define FORMA_MOV_RI FORMA_RI
+#define FORMA_MOV_RM FORMA_RM
+#define FUENTE_MOV_RR(x) FUENTE_RR(x)
+#define FUENTE_MOV_RI(x) FUENTE_RI(x)
+#define FUENTE_MOV_RM(x) FUENTE_RM(x)
+#define FUENTE_ADD_RR(x) FUENTE_RR(x)
+#define FUENTE_ADD_RI(x) FUENTE_RI(x)
+
+// Cada entrada de LISTA_FUSIONES va a su generador segun el prefijo
+#define MANEJADOR_FUSION(primera, ultima) MANEJADOR_FUSION_##primera(ultima)
+#define MANEJADOR_FUSION_CMP_RR(salto) MANEJADOR_CMP_SALTO(CMP_RR, salto)
+#define MANEJADOR_FUSION_CMP_RI(salto) MANEJADOR_CMP_SALTO(CMP_RI, salto)
+#define MANEJADOR_FUSION_ADD_CMP_RR(salto) MANEJADOR_ADD_CMP_SALTO(CMP_RR, salto)
+#define MANEJADOR_FUSION_ADD_CMP_RI(salto) MANEJADOR_ADD_CMP_SALTO(CMP_RI, salto)
+#define MANEJADOR_FUSION_SUB_CMP_RR(salto) MANEJADOR_SUB_CMP_SALTO(CMP_RR, salto)
+#define MANEJADOR_FUSION_SUB_CMP_RI(salto) MANEJADOR_SUB_CMP_SALTO(CMP_RI, salto)
+#define MANEJADOR_FUSION_MOV_RR(suma) MANEJADOR_MOV_ADD(MOV_RR, suma)
+#define MANEJADOR_FUSION_MOV_RI(suma) MANEJADOR_MOV_ADD(MOV_RI, suma)
+#define MANEJADOR_FUSION_MOV_RM(suma) MANEJADOR_MOV_ADD(MOV_RM, suma)
+
+// Condicion de cada salto sobre los bits N y Z del CC ya calculado
+#define TOMADO_JMP(cc) 1
+#define TOMADO_JZ(cc) ((cc) & CC_Z)
+#define TOMADO_JP(cc) (!((cc) & (CC_N | CC_Z)))
+#define TOMADO_JN(cc) ((cc) & CC_N)
+#define TOMADO_JNZ(cc) (!((cc) & CC_Z))
+#define TOMADO_JNP(cc) ((cc) & (CC_N | CC_Z))
+#define TOMADO_JNN(cc) (!((cc) & CC_N))
+
+// Solo saltos por registro o inmediato: no acceden a memoria. Con el destino
+// verificado se salta sin pasar por calculaDireccionSalto
+#define MANEJADOR_SALTO(m) \
+    MANEJADOR(m): \
+        mv->Registros[POS_IP] = segmentoCS | ins->siguiente; \
+        REGISTROS_OP(ins); \
+        if (ins->verificada & VERIF_DESTINO) { \
+            if (MANEJ_##m != MANEJ_JMP) { \
+                materializaCC(mv); \
+            } \
+            if (TOMADO_##m(mv->Registros[POS_CC])) { \
+                mv->Registros[POS_IP] = segmentoCS | ins->operandoA; \
+            } \
+        } else { \
+            ejecutar##m(mv, ins->tipoA, ins->operandoA, ins->tamA); \
+        } \
+        DESPACHAR_DIRECTO();
+
+//---------------INSTANCIAS DEL MOTOR---------------
+// El mismo conjunto de manejadores (motor_hilado.h) con dos formas de llegar
+// a la instruccion siguiente
+
+// Por IP: cada manejador busca la instruccion siguiente en la cache. Lo que no
+// esta en la cache (IP fuera del CS o con otro segmento) lo resuelve ejecutarDecodificada
+#define MOTOR_POR_BLOQUES 0
+#define FUNCION_MOTOR ejecutarProgramaHilado
+#define AVANZAR(n) do{ \
+        ip = mv->Registros[POS_IP]; \
+        if ((ip >> 16) != posCS || (ip & 0xFFFF) >= tamCS) goto fueraDeCache; \
+        ins = &cache[ip & 0xFFFF]; \
+        SALTAR_A_MANEJADOR(); \
+    }while(0)
+#define POSTERIOR(x) (&cache[(x)->siguiente])
+#define REANUDAR() DESPACHAR_DIRECTO()
+#include "motor_hilado.h"
+#undef MOTOR_POR_BLOQUES
+#undef FUNCION_MOTOR
+#undef AVANZAR
+#undef POSTERIOR
+#undef REANUDAR
+
+// Por bloques: dentro de un bloque la instruccion siguiente es la proxima
+// copia, sin mirar IP. Solo el centinela del final vuelve a leer IP, y sigue
+// por un bloque encadenado o lo busca (traduce) en la cache de bloques
+#define MOTOR_POR_BLOQUES 1
+#define FUNCION_MOTOR ejecutarProgramaBloques
+#define AVANZAR(n) do{ ins += (n); SALTAR_A_MANEJADOR(); }while(0)
+#define POSTERIOR(x) ((x) + 1)
+#define REANUDAR() goto entreBloques
+#include "motor_hilado.h"
@@ -0,0 +1,188 @@
+// Cuerpo del motor hilado. motor.c lo incluye una vez por cada forma de
+// despacho, definiendo antes FUNCION_MOTOR, MOTOR_POR_BLOQUES, AVANZAR(n),
+// POSTERIOR(x) y REANUDAR(). No tiene guarda de inclusion a proposito.
+
+int FUNCION_MOTOR(MaquinaVirtual *mv){
+#if USA_GOTO_COMPUTADO
+    static void *const tablaManejadores[CANT_MANEJADORES] = {
+        LISTA_MANEJADORES(ETIQUETA_MANEJADOR)
+        LISTA_ESPECIALIZADOS(ETIQUETA_ESPECIALIZADO)
+        LISTA_FUSIONES(ETIQUETA_FUSION)
+    };
+#endif
+    InstruccionDecodificada *cache = mv->cacheDecodificada;
+    InstruccionDecodificada *ins;
+    uint8_t posCS = mv->Registros[POS_CS] >> 16;
+    uint32_t tamCS = cache != NULL ? mv->cacheFinCS - mv->cacheBaseCS : 0;
+    uint32_t segmentoCS = (uint32_t)posCS << 16;
+    uint32_t ip, operandoA, operandoB;
+    int rapido = modoRapido;
+#if MOTOR_POR_BLOQUES
+    Bloque *bloque = NULL;
+    int niveles = motorEjecucion == MOTOR_NIVELES;
+    int contarEntradas = niveles || jitActivo;
+#endif
+
+    if (!mv->continuarEjecucion) {
+        return 0;
+    }
+
+    REANUDAR();
+
+#if !USA_GOTO_COMPUTADO
+despachar:
+    switch(ins->manejador){
+#endif
+
+    MANEJADOR(DECODIFICAR):
+#if MOTOR_POR_BLOQUES
+        // Los bloques se traducen ya decodificados: no deberia llegar aca
+        goto entreBloques;
+#else
+        decodificaInstruccion(mv, ip & 0xFFFF, ins);
+        if (ins->estado == PRE_OK) {
+            fusionaInstruccion(mv, cache, tamCS, ip & 0xFFFF);
+        }
+        SALTAR_A_MANEJADOR();
+#endif
+
+    MANEJADOR(REFERENCIA):
+        if (ejecutarInstruccion(mv) != 0) {
+            return 1;
+        }
+        DESPACHAR();
+
+    MANEJADOR(GENERICO):
+        PROLOGO();
+        ejecutarOperacion(mv, ins->codOp, ins->tipoA, operandoA, ins->tipoB, operandoB, ins->tamA, ins->tamB);
+        DESPACHAR();
+
+    MANEJADOR_DOS_OPERANDOS(MOV)
+    MANEJADOR_DOS_OPERANDOS(ADD)
+    MANEJADOR_DOS_OPERANDOS(SUB)
+    MANEJADOR_DOS_OPERANDOS(MUL)
+    MANEJADOR_DOS_OPERANDOS(DIV)
+    MANEJADOR_DOS_OPERANDOS(CMP)
+    MANEJADOR_DOS_OPERANDOS(SHL)
+    MANEJADOR_DOS_OPERANDOS(SHR)
+    MANEJADOR_DOS_OPERANDOS(SAR)
+    MANEJADOR_DOS_OPERANDOS(AND)
+    MANEJADOR_DOS_OPERANDOS(OR)
+    MANEJADOR_DOS_OPERANDOS(XOR)
+    MANEJADOR_DOS_OPERANDOS(SWAP)
+    MANEJADOR_DOS_OPERANDOS(LDL)
+    MANEJADOR_DOS_OPERANDOS(LDH)
+    MANEJADOR_DOS_OPERANDOS(RND)
+
+    LISTA_ESPECIALIZADOS(MANEJADOR_ESPECIALIZADO)
+    LISTA_FUSIONES(MANEJADOR_FUSION)
+
+    MANEJADOR_SALTO(JMP)
+    MANEJADOR_SALTO(JZ)
+    MANEJADOR_SALTO(JP)
+    MANEJADOR_SALTO(JN)
+    MANEJADOR_SALTO(JNZ)
+    MANEJADOR_SALTO(JNP)
+    MANEJADOR_SALTO(JNN)
+
+    MANEJADOR(SYS):
+        PROLOGO();
+        ejecutarSYS(mv, operandoA);
+        DESPACHAR();
+
+    MANEJADOR(CALL):
+        // Solo CALL inmediato verificado: el destino ya esta dentro del CS
+        PROLOGO();
+        ejecutarPUSH(mv, mv->Registros[POS_IP]);
+        mv->Registros[POS_IP] = segmentoCS | ins->operandoA;
+        DESPACHAR();
+
+    MANEJADOR(NOT):
+        PROLOGO();
+        ejecutarNOT(mv, ins->tipoA, operandoA, ins->tamA);
+        DESPACHAR();
+
+    MANEJADOR(RET):
+        PROLOGO();
+        ejecutarRET(mv);
+        DESPACHAR();
+
+    MANEJADOR(STOP):
+        PROLOGO();
+        mv->Registros[POS_IP] = -1;
+        mv->continuarEjecucion = 0; // Detener la ejecucion
+        goto fin;
+
+    MANEJADOR(FIN_BLOQUE):
+        REANUDAR();
+
+#if !USA_GOTO_COMPUTADO
+    }
+#endif
+
+#if MOTOR_POR_BLOQUES
+entreBloques:
+    ip = mv->Registros[POS_IP];
+    if ((ip >> 16) != posCS || (ip & 0xFFFF) >= tamCS) {
+        goto fueraDeCache;
+    }
+    if (bloque != NULL && bloque->sucesores[0] != NULL && bloque->sucesores[0]->inicio == (ip & 0xFFFF)) {
+        bloque = bloque->sucesores[0];
+    } else if (bloque != NULL && bloque->sucesores[1] != NULL && bloque->sucesores[1]->inicio == (ip & 0xFFFF)) {
+        bloque = bloque->sucesores[1];
+    } else {
+        // Con motor=niveles un bloque frio se ejecuta sin traducir
+        uint8_t nivel = niveles ? nivelEntrada(mv, ip & 0xFFFF) : NIVEL_BLOQUES;
+        if (nivel < NIVEL_BLOQUES) {
+            // ejecutaBloqueInterpretado descuenta cada instruccion de la cuota
+            if (cuotaAgotada(mv, 0)) {
+                goto fin;
+            }
+            if (ejecutaBloqueInterpretado(mv, ip & 0xFFFF, nivel) != 0) {
+                return 1;
+            }
+            if (!mv->continuarEjecucion) {
+                goto fin;
+            }
+            goto entreBloques;
+        }
+        bloque = encadenaBloque(mv, bloque, ip & 0xFFFF);
+        if (bloque == NULL) {
+            goto fueraDeCache;
+        }
+    }
+    if (cuotaAgotada(mv, bloque->cantidad)) {
+        goto fin;
+    }
+    ins = bloque->instrucciones;
+    if (contarEntradas) {
+        if (++bloque->ejecuciones == umbralJit && jitActivo) {
+            compilaBloque(mv, bloque);
+        }
+        if (bloque->nativo != NULL) {
+            // El codigo nativo trabaja sobre CC y los registros internos ya calculados.
+            // Sigue en el interprete desde donde el codigo nativo devolvio el control
+            materializaCC(mv);
+            materializaInternos(mv);
+            ins += bloque->nativo(mv->Registros, mv->MemoriaPrincipal, mv->traduccion);
+        }
+    }
+    SALTAR_A_MANEJADOR();
+#endif
+
+fueraDeCache:
+    // IP fuera del CS (fin de programa) o con otro segmento: camino de referencia
+    if (cuotaAgotada(mv, 1)) {
+        goto fin;
+    }
+    if (ejecutarDecodificada(mv) != 0) {
+        return 1;
+    }
+    if (!mv->continuarEjecucion) {
+        goto fin;
+    }
+    REANUDAR();
+
+fin:
+    return 0;
+}
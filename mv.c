@@ -6,156 +6,243 @@
 #include "mv.h"
 
 //-------------VARIABLES GLOBALES---------------
-// Memoria principal
-uint8_t *MemoriaPrincipal;
-uint32_t TAMANIO_MEMORIA = 16384; //tamanio en bytes por defecto
-uint32_t entryPoint = 0; // Entry point del programa
-// Tabla de Registros
-uint32_t Registros[NUM_REGISTROS];
-DescriptoresSegmentos tablaSegmentos[NUM_SEG];
-
-//variables del main
-extern uint8_t versionPrograma;
-extern int continuarEjecucion;//para controlar el bucle
-extern char *archivo_vmi;
+int modoRapido = 0;
 
 //---------------FUNCION PARA DETECCION DE ERROR---------------
-void detectaError(int8_t cod, int32_t er){
-    continuarEjecucion=0;
+void detectaError(MaquinaVirtual *mv, int8_t cod, int32_t er){
+    mv->continuarEjecucion=0;
+    mv->codigoError=cod;
     switch(cod){
         case COD_ERR_DIV: {
-            printf("Error, dividendo es cero \n");
+            fprintf(mv->salida, "Error, dividendo es cero \n");
             break;
             }
         case COD_ERR_INS: {
-            printf("Error, instruccion invalida \n");
+            fprintf(mv->salida, "Error, instruccion invalida \n");
             break;
         }
         case COD_ERR_REG:{
-            printf("Error, registro invalido, Registro: %d \n", er);
+            fprintf(mv->salida, "Error, registro invalido, Registro: %d \n", er);
             break;
         }
         case COD_ERR_FIS: {
-            printf("Error, direccion fisica invalida: 0x%08X \n",er);
+            fprintf(mv->salida, "Error, direccion fisica invalida: 0x%08X \n",er);
             break;
         }
         case COD_ERR_OPE:{
-            printf("Error, operando invalido \n");
+            fprintf(mv->salida, "Error, operando invalido \n");
             break;
         }
         case COD_ERR_READ:{
-            printf("Error, modo de lectura invalida \n");
+            fprintf(mv->salida, "Error, modo de lectura invalida \n");
             break;
         }
         case COD_ERR_WRITE:{
-            printf("Error, modo de escritura invalido \n");
+            fprintf(mv->salida, "Error, modo de escritura invalido \n");
             break;
         }
         case COD_ERR_LOG:{
-            printf("Error, direccion logica invalida: 0x%08X \n",er);
+            fprintf(mv->salida, "Error, direccion logica invalida: 0x%08X \n",er);
             break;
         }
         case COD_ERR_MEM_INS:{
-            printf("Error, tamanio de memoria insuficiente para guardar el programa. Tamanio memoria: %d, tamanio programa: %d \n",TAMANIO_MEMORIA,er);
+            fprintf(mv->salida, "Error, tamanio de memoria insuficiente para guardar el programa. Tamanio memoria: %d, tamanio programa: %d \n",mv->TAMANIO_MEMORIA,er);
             break;
         }
         case COD_ERR_SEGMENT:{
-            printf("Error, segmento invalido 0x%08X \n",er);
+            fprintf(mv->salida, "Error, segmento invalido 0x%08X \n",er);
             break;
         }        
     }
 }
 
 //--------------DECLARACIONES DE FUNCIONES PARA VIRTUAL MACHINE------//
-void inicializaMemoria(){
-    if (MemoriaPrincipal != NULL) {
-        free(MemoriaPrincipal);
-    }
-
-    MemoriaPrincipal = malloc(TAMANIO_MEMORIA);
-    if (!MemoriaPrincipal) {
+//-------------CREACION DE LA MAQUINA VIRTUAL---------------
+MaquinaVirtual *creaMaquinaVirtual(){
+    MaquinaVirtual *mv = calloc(1, sizeof(MaquinaVirtual));
+    if (!mv) {
         exit(EXIT_FAILURE);
     }
-
-    memset(MemoriaPrincipal, 0, TAMANIO_MEMORIA);
+    mv->TAMANIO_MEMORIA = 16384; //tamanio en bytes por defecto
+    mv->continuarEjecucion = 1;
+    mv->codigoError = -1;
+    mv->entrada = stdin;
+    mv->salida = stdout;
+    mv->cuota = SIN_CUOTA;
+    return mv;
+}
+
+// Deja la maquina lista para cargar otro programa. Conserva la memoria
+// reservada (inicializaMemoria la vuelve a poner en cero), el tamanio y la E/S
+void reiniciaMaquinaVirtual(MaquinaVirtual *mv){
+    uint8_t *memoria = mv->MemoriaPrincipal;
+    uint32_t tamanio = mv->TAMANIO_MEMORIA, reservada = mv->memoriaReservada;
+    void *mapeoImagen = mv->mapeoImagen;
+    size_t tamMapeoImagen = mv->tamMapeoImagen;
+    struct SegmentosCompartidos *compartidos = mv->compartidos;
+    uint32_t inicioCompartido = mv->inicioCompartido, finCompartido = mv->finCompartido;
+    FILE *entrada = mv->entrada, *salida = mv->salida;
+
+    liberaCacheDecodificada(mv);
+    memset(mv, 0, sizeof(MaquinaVirtual));
+    mv->MemoriaPrincipal = memoria;
+    mv->memoriaReservada = reservada;
+    mv->mapeoImagen = mapeoImagen;
+    mv->tamMapeoImagen = tamMapeoImagen;
+    mv->compartidos = compartidos;
+    mv->inicioCompartido = inicioCompartido;
+    mv->finCompartido = finCompartido;
+    mv->TAMANIO_MEMORIA = tamanio;
+    mv->entrada = entrada;
+    mv->salida = salida;
+    mv->continuarEjecucion = 1;
+    mv->codigoError = -1;
+    mv->cuota = SIN_CUOTA;
+}
+
+void liberaMaquinaVirtual(MaquinaVirtual *mv){
+    esperaImagenesEnCurso(mv);
+    liberaCacheDecodificada(mv);
+    liberaMemoria(mv);
+    free(mv);
+}
+
+void inicializaMemoria(MaquinaVirtual *mv){
+    // Una maquina reutilizada conserva la memoria si el tamanio no cambio
+    // (la de una imagen mapeada no: limpiarla volveria al contenido del archivo)
+    if (mv->MemoriaPrincipal != NULL) {
+        liberaSegmentosCompartidos(mv);
+    }
+    if (mv->MemoriaPrincipal != NULL && (mv->memoriaReservada != mv->TAMANIO_MEMORIA || mv->mapeoImagen != NULL)) {
+        liberaMemoria(mv);
+    }
+
+    if (mv->MemoriaPrincipal == NULL) {
+        // Recien reservada ya esta en cero (ver MEMORIA PRINCIPAL en mv.h)
+        mv->MemoriaPrincipal = reservaMemoria(mv->TAMANIO_MEMORIA);
+        if (!mv->MemoriaPrincipal) {
+            exit(EXIT_FAILURE);
+        }
+        mv->memoriaReservada = mv->TAMANIO_MEMORIA;
+    } else {
+        limpiaMemoria(mv);
+    }
+    // La memoria nueva no tiene imagen guardada: la primera se escribe completa
+    memset(mv->paginasSucias, 0, sizeof(mv->paginasSucias));
+    mv->cadenaImagen = 0;
+    mv->largoDiferencias = 0;
+    actualizaTraduccion(mv);
 }
 
 //---------------- FUNCIONES DE MEMORIA ----------------
-uint32_t calculaDireccionFisica(uint32_t direccionLogica) {
+// Recalcula la traduccion de cada segmento (ver TRADUCCION DE DIRECCIONES en mv.h)
+void actualizaTraduccion(MaquinaVirtual *mv){
+    for (int i = 0; i < NUM_SEG; i++) {
+        TraduccionSegmento *t = &mv->traduccion[i];
+        uint32_t base = mv->tablaSegmentos[i].base;
+        uint32_t limite = mv->tablaSegmentos[i].tamanio;
+
+        // Los 4 bytes de un acceso long tienen que quedar dentro de la memoria
+        if (mv->MemoriaPrincipal == NULL || base + 4 > mv->TAMANIO_MEMORIA) {
+            limite = 0;
+        } else if (limite > mv->TAMANIO_MEMORIA - base - 3) {
+            limite = mv->TAMANIO_MEMORIA - base - 3;
+        }
+        t->inicio = (uint32_t)i << 16;
+        t->limite = limite;
+        t->base = base;
+    }
+}
+
+// Camino verificado de calculaDireccionFisica: informa el error que corresponda
+uint32_t calculaDireccionFisicaVerificada(MaquinaVirtual *mv, uint32_t direccionLogica) {
     uint16_t segmento = direccionLogica >> 16;
     uint16_t offset = direccionLogica & 0xFFFF;
 
     if (segmento >= NUM_SEG) {
-        detectaError(COD_ERR_LOG, direccionLogica);
+        detectaError(mv, COD_ERR_LOG, direccionLogica);
         return 0;
     }
     // Verificar que el desplazamiento no exceda el tamanio del segmento
-    if (offset >= tablaSegmentos[segmento].tamanio) {
-        detectaError(COD_ERR_LOG, direccionLogica);
+    if (offset >= mv->tablaSegmentos[segmento].tamanio) {
+        detectaError(mv, COD_ERR_LOG, direccionLogica);
         return 0;
     }
-    uint32_t direccionFisica = tablaSegmentos[segmento].base + offset;
+    uint32_t direccionFisica = mv->tablaSegmentos[segmento].base + offset;
 
-    if (direccionFisica >= TAMANIO_MEMORIA) {
-        detectaError(COD_ERR_FIS, direccionFisica);
+    if (direccionFisica >= mv->TAMANIO_MEMORIA) {
+        detectaError(mv, COD_ERR_FIS, direccionFisica);
         return 0;
     }
     return direccionFisica;
 }
 
-int32_t leerMemoria(uint32_t direccionFisica, uint8_t tamanio) {
-    if(direccionFisica + tamanio > TAMANIO_MEMORIA) {
-        detectaError(COD_ERR_FIS, direccionFisica + tamanio);
+uint32_t traduceAccesoVerificado(MaquinaVirtual *mv, uint32_t direccionLogica, uint8_t tamanio){
+    uint32_t direccionFisica = calculaDireccionFisicaVerificada(mv, direccionLogica);
+
+    if(direccionFisica + tamanio > mv->TAMANIO_MEMORIA) {
+        detectaError(mv, COD_ERR_FIS, direccionFisica + tamanio);
         return 0;
     }
+    return direccionFisica;
+}
 
-    int32_t valor = 0;
-    for(int i = 0; i < tamanio; i++) {
-        valor = (valor << 8) | MemoriaPrincipal[direccionFisica + i];
-    }
-    // Extensión de signo para tamaños menores a 4 bytes
-    if(tamanio < 4) {
-        int bits = tamanio * 8;
-        valor = (valor << (32 - bits)) >> (32 - bits);
+int32_t leerMemoria(MaquinaVirtual *mv, uint32_t direccionFisica, uint8_t tamanio) {
+    if(direccionFisica + tamanio > mv->TAMANIO_MEMORIA) {
+        detectaError(mv, COD_ERR_FIS, direccionFisica + tamanio);
+        return 0;
     }
-
-    return valor;
+    return leeMemoriaTraducida(mv, direccionFisica, tamanio);
 }
 
-void escribirMemoria(uint32_t direccionFisica, int32_t valor, uint8_t tamanio) {
-    if(direccionFisica+tamanio > TAMANIO_MEMORIA) {
-        detectaError(COD_ERR_FIS, direccionFisica+tamanio);
+void escribirMemoria(MaquinaVirtual *mv, uint32_t direccionFisica, int32_t valor, uint8_t tamanio) {
+    if(direccionFisica+tamanio > mv->TAMANIO_MEMORIA) {
+        detectaError(mv, COD_ERR_FIS, direccionFisica+tamanio);
         return;
     }
-    for (int i = 0; i < tamanio; i++) {
-        MemoriaPrincipal[direccionFisica + i] = (valor >> (8 * (tamanio - 1 - i))) & 0xFF;
-    }
+    escribeMemoriaTraducida(mv, direccionFisica, valor, tamanio);
+}
 
+// Escritura big-endian sin verificar la direccion
+void escribeMemoriaTraducida(MaquinaVirtual *mv, uint32_t direccionFisica, int32_t valor, uint8_t tamanio) {
+    uint8_t *p = mv->MemoriaPrincipal + direccionFisica;
+    verificaCompartidos(mv, direccionFisica, tamanio);
+    switch(tamanio){
+        case 1: p[0] = valor & 0xFF; break;
+        case 2: guardaBE16(p, (uint16_t)valor); break;
+        default: guardaBE32(p, (uint32_t)valor); break;
+    }
+    marcaPaginaSucia(mv, direccionFisica, tamanio);
+    // Si se escribio sobre el Code Segment, las instrucciones predecodificadas quedan viejas
+    if (direccionFisica < mv->cacheFinCS && direccionFisica + tamanio > mv->cacheBaseCS) {
+        invalidaCacheDecodificada(mv, direccionFisica, tamanio);
+    }
 }
 
 //----------------INICIALIZACIONES PARA VERSION 1---------------------
-void inicializaSegmentosV1(uint16_t tamanioCodigo){
+void inicializaSegmentosV1(MaquinaVirtual *mv, uint16_t tamanioCodigo){
     for(int i=0; i<NUM_SEG; i++){
-        tablaSegmentos[i].base = 0;
-        tablaSegmentos[i].tamanio = 0;
+        mv->tablaSegmentos[i].base = 0;
+        mv->tablaSegmentos[i].tamanio = 0;
     }
     //actualiza la tabla de descriptores
     //En esta version, SEG_CS = 0 y SEG_DS = 1 (posiciones del CS y DS)
-    tablaSegmentos[SEG_CS].tamanio = tamanioCodigo;
+    mv->tablaSegmentos[SEG_CS].tamanio = tamanioCodigo;
 
-    tablaSegmentos[SEG_DS].base = tamanioCodigo;
-    tablaSegmentos[SEG_DS].tamanio = TAMANIO_MEMORIA-tamanioCodigo;
+    mv->tablaSegmentos[SEG_DS].base = tamanioCodigo;
+    mv->tablaSegmentos[SEG_DS].tamanio = mv->TAMANIO_MEMORIA-tamanioCodigo;
+    actualizaTraduccion(mv);
 }
 
-void inicializaTablaRegistrosV1(){
-    memset(Registros, 0, sizeof(Registros)); // Inicializo registros a 0
+void inicializaTablaRegistrosV1(MaquinaVirtual *mv){
+    memset(mv->Registros, 0, sizeof(mv->Registros)); // Inicializo registros a 0
 
     // CS: segmento 0x0000, offset 0x0000
-    Registros[POS_CS] = 0x00000000; // o podria ser POS_CS<<16
+    mv->Registros[POS_CS] = 0x00000000; // o podria ser POS_CS<<16
     // DS: segmento 0x0001, offset 0x0000
-    Registros[POS_DS] = 0x00010000; // o podria ser POS_DS<<16
+    mv->Registros[POS_DS] = 0x00010000; // o podria ser POS_DS<<16
     // IP: comienza en 0
-    Registros[POS_IP] = 0x00000000;
+    mv->Registros[POS_IP] = 0x00000000;
 }
 
 //------------FUNCIONES PARA PARAM SEGMENT----------------
@@ -173,8 +260,8 @@ uint32_t calculaTamanioParametros(char **parametros, int cantParam){
     return tamanio_ParamSeg;
 }
 
-uint32_t inicializaParamSegment(char **parametros, int cantParam){
-    uint32_t pos_act = tablaSegmentos[0].base;
+uint32_t inicializaParamSegment(MaquinaVirtual *mv, char **parametros, int cantParam){
+    uint32_t pos_act = mv->tablaSegmentos[0].base;
 
     uint32_t argv_dir_start = pos_act;
 
@@ -187,32 +274,32 @@ uint32_t inicializaParamSegment(char **parametros, int cantParam){
     uint32_t act_str_offset = pos_act;
     for(int i=0; i<cantParam; i++){
         //Copiar string a memoria
-        strcpy((char*)MemoriaPrincipal + act_str_offset, parametros[i]);
+        strcpy((char*)mv->MemoriaPrincipal + act_str_offset, parametros[i]);
 
         //Escribir puntero en array argv
         uint32_t offsetRel = act_str_offset - pos_act; //offset relativo al seg
-        escribirMemoria(argv_dir_start + i*4, offsetRel, sizeof(uint32_t));
+        escribirMemoria(mv, argv_dir_start + i*4, offsetRel, sizeof(uint32_t));
         act_str_offset +=strlen(parametros[i])+1;
     }
     return argv_dir_start; // Devuelve la dirección del array argv
 }
 
 //------------------INICIALIZACIONES PARA VERSION 2------------------------------------
-void inicializaTablasV2(VMXHeaderV2 encabezado, char **parametros, int cantParam) {
+void inicializaTablasV2(MaquinaVirtual *mv, VMXHeaderV2 encabezado, char **parametros, int cantParam) {
     uint32_t pos_act = 0;
     int contSeg = 0; // Contador de segmentos
-    memset(Registros, 0, sizeof(Registros));
+    memset(mv->Registros, 0, sizeof(mv->Registros));
     uint32_t dir_argv_mv = 0xFFFFFFFF; // Inicializar a un valor inválido
 
     // 1. PARAM SEGMENT (si hay parámetros)
     if (cantParam > 0) {
         uint32_t tamanio_param = calculaTamanioParametros(parametros, cantParam);
         if(contSeg<=NUM_SEG){
-            tablaSegmentos[contSeg].base = pos_act;
-            tablaSegmentos[contSeg].tamanio = tamanio_param;
-            dir_argv_mv = inicializaParamSegment(parametros, cantParam);
+            mv->tablaSegmentos[contSeg].base = pos_act;
+            mv->tablaSegmentos[contSeg].tamanio = tamanio_param;
+            dir_argv_mv = inicializaParamSegment(mv, parametros, cantParam);
             pos_act += tamanio_param;
-            Registros[POS_PS] = (contSeg<<16);
+            mv->Registros[POS_PS] = (contSeg<<16);
             contSeg++;
         }
         else
@@ -221,121 +308,122 @@ void inicializaTablasV2(VMXHeaderV2 encabezado, char **parametros, int cantParam
 
     // 2. CONST SEGMENT (si existe)
     if (encabezado.tamanio_const > 0) {
-        tablaSegmentos[contSeg].base = pos_act;
-        tablaSegmentos[contSeg].tamanio = encabezado.tamanio_const;
+        mv->tablaSegmentos[contSeg].base = pos_act;
+        mv->tablaSegmentos[contSeg].tamanio = encabezado.tamanio_const;
         pos_act += encabezado.tamanio_const;
-        Registros[POS_KS] = (contSeg<<16);
+        mv->Registros[POS_KS] = (contSeg<<16);
         contSeg++;
     }
     else{
-        Registros[POS_KS] = 0xFFFFFFFF;
+        mv->Registros[POS_KS] = 0xFFFFFFFF;
     }
 
     // 3. CODE SEGMENT (siempre existe)
-    tablaSegmentos[contSeg].base = pos_act;
-    tablaSegmentos[contSeg].tamanio = encabezado.tamanio_cod;
+    mv->tablaSegmentos[contSeg].base = pos_act;
+    mv->tablaSegmentos[contSeg].tamanio = encabezado.tamanio_cod;
     pos_act += encabezado.tamanio_cod;
-    Registros[POS_CS] = (contSeg<<16);
+    mv->Registros[POS_CS] = (contSeg<<16);
     contSeg++;
 
     // 4. DATA SEGMENT (si existe)
     if (encabezado.tamanio_datos > 0) {
-        tablaSegmentos[contSeg].base = pos_act;
-        tablaSegmentos[contSeg].tamanio = encabezado.tamanio_datos;
+        mv->tablaSegmentos[contSeg].base = pos_act;
+        mv->tablaSegmentos[contSeg].tamanio = encabezado.tamanio_datos;
         pos_act += encabezado.tamanio_datos;
-        Registros[POS_DS] = (contSeg<<16);
+        mv->Registros[POS_DS] = (contSeg<<16);
         contSeg++;
     }
     else{
-        Registros[POS_DS] = 0xFFFFFFFF;
+        mv->Registros[POS_DS] = 0xFFFFFFFF;
     }
 
     // 5. EXTRA SEGMENT (si existe)
     if (encabezado.tamanio_extra > 0) {
-        tablaSegmentos[contSeg].base = pos_act;
-        tablaSegmentos[contSeg].tamanio = encabezado.tamanio_extra;
+        mv->tablaSegmentos[contSeg].base = pos_act;
+        mv->tablaSegmentos[contSeg].tamanio = encabezado.tamanio_extra;
         pos_act += encabezado.tamanio_extra;
-        Registros[POS_ES]=(contSeg<<16);
+        mv->Registros[POS_ES]=(contSeg<<16);
         contSeg++;
     }
     else{
-        Registros[POS_ES] = 0xFFFFFFFF;
+        mv->Registros[POS_ES] = 0xFFFFFFFF;
     }
 
     // 6. STACK SEGMENT (siempre existe)
-    tablaSegmentos[contSeg].base = pos_act;
-    tablaSegmentos[contSeg].tamanio = encabezado.tamanio_stack;
-    Registros[POS_SS] = (contSeg << 16);
+    mv->tablaSegmentos[contSeg].base = pos_act;
+    mv->tablaSegmentos[contSeg].tamanio = encabezado.tamanio_stack;
+    mv->Registros[POS_SS] = (contSeg << 16);
     //El SP debe apuntar al "tope" de la pila, que es el final del segmento de stack.
     //Pero la pila crece hacia abajo. Entonces, el SP inicial es la base + el tamaño.
-    Registros[POS_SP] = (contSeg<<16) | encabezado.tamanio_stack;
-    Registros[POS_BP] = Registros[POS_SP];
+    mv->Registros[POS_SP] = (contSeg<<16) | encabezado.tamanio_stack;
+    mv->Registros[POS_BP] = mv->Registros[POS_SP];
     contSeg++;
 
     // Inicializar segmentos no usados
     for (; contSeg < NUM_SEG; contSeg++) {
-        tablaSegmentos[contSeg].base = 0;
-        tablaSegmentos[contSeg].tamanio = 0;
+        mv->tablaSegmentos[contSeg].base = 0;
+        mv->tablaSegmentos[contSeg].tamanio = 0;
     }
 
+    actualizaTraduccion(mv);
+
     // Inicializar IP con el entry point
-    Registros[POS_IP] = (Registros[POS_CS] & 0xFFFF0000) | encabezado.entry_point;
-    inicializarPilaMain(cantParam, dir_argv_mv);
+    mv->Registros[POS_IP] = (mv->Registros[POS_CS] & 0xFFFF0000) | encabezado.entry_point;
+    inicializarPilaMain(mv, cantParam, dir_argv_mv);
 
 }
 
 //-------------------LECTURA DEL ARCHIVO---------------------------------
     //-----------CARGA PROGRAMA PARA VERSION 1----------------------//
-int cargaProgramaV1(FILE *arch) {
+int cargaProgramaV1(MaquinaVirtual *mv, const uint8_t *archivo, size_t tamanio) {
     VMXHeaderV1 encabezado;
 
     // Leer header completo
-    if (fread(&encabezado, sizeof(VMXHeaderV1), 1, arch) != 1) {
-        printf("Error al leer encabezado MV1\n");
+    if (tamanio < sizeof(VMXHeaderV1)) {
+        fprintf(mv->salida, "Error al leer encabezado MV1\n");
         return -1;
     }
+    memcpy(&encabezado, archivo, sizeof(VMXHeaderV1));
 
     // Verificar identificador y versión
     if (memcmp(encabezado.identificador, "VMX25", 5) != 0 || encabezado.version != 1) {
-        printf("Encabezado inválido para MV1\n");
+        fprintf(mv->salida, "Encabezado inválido para MV1\n");
         return -1;
     }
 
     encabezado.tamanio = convertirBigEndian16(encabezado.tamanio);
 
     // Verificar que el programa cabe en memoria
-    if (encabezado.tamanio == 0 || encabezado.tamanio >= TAMANIO_MEMORIA ) {
-        detectaError(COD_ERR_MEM_INS, encabezado.tamanio);
-        fclose(arch);
+    if (encabezado.tamanio == 0 || encabezado.tamanio >= mv->TAMANIO_MEMORIA ) {
+        detectaError(mv, COD_ERR_MEM_INS, encabezado.tamanio);
         return -1;
     }
 
-    // Leer código directamente al inicio de la memoria
-    size_t bytes_leidos = fread(MemoriaPrincipal, sizeof(uint8_t), encabezado.tamanio, arch);
-    if (bytes_leidos != encabezado.tamanio) {
-        printf("Error: tamaño del código no coincide\n");
-        fclose(arch);
+    // Copiar el código directamente al inicio de la memoria
+    if (tamanio - sizeof(VMXHeaderV1) < encabezado.tamanio) {
+        fprintf(mv->salida, "Error: tamaño del código no coincide\n");
         return -1;
     }
-
-    fclose(arch);
+    memcpy(mv->MemoriaPrincipal, archivo + sizeof(VMXHeaderV1), encabezado.tamanio);
 
     // Inicializar segmentos y registros
-    inicializaSegmentosV1(encabezado.tamanio);
-    inicializaTablaRegistrosV1();
+    inicializaSegmentosV1(mv, encabezado.tamanio);
+    inicializaTablaRegistrosV1(mv);
 
     return 0;
 }
 
     //----------------CARGA PROGRAMA PARA VERSION 2-----------------------
-int cargaProgramaV2(FILE *arch, char **parametros, int cantParam) {
+int cargaProgramaV2(MaquinaVirtual *mv, const uint8_t *archivo, size_t tamanio, char **parametros, int cantParam) {
     VMXHeaderV2 encabezado;
+    size_t pos = sizeof(VMXHeaderV2);
 
     // Leer header completo
-    if (fread(&encabezado, sizeof(VMXHeaderV2), 1, arch) != 1) {
-        printf("Error al leer encabezado MV2\n");
+    if (tamanio < sizeof(VMXHeaderV2)) {
+        fprintf(mv->salida, "Error al leer encabezado MV2\n");
         return -1;
     }
+    memcpy(&encabezado, archivo, sizeof(VMXHeaderV2));
 
     encabezado.tamanio_cod = (encabezado.tamanio_cod >> 8) | (encabezado.tamanio_cod << 8);
     encabezado.tamanio_datos = (encabezado.tamanio_datos >> 8) | (encabezado.tamanio_datos << 8);
@@ -344,7 +432,7 @@ int cargaProgramaV2(FILE *arch, char **parametros, int cantParam) {
     encabezado.tamanio_const = (encabezado.tamanio_const >> 8) | (encabezado.tamanio_const << 8);
     encabezado.entry_point = (encabezado.entry_point >> 8) | (encabezado.entry_point << 8);
 
-    entryPoint = encabezado.entry_point;
+    mv->entryPoint = encabezado.entry_point;
 
 
     // Validar tamaños no nulos
@@ -353,21 +441,21 @@ int cargaProgramaV2(FILE *arch, char **parametros, int cantParam) {
     }
 
     // Verificar que ningún segmento tenga tamaño negativo disfrazado (por cast incorrecto)
-    if (encabezado.tamanio_cod > TAMANIO_MEMORIA ||
-        encabezado.tamanio_datos > TAMANIO_MEMORIA ||
-        encabezado.tamanio_extra > TAMANIO_MEMORIA ||
-        encabezado.tamanio_stack > TAMANIO_MEMORIA ||
-        encabezado.tamanio_const > TAMANIO_MEMORIA) {
+    if (encabezado.tamanio_cod > mv->TAMANIO_MEMORIA ||
+        encabezado.tamanio_datos > mv->TAMANIO_MEMORIA ||
+        encabezado.tamanio_extra > mv->TAMANIO_MEMORIA ||
+        encabezado.tamanio_stack > mv->TAMANIO_MEMORIA ||
+        encabezado.tamanio_const > mv->TAMANIO_MEMORIA) {
         return -1;
     }
 
     // Validar header
     if (strncmp(encabezado.identificador, "VMX25", 5) != 0 || encabezado.version != 2) {
-        printf("Error: archivo no es MV2 válido\n");
+        fprintf(mv->salida, "Error: archivo no es MV2 válido\n");
         return -1;
     }
 
-    if (entryPoint >= encabezado.tamanio_cod) {
+    if (mv->entryPoint >= encabezado.tamanio_cod) {
         return -1;
     }
     // Calcular tamaño total necesario
@@ -377,194 +465,301 @@ int cargaProgramaV2(FILE *arch, char **parametros, int cantParam) {
         total_size += calculaTamanioParametros(parametros, cantParam);
     }
 
-    if (total_size > TAMANIO_MEMORIA) {
-        detectaError(COD_ERR_MEM_INS, total_size);
+    if (total_size > mv->TAMANIO_MEMORIA) {
+        detectaError(mv, COD_ERR_MEM_INS, total_size);
         return -1;
     }
 
     // Inicializar segmentos y registros
-    inicializaTablasV2(encabezado, parametros, cantParam);
+    inicializaTablasV2(mv, encabezado, parametros, cantParam);
 
     // Cargar segmentos en memoria
-    uint8_t posCS = Registros[POS_CS] >> 16;
+    uint8_t posCS = mv->Registros[POS_CS] >> 16;
     if (posCS >= NUM_SEG) {
-        detectaError(COD_ERR_SEGMENT, posCS);
+        detectaError(mv, COD_ERR_SEGMENT, posCS);
         return -1;
     }
-    if (fread(MemoriaPrincipal + tablaSegmentos[posCS].base, 1, encabezado.tamanio_cod, arch) != encabezado.tamanio_cod) {
-        printf("Error al leer Code Segment\n");
+    if (tamanio - pos < encabezado.tamanio_cod) {
+        fprintf(mv->salida, "Error al leer Code Segment\n");
         return -1;
     }
+    memcpy(mv->MemoriaPrincipal + mv->tablaSegmentos[posCS].base, archivo + pos, encabezado.tamanio_cod);
+    pos += encabezado.tamanio_cod;
 
     // Cargar Const Segment si existe
-    if (encabezado.tamanio_const > 0 && Registros[POS_KS] != 0xFFFFFFFF) {
-        uint8_t posKS = Registros[POS_KS] >> 16;
-        if (fread(MemoriaPrincipal + tablaSegmentos[posKS].base, 1, encabezado.tamanio_const, arch) != encabezado.tamanio_const) {
-            printf("Error al leer Const Segment\n");
+    if (encabezado.tamanio_const > 0 && mv->Registros[POS_KS] != 0xFFFFFFFF) {
+        uint8_t posKS = mv->Registros[POS_KS] >> 16;
+        if (tamanio - pos < encabezado.tamanio_const) {
+            fprintf(mv->salida, "Error al leer Const Segment\n");
             return -1;
         }
+        memcpy(mv->MemoriaPrincipal + mv->tablaSegmentos[posKS].base, archivo + pos, encabezado.tamanio_const);
     }
+    // El KS queda justo antes del CS (ver inicializaTablasV2)
+    compartirSegmentos(mv, mv->Registros[POS_KS] != 0xFFFFFFFF ? mv->tablaSegmentos[mv->Registros[POS_KS] >> 16].base : mv->tablaSegmentos[posCS].base,
+                       mv->tablaSegmentos[posCS].base + encabezado.tamanio_cod);
 
-    printf("Programa MV2 cargado correctamente\n");
-    fclose(arch);
+    fprintf(mv->salida, "Programa MV2 cargado correctamente\n");
     return 0;
 }
 
 
 //----------------CARGA PROGRAMA SEGUN LA VERSION---------------
-int cargaPrograma(const char *nombreArchivo, char **parametros, int cantParam) {
-    FILE *arch;
-    char identificador[6] = {0};
-
-    printf("Intentando abrir archivo: '%s'\n", nombreArchivo);
-    arch = fopen(nombreArchivo, "rb");
-    if (arch == NULL) {
-        printf("Error: no se pudo abrir el archivo\n");
+int cargaPrograma(MaquinaVirtual *mv, const char *nombreArchivo, char **parametros, int cantParam) {
+    ArchivoMapeado archivo;
+    int resultado;
+
+    fprintf(mv->salida, "Intentando abrir archivo: '%s'\n", nombreArchivo);
+    // El archivo se mapea y los segmentos se copian directo desde el mapeo
+    if (mapeaArchivo(nombreArchivo, &archivo) != 0) {
+        fprintf(mv->salida, "Error: no se pudo abrir el archivo\n");
         return -1;
     }
 
     // Leer identificador y versión
-    if (fread(identificador, 1, 6, arch) != 6) {
-        printf("Error: no se pudo leer la cabecera\n");
-        fclose(arch);
+    if (archivo.tamanio < 6) {
+        fprintf(mv->salida, "Error: no se pudo leer la cabecera\n");
+        liberaArchivoMapeado(&archivo);
         return -1;
     }
 
-    // Volver al inicio para que las funciones específicas lean desde cero
-    fseek(arch, 0, SEEK_SET);
-
-    if (strncmp(identificador, "VMX25", 5) != 0) {
-        printf("Error: encabezado desconocido (no es VMX25)\n");
-        fclose(arch);
+    if (strncmp((const char *)archivo.datos, "VMX25", 5) != 0) {
+        fprintf(mv->salida, "Error: encabezado desconocido (no es VMX25)\n");
+        liberaArchivoMapeado(&archivo);
         return -1;
     }
 
-    versionPrograma = (uint8_t)identificador[5];
+    mv->versionPrograma = archivo.datos[5];
 
-    if (versionPrograma == 1) {
-        printf("Archivo detectado como MV1\n");
-        return cargaProgramaV1(arch);
-    } else if (versionPrograma == 2) {
-        printf("Archivo detectado como MV2\n");
-        return cargaProgramaV2(arch, parametros, cantParam);
+    if (mv->versionPrograma == 1) {
+        fprintf(mv->salida, "Archivo detectado como MV1\n");
+        resultado = cargaProgramaV1(mv, archivo.datos, archivo.tamanio);
+    } else if (mv->versionPrograma == 2) {
+        fprintf(mv->salida, "Archivo detectado como MV2\n");
+        resultado = cargaProgramaV2(mv, archivo.datos, archivo.tamanio, parametros, cantParam);
     } else {
-        printf("Versión de archivo no soportada: %d\n", versionPrograma);
-        fclose(arch);
-        return -1;
+        fprintf(mv->salida, "Versión de archivo no soportada: %d\n", mv->versionPrograma);
+        resultado = -1;
     }
+    liberaArchivoMapeado(&archivo);
+    return resultado;
 }
 
 //-----------------CARGA O CREA ARCHIVO VMI-------------------
-int cargarImagenVMI(const char *filename){
+int cargarImagenVMI(MaquinaVirtual *mv, const char *filename){
     FILE *vmi_file = fopen(filename, "rb");
     if(vmi_file == NULL){
-        printf("Error: No se pudo abrir el archivo .vmi \n");
+        fprintf(mv->salida, "Error: No se pudo abrir el archivo .vmi \n");
         return -1;
     }
 
     VMIHeader encabezado;
     if(fread(&encabezado, sizeof(VMIHeader), 1, vmi_file) !=1){
         fclose(vmi_file);
-        printf("Error: No se pudo leer el encabezado .vmi\n");
+        fprintf(mv->salida, "Error: No se pudo leer el encabezado .vmi\n");
         return -1;
     }
 
     if(memcmp(encabezado.identificador, "VMI25", 5) !=0){
         fclose(vmi_file);
-        printf("Error: Formato de archivo .vmi no valido \n");
+        fprintf(mv->salida, "Error: Formato de archivo .vmi no valido \n");
+        return -1;
+    }
+    if(encabezado.version != VERSION_VMI && encabezado.version != VERSION_VMI_COMPRIMIDA){
+        fclose(vmi_file);
+        fprintf(mv->salida, "Error: Version de archivo .vmi no soportada \n");
         return -1;
     }
     encabezado.tamanio_mem = convertirBigEndian16(encabezado.tamanio_mem);
-    TAMANIO_MEMORIA = encabezado.tamanio_mem*1024; // Convertir a bytes
-    printf("Header: %s, Version: %d, Tamanio Memoria: %d KiB\n", encabezado.identificador, encabezado.version, encabezado.tamanio_mem);
+    if(encabezado.tamanio_mem < 1 || encabezado.tamanio_mem > 1024){
+        fclose(vmi_file);
+        fprintf(mv->salida, "Error: Tamanio de memoria invalido en el archivo .vmi \n");
+        return -1;
+    }
+    mv->TAMANIO_MEMORIA = encabezado.tamanio_mem*1024; // Convertir a bytes
+    inicializaMemoria(mv); // la imagen puede tener otro tamanio de memoria
+    fprintf(mv->salida, "Header: %s, Version: %d, Tamanio Memoria: %d KiB\n", encabezado.identificador, encabezado.version, encabezado.tamanio_mem);
 
-    if(fread(Registros, sizeof(uint32_t), NUM_REGISTROS, vmi_file) !=NUM_REGISTROS){
+    if(fread(mv->Registros, sizeof(uint32_t), NUM_REGISTROS, vmi_file) !=NUM_REGISTROS){
         fclose(vmi_file);
-        printf("Error: No se pudieron leer los registros \n");
+        fprintf(mv->salida, "Error: No se pudieron leer los registros \n");
         return -1;
     }
 
-    if(fread(tablaSegmentos, sizeof(DescriptoresSegmentos), NUM_SEG, vmi_file) !=NUM_SEG){
+    if(fread(mv->tablaSegmentos, sizeof(DescriptoresSegmentos), NUM_SEG, vmi_file) !=NUM_SEG){
         fclose(vmi_file);
-        printf("Error: No se pudieron leer la tabla de segmentos \n");
+        fprintf(mv->salida, "Error: No se pudieron leer la tabla de segmentos \n");
         return -1;
     }
 
+    convierteEstadoVMI(mv);
+
+    if (encabezado.version == VERSION_VMI_COMPRIMIDA) {
+        int resultado = cargaMemoriaComprimida(mv, vmi_file);
+        fclose(vmi_file);
+        if (resultado != 0) {
+            return -1;
+        }
+        aplicaDiferenciasVMI(mv, filename);
+        return 0;
+    }
+
+    // La memoria se mapea copy-on-write desde el archivo: retomar una imagen
+    // no lee la memoria entera, solo las paginas que el programa usa
+    long desplazamiento = ftell(vmi_file);
+    if (desplazamiento > 0 && mapeaMemoriaImagen(mv, filename, (uint32_t)desplazamiento) == 0) {
+        fclose(vmi_file);
+        aplicaDiferenciasVMI(mv, filename);
+        return 0;
+    }
+
+    // Sin mapeo se copia por paginas y se saltean las que estan en cero:
+    // quedan sin reservar hasta que el programa las use
+    uint8_t pagina[4096];
+    for (uint32_t pos = 0; pos < mv->TAMANIO_MEMORIA; pos += sizeof(pagina)) {
+        uint32_t largo = mv->TAMANIO_MEMORIA - pos < sizeof(pagina) ? mv->TAMANIO_MEMORIA - pos : sizeof(pagina);
+        if(fread(pagina, 1, largo, vmi_file) != largo){
+            fclose(vmi_file);
+            return -1;
+        }
+        if (pagina[0] != 0 || memcmp(pagina, pagina + 1, largo - 1) != 0) {
+            memcpy(mv->MemoriaPrincipal + pos, pagina, largo);
+        }
+    }
+    fclose(vmi_file);
+    aplicaDiferenciasVMI(mv, filename);
+    return 0;
+}
+
+// Registros y tabla de segmentos leidos de una imagen, todavia en big-endian
+void convierteEstadoVMI(MaquinaVirtual *mv){
     for (int i = 0; i < NUM_REGISTROS; i++) {
-        if(Registros[i] != 0xFFFFFFFF){
-            Registros[i]=convertirBigEndian32(Registros[i]);
+        if(mv->Registros[i] != 0xFFFFFFFF){
+            mv->Registros[i]=convertirBigEndian32(mv->Registros[i]);
         }
     }
+    mv->ccPendiente = 0; // el CC de la imagen ya tiene N y Z calculados
     for (int i = 0; i < NUM_SEG; i++) {
-        if(tablaSegmentos[i].base == 0xFFFF && tablaSegmentos[i].tamanio == 0xFFFF){
-            tablaSegmentos[i].tamanio = 0;
-            tablaSegmentos[i].base = 0;
+        if(mv->tablaSegmentos[i].base == 0xFFFF && mv->tablaSegmentos[i].tamanio == 0xFFFF){
+            mv->tablaSegmentos[i].tamanio = 0;
+            mv->tablaSegmentos[i].base = 0;
         }else{
-            tablaSegmentos[i].tamanio = convertirBigEndian16(tablaSegmentos[i].tamanio);
-            tablaSegmentos[i].base    = convertirBigEndian16(tablaSegmentos[i].base);
+            mv->tablaSegmentos[i].tamanio = convertirBigEndian16(mv->tablaSegmentos[i].tamanio);
+            mv->tablaSegmentos[i].base    = convertirBigEndian16(mv->tablaSegmentos[i].base);
         }
     }
+    actualizaTraduccion(mv);
+}
 
-    if(fread(MemoriaPrincipal, 1, TAMANIO_MEMORIA, vmi_file) != TAMANIO_MEMORIA){
-        fclose(vmi_file);
+// Registros y tabla de segmentos en big-endian, como los guarda la imagen
+int escribeEstadoVMI(MaquinaVirtual *mv, FILE *archivo){
+    uint32_t reg_be;
+    uint16_t base_vmi, tam_vmi;
+    int errores = 0;
+
+    // La imagen guarda los registros como si se hubieran calculado en cada instruccion
+    materializaCC(mv);
+    materializaInternos(mv);
+    for (int i = 0; i < NUM_REGISTROS; i++) {
+        reg_be = convertirBigEndian32(mv->Registros[i]);
+        errores |= fwrite(&reg_be, sizeof(uint32_t), 1, archivo) != 1;
+    }
+    for (int i = 0; i < NUM_SEG; i++) {
+        base_vmi = convertirBigEndian16(mv->tablaSegmentos[i].base);
+        tam_vmi = convertirBigEndian16(mv->tablaSegmentos[i].tamanio);
+        errores |= fwrite(&base_vmi, sizeof(uint16_t), 1, archivo) != 1;
+        errores |= fwrite(&tam_vmi, sizeof(uint16_t), 1, archivo) != 1;
+    }
+    return errores ? -1 : 0;
+}
+
+// Una imagen completa nueva deja sin sentido las diferencias de la anterior:
+// se borran antes, asi un corte en el medio deja la imagen vieja sin ellas
+int guardarImagenVMI(MaquinaVirtual *mv, const char *filename){
+    descartaDiferenciasVMI(filename);
+    if (escribeImagenVMI(mv, filename) != 0) {
+        mv->cadenaImagen = 0;
         return -1;
     }
-    fclose(vmi_file);
+    memset(mv->paginasSucias, 0, sizeof(mv->paginasSucias));
+    mv->cadenaImagen = 1;
+    mv->largoDiferencias = 0;
     return 0;
 }
 
-int guardarImagenVMI(const char *filename){
-    int i;
-    uint16_t base_vmi,tam_vmi;
-    FILE *vmi_file = fopen(filename, "wb");
+// La imagen se escribe en un archivo temporal que despues reemplaza al
+// anterior: si la memoria esta mapeada desde ese mismo archivo, truncarlo
+// dejaria el mapeo sin paginas debajo
+int escribeImagenVMI(MaquinaVirtual *mv, const char *filename){
+    char *temporal = malloc(strlen(filename) + 5);
+    if(temporal == NULL){
+        fprintf(mv->salida, "Error: No se pudo crear el archivo \n");
+        return -1;
+    }
+    sprintf(temporal, "%s.tmp", filename);
+    FILE *vmi_file = fopen(temporal, "wb");
     if(vmi_file == NULL){
-        printf("Error: No se pudo crear el archivo \n");
+        fprintf(mv->salida, "Error: No se pudo crear el archivo \n");
+        free(temporal);
         return -1;
     }
 
     VMIHeader encabezado;
     memcpy(encabezado.identificador, "VMI25", 5);
-    encabezado.version = 1;
-    encabezado.tamanio_mem = convertirBigEndian16(TAMANIO_MEMORIA / 1024);
+    encabezado.version = imagenComprimida ? VERSION_VMI_COMPRIMIDA : VERSION_VMI;
+    encabezado.tamanio_mem = convertirBigEndian16(mv->TAMANIO_MEMORIA / 1024);
 
     if(fwrite(&encabezado, sizeof(VMIHeader), 1, vmi_file) != 1){
         fclose(vmi_file);
+        remove(temporal);
+        free(temporal);
         return -1;
     }
 
-    for ( i = 0; i < NUM_REGISTROS; i++) {
-        uint32_t reg_be = convertirBigEndian32(Registros[i]);
-        fwrite(&reg_be, sizeof(uint32_t), 1, vmi_file);
-    }
-    for(i=0; i<NUM_SEG; i++){
-        base_vmi= convertirBigEndian16(tablaSegmentos[i].base);
-        tam_vmi= convertirBigEndian16(tablaSegmentos[i].tamanio);
-        fwrite(&base_vmi, sizeof(uint16_t), 1, vmi_file);
-        fwrite(&tam_vmi, sizeof(uint16_t), 1, vmi_file);
+    int errores = escribeEstadoVMI(mv, vmi_file) != 0;
+    if (imagenComprimida) {
+        errores |= escribeMemoriaComprimida(mv, vmi_file) != 0;
+    } else {
+        errores |= fwrite(mv->MemoriaPrincipal, 1, mv->TAMANIO_MEMORIA, vmi_file) != mv->TAMANIO_MEMORIA;
     }
-
-    if (fwrite(MemoriaPrincipal, 1, TAMANIO_MEMORIA, vmi_file) != TAMANIO_MEMORIA) {
+    if (errores) {
         fclose(vmi_file);
+        remove(temporal);
+        free(temporal);
         return -1;
     }
 
-    fclose(vmi_file);
-    printf("Estado de la MV guardado en %s\n",filename);
+    if (fclose(vmi_file) != 0) {
+        remove(temporal);
+        free(temporal);
+        return -1;
+    }
+#ifdef _WIN32
+    remove(filename); //en Windows rename no reemplaza un archivo existente
+#endif
+    if (rename(temporal, filename) != 0) {
+        fprintf(mv->salida, "Error: No se pudo crear el archivo \n");
+        remove(temporal);
+        free(temporal);
+        return -1;
+    }
+    free(temporal);
+    fprintf(mv->salida, "Estado de la MV guardado en %s\n",filename);
     return 0;
 }
 
 
 //-----------------FUNCIONES DE REGISTROS--------------
-int verificaRegistro(uint8_t numReg, uint8_t sector) {
+int verificaRegistro(MaquinaVirtual *mv, uint8_t numReg, uint8_t sector) {
     if (numReg >= NUM_REGISTROS || sector > 3) {
-        detectaError(COD_ERR_REG, numReg);
+        detectaError(mv, COD_ERR_REG, numReg);
         return -1;
     }
     return 0;
 }
 
-int32_t obtenerValorRegistro(uint8_t numReg, uint8_t sector) {
-    int32_t valor = (int32_t)Registros[numReg];
+int32_t obtenerValorRegistro(MaquinaVirtual *mv, uint8_t numReg, uint8_t sector) {
+    int32_t valor = (int32_t)mv->Registros[numReg];
 
     if (numReg == POS_DS) {
         return valor;
@@ -576,33 +771,33 @@ int32_t obtenerValorRegistro(uint8_t numReg, uint8_t sector) {
         case 0x02: return (int8_t)((valor >> 8) & 0xFF);// Obtener la parte media del registro
         case 0x03: return (int16_t)(valor & 0xFFFF); // Obtener la parte alta del registro
         default:
-            detectaError(COD_ERR_REG, numReg);
+            detectaError(mv, COD_ERR_REG, numReg);
             return 0;
     }
 }
 
-void escribirEnRegistro(uint8_t numReg, uint8_t sector, int32_t valor) {
+void escribirEnRegistro(MaquinaVirtual *mv, uint8_t numReg, uint8_t sector, int32_t valor) {
     //registro verificado en funcion que la invoca
     switch(sector){
         case 0x00:
-            Registros[numReg] = valor;
+            mv->Registros[numReg] = valor;
             break; // Escribir el valor completo en el registro
         case 0x01:
-            Registros[numReg] = (Registros[numReg] & 0xFFFFFF00) | (valor & 0xFF);
+            mv->Registros[numReg] = (mv->Registros[numReg] & 0xFFFFFF00) | (valor & 0xFF);
             break; // Escribir en la parte baja del registro
         case 0x02:
-            Registros[numReg] = (Registros[numReg] & 0xFFFF00FF) | ((valor & 0xFF) << 8);
+            mv->Registros[numReg] = (mv->Registros[numReg] & 0xFFFF00FF) | ((valor & 0xFF) << 8);
             break; // Escribir en la parte media del registro
         case 0x03:
-            Registros[numReg] = (Registros[numReg] & 0xFFFF0000) | (valor & 0xFFFF);
+            mv->Registros[numReg] = (mv->Registros[numReg] & 0xFFFF0000) | (valor & 0xFFFF);
             break; // Escribir en la parte alta del registro
         default:
-            detectaError(COD_ERR_REG, numReg);
+            detectaError(mv, COD_ERR_REG, numReg);
             return;
     }
 }
 
-uint32_t calculaDireccionSalto(uint8_t tipoA, uint32_t operandoA, uint8_t tamA) {
+uint32_t calculaDireccionSalto(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tamA) {
     //los saltos son con respecto al Code Segment
     uint32_t direccionSalto;
     uint32_t offset;
@@ -610,87 +805,104 @@ uint32_t calculaDireccionSalto(uint8_t tipoA, uint32_t operandoA, uint8_t tamA)
     if(tipoA == OP_REG) {
         uint8_t numReg = operandoA & 0x1F;
         uint8_t sector = (operandoA >> 6) & 0x03;
-        offset = obtenerValorRegistro(numReg, sector); // Obtener el offset que guarda el registro
+        offset = obtenerValorRegistro(mv, numReg, sector); // Obtener el offset que guarda el registro
 
     } else if(tipoA == OP_INM) {
         offset = operandoA;
 
     } else if(tipoA == OP_MEM) {
-        uint32_t direccionFisica = calculaDireccionFisica(operandoA);
-        offset = leerMemoria(direccionFisica, tamA); // Leer el offset de memoria
+        uint32_t direccionFisica = calculaDireccionFisica(mv, operandoA);
+        offset = leerMemoria(mv, direccionFisica, tamA); // Leer el offset de memoria
 
     } else {
-        detectaError(COD_ERR_OPE, tipoA);
+        detectaError(mv, COD_ERR_OPE, tipoA);
         return 0xFFFFFFFF;
     }
     // Verificar si la direccion de salto es valida
-    if (offset >= tablaSegmentos[Registros[POS_CS]>>16].tamanio) {
+    if (offset >= mv->tablaSegmentos[mv->Registros[POS_CS]>>16].tamanio) {
         return 0xFFFFFFFF;
     }
-    direccionSalto = (Registros[POS_CS] & 0xFFFF0000) | offset;
+    direccionSalto = (mv->Registros[POS_CS] & 0xFFFF0000) | offset;
     return direccionSalto;
 }
 
-void actualizarCC(int32_t resultado) {
-    Registros[POS_CC] &= ~(CC_N | CC_Z);
-    // Bit N (signo)
-    if (resultado < 0) {
-        Registros[POS_CC] |= CC_N;
-    }
-
-    // Bit Z (cero)
-    if (resultado == 0) {
-        Registros[POS_CC] |= CC_Z;
+void actualizarCC(MaquinaVirtual *mv, int32_t resultado) {
+    // Los bits N y Z se calculan en materializaCC, si alguien los lee
+    mv->resultadoCC = resultado;
+    mv->ccPendiente = 1;
+}
+
+void calculaRegistrosInternos(MaquinaVirtual *mv) {
+    if (mv->instruccionPendiente != NULL) {
+        mv->Registros[POS_OPC] = mv->instruccionPendiente->codOp;
+        mv->Registros[POS_OP1] = mv->instruccionPendiente->valorOP1;
+        mv->Registros[POS_OP2] = mv->instruccionPendiente->valorOP2;
+        mv->instruccionPendiente = NULL;
+    }
+    if (mv->accesoPendiente) {
+        // Misma traduccion que calculaDireccionFisica, sin informar errores: si el
+        // acceso fallo la MV ya se detuvo. Es el ultimo acceso a memoria, asi que
+        // lo leido o escrito sigue ahi
+        uint16_t segmento = mv->accesoPendienteLAR >> 16;
+        uint16_t offset = mv->accesoPendienteLAR & 0xFFFF;
+        uint32_t direccionFisica = 0;
+        if (segmento < NUM_SEG && offset < mv->tablaSegmentos[segmento].tamanio &&
+            mv->tablaSegmentos[segmento].base + offset < mv->TAMANIO_MEMORIA) {
+            direccionFisica = mv->tablaSegmentos[segmento].base + offset;
+        }
+        mv->Registros[POS_LAR] = mv->accesoPendienteLAR;
+        mv->Registros[POS_MAR] = (4 << 16) | (direccionFisica & 0x0000FFFF);
+        mv->Registros[POS_MBR] = 0;
+        if (direccionFisica + 4 <= mv->TAMANIO_MEMORIA) {
+            mv->Registros[POS_MBR] = cargaBE32(&mv->MemoriaPrincipal[direccionFisica]);
+        }
+        mv->accesoPendiente = 0;
     }
 }
 
 //---------------------FUNCIONES DE OPERANDOS------------------
-void guardaRegistroOP(uint8_t tipo, uint32_t operando, uint8_t tipoOP_AB){
+void guardaRegistroOP(MaquinaVirtual *mv, uint8_t tipo, uint32_t operando, uint8_t tipoOP_AB){
     if(tipoOP_AB == 1){
-        Registros[POS_OP1] = (tipo<<24) | operando;
+        mv->Registros[POS_OP1] = (tipo<<24) | operando;
     }else if(tipoOP_AB == 2){
-        Registros[POS_OP2] = (tipo<<24) | operando;
+        mv->Registros[POS_OP2] = (tipo<<24) | operando;
     }
 }
 
-uint32_t obtenerOperando(uint8_t tipo, unsigned int *ip, uint8_t *tam, uint8_t tipoOP_AB) {
+uint32_t obtenerOperando(MaquinaVirtual *mv, uint8_t tipo, unsigned int *ip, uint8_t *tam, uint8_t tipoOP_AB) {
     uint32_t operando = 0;
-    uint8_t byte1, byte2, byte3;
+    uint8_t byte1;
     // Verifica si el operando es valido, y mueve el IP
-    uint32_t ip_aux=calculaDireccionFisica(*ip);
+    uint32_t ip_aux=calculaDireccionFisica(mv, *ip);
 
     *tam=4;
     if(tipo == OP_REG) { // Operando de registro (1 byte)
-        byte1 = MemoriaPrincipal[ip_aux];
+        byte1 = mv->MemoriaPrincipal[ip_aux];
         (*ip)++; ip_aux++;
         uint8_t numReg = byte1 & 0x1F;
         uint8_t sector = (byte1 >> 6) & 0x03;
-        if(verificaRegistro(numReg, sector) == 0) {
+        if(numReg == POS_CC)
+            materializaCC(mv); //la instruccion lee o escribe CC completo
+        if(verificaRegistro(mv, numReg, sector) == 0) {
             operando = byte1;
-            guardaRegistroOP(OP_REG, operando, tipoOP_AB);
+            guardaRegistroOP(mv, OP_REG, operando, tipoOP_AB);
         }else{
             return 0;
         }
         
 
     }else if(tipo == OP_INM) { // Operando inmediato (2 bytes)
-        byte1 = MemoriaPrincipal[ip_aux];
-        byte2 = MemoriaPrincipal[ip_aux + 1];
+        uint16_t inmediato = cargaBE16(&mv->MemoriaPrincipal[ip_aux]); // Valor inmediato de 16 bits
         (*ip) += 2; ip_aux += 2;
-        operando = (byte1 << 8) | byte2; // Ensamblar el valor inmediato de 16 bits
-        // Si el valor es negativo, extiendo para signo
-        if (operando & 0x8000) {
-            operando |= 0xFFFF0000;
-        }
+        operando = (uint32_t)(int32_t)(int16_t)inmediato; // Extendido con signo
 
         //guardar en OP1 u OP2
-        uint32_t operandoOP = byte1 << 8 | byte2;
-        guardaRegistroOP(OP_INM, operandoOP, tipoOP_AB);
+        uint32_t operandoOP = inmediato;
+        guardaRegistroOP(mv, OP_INM, operandoOP, tipoOP_AB);
 
     }else if(tipo == OP_MEM) { // Operando de memoria (3 bytes)
-        byte1 = MemoriaPrincipal[ip_aux];
-        byte2 = MemoriaPrincipal[ip_aux + 1];
-        byte3 = MemoriaPrincipal[ip_aux + 2];
+        byte1 = mv->MemoriaPrincipal[ip_aux];
+        uint16_t offset = cargaBE16(&mv->MemoriaPrincipal[ip_aux + 1]); // Offset de 16 bits
         (*ip) += 3; ip_aux += 3;
 
         //Determinar tamanio de acceso:
@@ -702,625 +914,639 @@ uint32_t obtenerOperando(uint8_t tipo, unsigned int *ip, uint8_t *tam, uint8_t t
         }
 
         uint8_t codReg = byte1 & 0x1F; // Extrae posicion del registro que guarda la memoria
-        uint16_t offsetReg = (Registros[codReg]) & 0xFFFF; // Extraer el offset del registro
-        uint16_t offset = (uint16_t)(byte2 << 8) | byte3; // Ensambla el offset de 16 bits
+        if(codReg == POS_CC)
+            materializaCC(mv);
+        uint16_t offsetReg = (mv->Registros[codReg]) & 0xFFFF; // Extraer el offset del registro
         
         // Calcular direccion logica
-        uint32_t base = Registros[codReg] >>16; // Extrae el segmento
+        uint32_t base = mv->Registros[codReg] >>16; // Extrae el segmento
         uint32_t direccionLogica = (base << 16) | (offset+offsetReg); // Ensambla la direccion logica
 
         operando = direccionLogica; //Devuelve DIRECCION LOGICA
 
         //guardar en OP1 u OP2
-        uint32_t operandoOP = byte1 << 16 | byte2 << 8 | byte3;
-        guardaRegistroOP(OP_MEM, operandoOP, tipoOP_AB);
+        uint32_t operandoOP = (uint32_t)byte1 << 16 | offset;
+        guardaRegistroOP(mv, OP_MEM, operandoOP, tipoOP_AB);
     }else {
-        detectaError(COD_ERR_OPE, tipo);
+        detectaError(mv, COD_ERR_OPE, tipo);
         return 0;
     }
 
     return operando;
 }
 
-int32_t obtenerValorOperando(uint8_t tipoOp, uint32_t operando, uint8_t tamanio){
+int32_t obtenerValorOperando(MaquinaVirtual *mv, uint8_t tipoOp, uint32_t operando, uint8_t tamanio){
     int32_t valor = 0;
 
     if (tipoOp == OP_REG) {
         uint8_t numReg = operando & 0x1F;
         uint8_t sector = (operando >> 6) & 0x03;
-        valor =(int32_t) obtenerValorRegistro(numReg, sector);
+        valor =(int32_t) obtenerValorRegistro(mv, numReg, sector);
 
     } else if (tipoOp == OP_INM) {
         valor = (int32_t)operando;
     } else if (tipoOp == OP_MEM) {
-        uint32_t direccionFisica = calculaDireccionFisica(operando);
-        valor = (int32_t) leerMemoria(direccionFisica, tamanio);    
+        uint32_t direccionFisica = traduceAcceso(mv, operando, tamanio);
+        valor = leeMemoriaTraducida(mv, direccionFisica, tamanio);
 
         //guardo en LAR la direccion logica
-        Registros[POS_LAR] = operando; 
+        mv->Registros[POS_LAR] = operando; 
         // guardo en la parte alta del MAR la cantidad de bytes
-        Registros[POS_MAR] = tamanio << 16;
+        mv->Registros[POS_MAR] = tamanio << 16;
         //guardo en la parte baja del MAR la direccion fisica
-        Registros[POS_MAR]= (Registros[POS_MAR] & 0xFFFF0000) | (direccionFisica & 0x0000FFFF);
+        mv->Registros[POS_MAR]= (mv->Registros[POS_MAR] & 0xFFFF0000) | (direccionFisica & 0x0000FFFF);
         //guardo en MBR el valor leido 
-        Registros[POS_MBR] = valor; 
+        mv->Registros[POS_MBR] = valor; 
 
     } else {
-        detectaError(COD_ERR_OPE, tipoOp);
+        detectaError(mv, COD_ERR_OPE, tipoOp);
         return 0;
     }
     return valor;
 }
 
-void escribirValorOperando(uint8_t tipoOp, uint32_t operando, int32_t valor, uint8_t tamA){
+void escribirValorOperando(MaquinaVirtual *mv, uint8_t tipoOp, uint32_t operando, int32_t valor, uint8_t tamA){
 
     if(tipoOp == OP_REG) {
         uint8_t numReg = operando & 0x1F;
         uint8_t sector = (operando >> 6) & 0x03;
-        escribirEnRegistro(numReg, sector, valor);
+        escribirEnRegistro(mv, numReg, sector, valor);
     } else if(tipoOp == OP_MEM) {
-        uint32_t direccionFisica = calculaDireccionFisica(operando);
-        escribirMemoria(direccionFisica, valor, tamA);
+        uint32_t direccionFisica = traduceAcceso(mv, operando, tamA);
+        escribeMemoriaTraducida(mv, direccionFisica, valor, tamA);
         
         //guardo en LAR la direccion logica
-        Registros[POS_LAR] = operando; 
+        mv->Registros[POS_LAR] = operando; 
         // guardo en la parte alta del MAR la cantidad de bytes
-        Registros[POS_MAR] = tamA << 16;
+        mv->Registros[POS_MAR] = tamA << 16;
         //guardo en la parte baja del MAR la direccion fisica
-        Registros[POS_MAR]= (Registros[POS_MAR] & 0xFFFF0000) | (direccionFisica & 0x0000FFFF);
+        mv->Registros[POS_MAR]= (mv->Registros[POS_MAR] & 0xFFFF0000) | (direccionFisica & 0x0000FFFF);
         //guardo en MBR el valor leido 
-        Registros[POS_MBR] = valor; 
+        mv->Registros[POS_MBR] = valor; 
     } else {
-        detectaError(COD_ERR_OPE,tipoOp);
+        detectaError(mv, COD_ERR_OPE,tipoOp);
     }
 }
 
 //----------------FUNCIONES DE INSTRUCCIONES--------------------
-void ejecutarMOV(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA,uint8_t tamB) {
+void ejecutarMOV(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA,uint8_t tamB) {
     int32_t valor;
 
-    valor = obtenerValorOperando(tipoB, operandoB, tamB);
-    escribirValorOperando(tipoA, operandoA, valor, tamA);
+    valor = obtenerValorOperando(mv, tipoB, operandoB, tamB);
+    escribirValorOperando(mv, tipoA, operandoA, valor, tamA);
     // MOV no afecta el registro CC
 }
 
-void ejecutarADD(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
+void ejecutarADD(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
     int32_t valorA, valorB, resultado;
     // Obtener valor del operando B (fuente)
-    valorB = obtenerValorOperando(tipoB, operandoB, tamB);
+    valorB = obtenerValorOperando(mv, tipoB, operandoB, tamB);
 
     // Obtener valor del operando A (destino)
-    valorA = obtenerValorOperando(tipoA, operandoA, tamA);
+    valorA = obtenerValorOperando(mv, tipoA, operandoA, tamA);
 
     // Verificar overflow
     if ((valorB > 0 && valorA > INT32_MAX - valorB) || (valorB < 0 && valorA < INT32_MIN - valorB)) {
-        detectaError(COD_ERR_OVF,0x0);
+        detectaError(mv, COD_ERR_OVF,0x0);
         return;
     }
     // Sumar los valores
     resultado = valorA + valorB;
 
     //Guardo resultado
-    escribirValorOperando(tipoA, operandoA, resultado,tamA);
+    escribirValorOperando(mv, tipoA, operandoA, resultado,tamA);
 
     // Actualizar el registro de condicion (CC)
-    actualizarCC(resultado);
+    actualizarCC(mv, resultado);
 }
 
-void ejecutarSUB(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
+void ejecutarSUB(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
     int32_t valorA, valorB, resultado;
     //fuente
-    valorB = obtenerValorOperando(tipoB, operandoB, tamB);
+    valorB = obtenerValorOperando(mv, tipoB, operandoB, tamB);
 
     //destino
-    valorA = obtenerValorOperando(tipoA, operandoA, tamA);
+    valorA = obtenerValorOperando(mv, tipoA, operandoA, tamA);
 
     // Verificar overflow
     if ((valorB > 0 && valorA < INT32_MIN + valorB) || (valorB < 0 && valorA > INT32_MAX + valorB)) {
-        detectaError(COD_ERR_OVF,0x00);
+        detectaError(mv, COD_ERR_OVF,0x00);
         return;
     }
 
     // Restar los valores
     resultado = valorA - valorB;
     //Guardar resultado
-    escribirValorOperando(tipoA, operandoA, resultado, tamA);
+    escribirValorOperando(mv, tipoA, operandoA, resultado, tamA);
 
     // Actualizar el registro de condicion (CC)
-    actualizarCC(resultado);
+    actualizarCC(mv, resultado);
 }
 
-void ejecutarMUL(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
+void ejecutarMUL(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
     int32_t resultado, valorA, valorB;
     //Fuente
-    valorB = (int32_t)obtenerValorOperando(tipoB, operandoB, tamB);
+    valorB = (int32_t)obtenerValorOperando(mv, tipoB, operandoB, tamB);
     //Destino
-    valorA = (int32_t)obtenerValorOperando(tipoA, operandoA, tamA);
+    valorA = (int32_t)obtenerValorOperando(mv, tipoA, operandoA, tamA);
 
-    // Verificar overflow
-    if ((valorB > 0 && valorA > INT32_MAX / valorB) || (valorB < 0 && valorA < INT32_MIN / valorB)) {
-        detectaError(COD_ERR_OVF,0x00);
+    // Verificar overflow (INT32_MIN / -1 no se puede calcular en el host)
+    if ((valorB > 0 && valorA > INT32_MAX / valorB) || (valorB == -1 && valorA == INT32_MIN) ||
+        (valorB < -1 && valorA < INT32_MIN / valorB)) {
+        detectaError(mv, COD_ERR_OVF,0x00);
         return;
     }
     // Multiplicar los valores
     resultado = valorA * valorB;
     //Guardar resultado
-    escribirValorOperando(tipoA, operandoA, resultado, tamA);
+    escribirValorOperando(mv, tipoA, operandoA, resultado, tamA);
 
-    actualizarCC(resultado); // Actualizar el registro de condicion (CC)
+    actualizarCC(mv, resultado); // Actualizar el registro de condicion (CC)
 }
 
-void ejecutarDIV(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
+void ejecutarDIV(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
     int32_t resultado, resto, valorA, valorB;
 
     //Fuente
-    valorB = (int32_t)obtenerValorOperando(tipoB, operandoB,tamB);
+    valorB = (int32_t)obtenerValorOperando(mv, tipoB, operandoB,tamB);
     //Destino
-    valorA = (int32_t)obtenerValorOperando(tipoA, operandoA,tamA);
+    valorA = (int32_t)obtenerValorOperando(mv, tipoA, operandoA,tamA);
 
     // Verificar division por cero
     if (valorB == 0) {
-        detectaError(COD_ERR_DIV,0x00); // Error en la division
+        detectaError(mv, COD_ERR_DIV,0x00); // Error en la division
         return;
     }
-    // Dividir los valores
-    resultado = valorA / valorB;
-    resto = valorA % valorB; // Obtener el resto de la division
+    // Dividir los valores. INT32_MIN / -1 no entra en 32 bits y en el host es
+    // una excepcion que terminaria el proceso (y con el, todo el lote)
+    if (valorB == -1 && valorA == INT32_MIN) {
+        resultado = INT32_MIN;
+        resto = 0;
+    } else {
+        resultado = valorA / valorB;
+        resto = valorA % valorB; // Obtener el resto de la division
+    }
 
     //Guardar resultado
-    escribirValorOperando(tipoA, operandoA, resultado,tamA);
+    escribirValorOperando(mv, tipoA, operandoA, resultado,tamA);
 
     // Actualizar el registro de condicion (CC)
-    actualizarCC(resultado);
+    actualizarCC(mv, resultado);
 
     // Guardar el resto en el registro (AC)
-    Registros[POS_AC] = resto;
+    mv->Registros[POS_AC] = resto;
 }
 
-void ejecutarCMP(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
+void ejecutarCMP(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
     int32_t valorA, valorB, resultado;
     //SUB no guarda el valor en ningun registro ni memoria, solo actualiza el CC
 
     //Fuente
-    valorB = (int32_t)obtenerValorOperando(tipoB, operandoB, tamB);
+    valorB = (int32_t)obtenerValorOperando(mv, tipoB, operandoB, tamB);
     //Destino
-    valorA = (int32_t)obtenerValorOperando(tipoA, operandoA, tamA);
+    valorA = (int32_t)obtenerValorOperando(mv, tipoA, operandoA, tamA);
 
     // Restar los valores
     resultado = valorA - valorB;
     // Actualizar el registro de condicion (CC)
-    actualizarCC(resultado);
+    actualizarCC(mv, resultado);
 }
 
-void ejecutarSHL(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
+void ejecutarSHL(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
     int32_t valorA, valorB, resultado;
 
     //Fuente
-    valorB = (int32_t)obtenerValorOperando(tipoB, operandoB, tamB);
+    valorB = (int32_t)obtenerValorOperando(mv, tipoB, operandoB, tamB);
 
     // Verificar que el valor B sea un desplazamiento valido
     if (valorB < 0 || valorB > 31) {
-        detectaError(COD_ERR_OPE, 0x00);
+        detectaError(mv, COD_ERR_OPE, 0x00);
         return;
     }
 
     //Destino
-    valorA = (int32_t)obtenerValorOperando(tipoA, operandoA, tamA);
+    valorA = (int32_t)obtenerValorOperando(mv, tipoA, operandoA, tamA);
 
     //Desplazar a la izquierda el valor A
     resultado = valorA << valorB;
 
     //Guardar resultado
-    escribirValorOperando(tipoA, operandoA, resultado, tamA);
+    escribirValorOperando(mv, tipoA, operandoA, resultado, tamA);
 
     // Actualizar el registro de condicion (CC)
-    actualizarCC(resultado);
+    actualizarCC(mv, resultado);
 }
 
-void ejecutarSHR(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
+void ejecutarSHR(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
     int32_t valorA_signo, valorB, resultado_signo;
     uint32_t valorA_sin, resultado_sin;
 
-    valorB = (int32_t)obtenerValorOperando(tipoB, operandoB, tamB);
+    valorB = (int32_t)obtenerValorOperando(mv, tipoB, operandoB, tamB);
     //Verificar que el valor B sea un desplazamiento valido
     if (valorB < 0 || valorB > 31) {
-        detectaError(COD_ERR_OPE, 0x0); // Error en el desplazamiento
+        detectaError(mv, COD_ERR_OPE, 0x0); // Error en el desplazamiento
         return;
     }
 
     //Destino
-    valorA_signo = (int32_t)obtenerValorOperando(tipoA, operandoA, tamA);
+    valorA_signo = (int32_t)obtenerValorOperando(mv, tipoA, operandoA, tamA);
     valorA_sin = (uint32_t) valorA_signo; // Asegurar que el bit de signo sea 0 para SHR
     //Desplazar a la derecha el valor A
     resultado_sin = valorA_sin >> valorB;
 
     resultado_signo = (int32_t) resultado_sin;
 
-    escribirValorOperando(tipoA, operandoA, resultado_signo, tamA);
+    escribirValorOperando(mv, tipoA, operandoA, resultado_signo, tamA);
 
     //Actualizar el registro de condicion (CC)
-    actualizarCC(resultado_signo);
+    actualizarCC(mv, resultado_signo);
 }
 
-void ejecutarSAR(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
+void ejecutarSAR(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
     int32_t valorA, valorB, resultado;
     //Fuente
-    valorB = (int32_t)obtenerValorOperando(tipoB, operandoB, tamB);
+    valorB = (int32_t)obtenerValorOperando(mv, tipoB, operandoB, tamB);
 
     //Verificar que el valor B sea un desplazamiento valido
     if (valorB < 0 || valorB > 31) {
-        detectaError(COD_ERR_OPE, 0x0); // Error en el desplazamiento
+        detectaError(mv, COD_ERR_OPE, 0x0); // Error en el desplazamiento
         return;
     }
 
     //Destino
-    valorA = (int32_t)obtenerValorOperando(tipoA, operandoA, tamA);
+    valorA = (int32_t)obtenerValorOperando(mv, tipoA, operandoA, tamA);
 
     //Desplazar a la derecha el valor A
     resultado = valorA >> valorB;
     //Guardar resultado
-    escribirValorOperando(tipoA, operandoA, resultado, tamA);
+    escribirValorOperando(mv, tipoA, operandoA, resultado, tamA);
 
     //Actualizar el registro de condicion (CC)
-    actualizarCC(resultado);
+    actualizarCC(mv, resultado);
 }
 
-void ejecutarAND(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
+void ejecutarAND(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
     int32_t valorA, valorB, resultado;
 
     //Fuente
-    valorB = (int32_t)obtenerValorOperando(tipoB, operandoB, tamB);
+    valorB = (int32_t)obtenerValorOperando(mv, tipoB, operandoB, tamB);
     //Destino
-    valorA = (int32_t)obtenerValorOperando(tipoA, operandoA, tamA);
+    valorA = (int32_t)obtenerValorOperando(mv, tipoA, operandoA, tamA);
 
     //Realizar la operacion AND
     resultado = valorA & valorB;
     //Guardar resultado
-    escribirValorOperando(tipoA, operandoA, resultado, tamA);
+    escribirValorOperando(mv, tipoA, operandoA, resultado, tamA);
 
     // Actualizar el registro de condicion (CC)
-    actualizarCC(resultado);
+    actualizarCC(mv, resultado);
 }
 
-void ejecutarOR(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
+void ejecutarOR(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
     int32_t valorA, valorB, resultado;
 
     //Fuente
-    valorB = (int32_t)obtenerValorOperando(tipoB, operandoB, tamB);
+    valorB = (int32_t)obtenerValorOperando(mv, tipoB, operandoB, tamB);
     //Destino
-    valorA = (int32_t)obtenerValorOperando(tipoA, operandoA, tamA);
+    valorA = (int32_t)obtenerValorOperando(mv, tipoA, operandoA, tamA);
 
     //Realizar la operacion OR
     resultado = valorA | valorB;
 
     //Guardar resultado
-    escribirValorOperando(tipoA, operandoA, resultado,tamA);
+    escribirValorOperando(mv, tipoA, operandoA, resultado,tamA);
 
     //Actualizar el registro de condicion (CC)
-    actualizarCC(resultado);
+    actualizarCC(mv, resultado);
 }
 
-void ejecutarXOR(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
+void ejecutarXOR(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
     int32_t valorA, valorB, resultado;
 
     //Fuente
-    valorB = (int32_t)obtenerValorOperando(tipoB, operandoB, tamB);
+    valorB = (int32_t)obtenerValorOperando(mv, tipoB, operandoB, tamB);
     //Destino
-    valorA = (int32_t)obtenerValorOperando(tipoA, operandoA, tamA);
+    valorA = (int32_t)obtenerValorOperando(mv, tipoA, operandoA, tamA);
 
     //Realizar la operacion XOR
     resultado = valorA ^ valorB;
 
     //Guardar resultado
-    escribirValorOperando(tipoA, operandoA, resultado, tamA);
+    escribirValorOperando(mv, tipoA, operandoA, resultado, tamA);
 
     // Actualizar el registro de condicion (CC)
-    actualizarCC(resultado);
+    actualizarCC(mv, resultado);
 }
 
-void ejecutarSWAP(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB){
+void ejecutarSWAP(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB){
     uint32_t valorA, valorB;
     //Verificar que los tamanios son compatibles
     if(tamA != tamB){
-        detectaError(COD_ERR_OPE, 0x0);
+        detectaError(mv, COD_ERR_OPE, 0x0);
         return;
     }
 
     // Obtener valor del operando A
-    valorA = obtenerValorOperando(tipoA, operandoA, tamA);
+    valorA = obtenerValorOperando(mv, tipoA, operandoA, tamA);
     // Obtener valor del operando B
-    valorB = obtenerValorOperando(tipoB, operandoB, tamB);
+    valorB = obtenerValorOperando(mv, tipoB, operandoB, tamB);
 
     // Intercambiar los valores
-    escribirValorOperando(tipoA, operandoA, valorB, tamB);
-    escribirValorOperando(tipoB, operandoB, valorA, tamA);
+    escribirValorOperando(mv, tipoA, operandoA, valorB, tamB);
+    escribirValorOperando(mv, tipoB, operandoB, valorA, tamA);
 
     //SWAP no afecta el registro CC
 }
 
-void ejecutarLDL(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
+void ejecutarLDL(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB) {
     int32_t valorA, valorB;
 
-    valorB = (int32_t)obtenerValorOperando(tipoB, operandoB, tamB);
-    valorA = (int32_t)obtenerValorOperando(tipoA, operandoA, tamA);
+    valorB = (int32_t)obtenerValorOperando(mv, tipoB, operandoB, tamB);
+    valorA = (int32_t)obtenerValorOperando(mv, tipoA, operandoA, tamA);
 
     int32_t resultado = (valorB & 0xFFFF) | (valorA & 0xFFFF0000);
 
     //Guardo el valor
-    escribirValorOperando(tipoA, operandoA, resultado, tamA);
+    escribirValorOperando(mv, tipoA, operandoA, resultado, tamA);
 
 }
 
-void ejecutarLDH(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB, uint8_t tamA, uint8_t tamB) {
+void ejecutarLDH(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB, uint8_t tamA, uint8_t tamB) {
     int32_t valorA, valorB;
 
-    valorB = (int32_t)obtenerValorOperando(tipoB, operandoB, tamB);
-    valorA = (int32_t)obtenerValorOperando(tipoA, operandoA, tamA);
+    valorB = (int32_t)obtenerValorOperando(mv, tipoB, operandoB, tamB);
+    valorA = (int32_t)obtenerValorOperando(mv, tipoA, operandoA, tamA);
 
     int32_t resultado = ((valorB & 0xFFFF) <<16 ) | (valorA & 0xFFFF);
 
-    escribirValorOperando(tipoA, operandoA, resultado, tamA);
+    escribirValorOperando(mv, tipoA, operandoA, resultado, tamA);
 }
 
-void ejecutarRND(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB, uint8_t tamA, uint8_t tamB) {
+void ejecutarRND(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB, uint8_t tamA, uint8_t tamB) {
     int32_t max;
 
     //Fuente
-    max = (int32_t)obtenerValorOperando(tipoB, operandoB, tamB);
+    max = (int32_t)obtenerValorOperando(mv, tipoB, operandoB, tamB);
 
     // Generar un numero aleatorio entre 0 y valorB
     int32_t resultado = rand() % (max + 1);
 
     //Guardar resultado
-    escribirValorOperando(tipoA, operandoA, resultado, tamA);
+    escribirValorOperando(mv, tipoA, operandoA, resultado, tamA);
 }
 
-void ejecutarJMP(uint8_t tipoA, uint32_t operandoA, uint8_t tamA) {
+void ejecutarJMP(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tamA) {
     // Salta a la direccion especificada en el operando A
-    uint32_t direccionSalto = calculaDireccionSalto(tipoA, operandoA, tamA);
+    uint32_t direccionSalto = calculaDireccionSalto(mv, tipoA, operandoA, tamA);
 
     if(direccionSalto != 0xFFFFFFFF) {
-        Registros[POS_IP] = direccionSalto; // Actualizar el IP con la direccion de salto
+        mv->Registros[POS_IP] = direccionSalto; // Actualizar el IP con la direccion de salto
     }
     else return;
 }
 
-void ejecutarJZ(uint8_t tipoA, uint32_t operandoA, uint8_t tamA){
+void ejecutarJZ(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tamA){
     // Salta a la direccion especificada en el operando A si el CC es cero
-    uint32_t direccionSalto = calculaDireccionSalto(tipoA, operandoA, tamA);
+    materializaCC(mv);
+    uint32_t direccionSalto = calculaDireccionSalto(mv, tipoA, operandoA, tamA);
 
-    if((Registros[POS_CC] & CC_Z) && direccionSalto!= 0xFFFFFFFF) {
-        Registros[POS_IP] = direccionSalto;
+    if((mv->Registros[POS_CC] & CC_Z) && direccionSalto!= 0xFFFFFFFF) {
+        mv->Registros[POS_IP] = direccionSalto;
     }
 }
 
-void ejecutarJP(uint8_t tipoA, uint32_t operandoA, uint8_t tamA){
+void ejecutarJP(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tamA){
     // Salta a la direccion especificada en el operando A si el Z=0 y N=0
-    uint32_t direccionSalto = calculaDireccionSalto(tipoA, operandoA, tamA);
+    materializaCC(mv);
+    uint32_t direccionSalto = calculaDireccionSalto(mv, tipoA, operandoA, tamA);
 
-    if(!(Registros[POS_CC] & (CC_N | CC_Z)) && direccionSalto!= 0xFFFFFFFF) {
-        Registros[POS_IP] = direccionSalto;
+    if(!(mv->Registros[POS_CC] & (CC_N | CC_Z)) && direccionSalto!= 0xFFFFFFFF) {
+        mv->Registros[POS_IP] = direccionSalto;
     }else return;
 }
 
-void ejecutarJN(uint8_t tipoA, uint32_t operandoA, uint8_t tamA){
+void ejecutarJN(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tamA){
     // Salta a la direccion especificada en el operando A si el CC es negativo
-    uint32_t direccionSalto = calculaDireccionSalto(tipoA, operandoA, tamA);
+    materializaCC(mv);
+    uint32_t direccionSalto = calculaDireccionSalto(mv, tipoA, operandoA, tamA);
 
-    if((Registros[POS_CC] & CC_N) && direccionSalto!= 0xFFFFFFFF) {
-        Registros[POS_IP] = direccionSalto;
+    if((mv->Registros[POS_CC] & CC_N) && direccionSalto!= 0xFFFFFFFF) {
+        mv->Registros[POS_IP] = direccionSalto;
     }
 }
 
-void ejecutarJNZ(uint8_t tipoA, uint32_t operandoA, uint8_t tamA){
+void ejecutarJNZ(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tamA){
 // Salta a la direccion especificada si el resultado es distinta de cero
-    uint32_t direccionSalto = calculaDireccionSalto(tipoA, operandoA, tamA);
-    uint32_t valorCC = Registros[POS_CC]; // Obtener el valor del registro de condicion
+    materializaCC(mv);
+    uint32_t direccionSalto = calculaDireccionSalto(mv, tipoA, operandoA, tamA);
+    uint32_t valorCC = mv->Registros[POS_CC]; // Obtener el valor del registro de condicion
     uint32_t cero= valorCC & CC_Z; // Obtener el valor del registro de condicion
 
     if(cero==00 && direccionSalto!= 0xFFFFFFFF) {
-        Registros[POS_IP] = direccionSalto;
+        mv->Registros[POS_IP] = direccionSalto;
     }
 }
 
-void ejecutarJNP(uint8_t tipoA, uint32_t operandoA, uint8_t tamA){
+void ejecutarJNP(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tamA){
     // Salta a la direccion especificada si el resultado es <= cero
-    uint32_t valorCC = Registros[POS_CC]; // Obtener el valor del registro de condicion
-    uint32_t direccionSalto = calculaDireccionSalto(tipoA, operandoA, tamA);
+    materializaCC(mv);
+    uint32_t valorCC = mv->Registros[POS_CC]; // Obtener el valor del registro de condicion
+    uint32_t direccionSalto = calculaDireccionSalto(mv, tipoA, operandoA, tamA);
 
     if(((valorCC & CC_N) || (valorCC & CC_Z)) && direccionSalto != 0xFFFFFFFF){
-        Registros[POS_IP] = direccionSalto;
+        mv->Registros[POS_IP] = direccionSalto;
     }
 }
 
-void ejecutarJNN(uint8_t tipoA, uint32_t operandoA, uint8_t tamA){
+void ejecutarJNN(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tamA){
     // Salta a la direccion especificada si el resultado es >= cero
-    uint32_t valorCC = Registros[POS_CC]; // Obtener el valor del registro de condicion
-    uint32_t direccionSalto = calculaDireccionSalto(tipoA, operandoA, tamA);
+    materializaCC(mv);
+    uint32_t valorCC = mv->Registros[POS_CC]; // Obtener el valor del registro de condicion
+    uint32_t direccionSalto = calculaDireccionSalto(mv, tipoA, operandoA, tamA);
 
     if(!(valorCC & CC_N) && direccionSalto != 0xFFFFFFFF){
-        Registros[POS_IP] = direccionSalto;
+        mv->Registros[POS_IP] = direccionSalto;
     }
 }
 
-void ejecutarNOT(uint8_t tipoA, uint32_t operandoA, uint8_t tamA){
+void ejecutarNOT(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tamA){
     int32_t resultado, valor;
 
-    valor = (int32_t)obtenerValorOperando(tipoA, operandoA, tamA);
+    valor = (int32_t)obtenerValorOperando(mv, tipoA, operandoA, tamA);
     resultado = ~valor;
 
-    escribirValorOperando(tipoA, operandoA, resultado, tamA);
+    escribirValorOperando(mv, tipoA, operandoA, resultado, tamA);
 
     // Actualizar el registro de condicion (CC)
-    actualizarCC(resultado);
+    actualizarCC(mv, resultado);
 }
 
-void ejecutarPUSH(int32_t valorPush){ //al pasar valor, facilita guardar IP en la pila
-    if (Registros[POS_SS] == 0xFFFFFFFF || versionPrograma==1 || (Registros[POS_SS] >> 16) >= NUM_SEG) {
-        detectaError(COD_ERR_STACK, 0);
+void ejecutarPUSH(MaquinaVirtual *mv, int32_t valorPush){ //al pasar valor, facilita guardar IP en la pila
+    if (mv->Registros[POS_SS] == 0xFFFFFFFF || mv->versionPrograma==1 || (mv->Registros[POS_SS] >> 16) >= NUM_SEG) {
+        detectaError(mv, COD_ERR_STACK, 0);
         return;
     }
 
-    uint8_t segStack = Registros[POS_SS] >> 16;
-    uint32_t nuevaSP = Registros[POS_SP] - 4;
-    if((nuevaSP & 0xFFFF)>= tablaSegmentos[segStack].tamanio){
-        detectaError(COD_ERR_STACK_OVF, nuevaSP & 0xFFFF);
+    uint8_t segStack = mv->Registros[POS_SS] >> 16;
+    uint32_t nuevaSP = mv->Registros[POS_SP] - 4;
+    if((nuevaSP & 0xFFFF)>= mv->tablaSegmentos[segStack].tamanio){
+        detectaError(mv, COD_ERR_STACK_OVF, nuevaSP & 0xFFFF);
         return;
     }
-    uint32_t dirFis = calculaDireccionFisica(nuevaSP);
+    uint32_t dirFis = calculaDireccionFisica(mv, nuevaSP);
 
     // Verificar Stack Overflow
-    if (dirFis < tablaSegmentos[segStack].base) {
-        detectaError(COD_ERR_STACK_OVF, dirFis);
+    if (dirFis < mv->tablaSegmentos[segStack].base) {
+        detectaError(mv, COD_ERR_STACK_OVF, dirFis);
         return;
     }
 
-    Registros[POS_SP] = nuevaSP;
+    mv->Registros[POS_SP] = nuevaSP;
 
-    escribirMemoria(dirFis, valorPush, 4);
+    escribirMemoria(mv, dirFis, valorPush, 4);
 }
 
-int32_t ejecutarPOP(int *error){
-    if (Registros[POS_SS] == 0xFFFFFFFF || versionPrograma==1 || (Registros[POS_SS] >> 16) >= NUM_SEG) {
+int32_t ejecutarPOP(MaquinaVirtual *mv, int *error){
+    if (mv->Registros[POS_SS] == 0xFFFFFFFF || mv->versionPrograma==1 || (mv->Registros[POS_SS] >> 16) >= NUM_SEG) {
         *error=1;
-        detectaError(COD_ERR_STACK, 0);
+        detectaError(mv, COD_ERR_STACK, 0);
         return 0;
     }
 
-    uint8_t segStack = Registros[POS_SS] >> 16;
-    uint16_t offset = Registros[POS_SP] & 0xFFFF;
+    uint8_t segStack = mv->Registros[POS_SS] >> 16;
+    uint16_t offset = mv->Registros[POS_SP] & 0xFFFF;
 
-    if (offset + 4 > tablaSegmentos[segStack].tamanio) {
+    if (offset + 4 > mv->tablaSegmentos[segStack].tamanio) {
         *error=1;
-        detectaError(COD_ERR_STACK_UDF, Registros[POS_SP]);
+        detectaError(mv, COD_ERR_STACK_UDF, mv->Registros[POS_SP]);
         return 0;
     }
 
-    uint32_t dirFis = calculaDireccionFisica(Registros[POS_SP]);
-    int32_t valor = leerMemoria(dirFis, 4);
-    Registros[POS_SP] += 4;
+    uint32_t dirFis = calculaDireccionFisica(mv, mv->Registros[POS_SP]);
+    int32_t valor = leerMemoria(mv, dirFis, 4);
+    mv->Registros[POS_SP] += 4;
 
     return valor;
 }
 
-void ejecutarCALL(uint32_t destino){
+void ejecutarCALL(MaquinaVirtual *mv, uint32_t destino){
     // Verificar si el destino está dentro del Code Segment
-    uint8_t pos_CS = Registros[POS_CS] >> 16;
-    if (destino >= tablaSegmentos[pos_CS].tamanio) {
-        detectaError(COD_ERR_SEGMENT, 0);
+    uint8_t pos_CS = mv->Registros[POS_CS] >> 16;
+    if (destino >= mv->tablaSegmentos[pos_CS].tamanio) {
+        detectaError(mv, COD_ERR_SEGMENT, 0);
         return;
     }
 
-    ejecutarPUSH(Registros[POS_IP]);
-    Registros[POS_IP] = (Registros[POS_IP] & 0xFFFF0000) | (destino & 0xFFFF);
+    ejecutarPUSH(mv, mv->Registros[POS_IP]);
+    mv->Registros[POS_IP] = (mv->Registros[POS_IP] & 0xFFFF0000) | (destino & 0xFFFF);
 }
 
-void ejecutarRET() {
+void ejecutarRET(MaquinaVirtual *mv) {
     int error=0;
-    uint32_t dirRET = ejecutarPOP(&error);
+    uint32_t dirRET = ejecutarPOP(mv, &error);
     if (error == 1) {
         return;
     }
 
-    Registros[POS_IP] = dirRET;
+    mv->Registros[POS_IP] = dirRET;
 }
 
 //------------------INICIALIZO LA PILA PARA LA SUBRUTINA-----------
-void inicializarPilaMain(int cantParam, uint32_t dirParam){
+void inicializarPilaMain(MaquinaVirtual *mv, int cantParam, uint32_t dirParam){
     //Verifico existencia de Stack Segment
-    if(Registros[POS_SS] == 0xFFFFFFFF){
+    if(mv->Registros[POS_SS] == 0xFFFFFFFF){
         return;
     }
 
     // Puntero a array de argumentos
     if(cantParam >0 && dirParam!=0){
         //Calcular posicion del array de punteros (al final del param segment)
-        ejecutarPUSH(dirParam);
+        ejecutarPUSH(mv, dirParam);
     }else{
-        ejecutarPUSH(0xFFFFFFFF); //no hay parametros
+        ejecutarPUSH(mv, 0xFFFFFFFF); //no hay parametros
     }
 
     // Cantidad de argumentos (argc)
-    ejecutarPUSH(cantParam);
+    ejecutarPUSH(mv, cantParam);
 
     // Direccion de retorno
-    ejecutarPUSH(0xFFFFFFFF);
+    ejecutarPUSH(mv, 0xFFFFFFFF);
 }
 
 //LLAMADA A SYS
-void writeSYS() {
-    uint32_t EDX = Registros[POS_EDX];
-    uint16_t tamanio = (Registros[POS_ECX] >> 16) & 0xFF; // Tamaño de cada elemento
-    uint16_t cantidad = Registros[POS_ECX] & 0xFF;       // Cantidad de elementos
-    uint32_t EAX = Registros[POS_EAX];       // Modo de salida
+void writeSYS(MaquinaVirtual *mv) {
+    uint32_t EDX = mv->Registros[POS_EDX];
+    uint16_t tamanio = (mv->Registros[POS_ECX] >> 16) & 0xFF; // Tamaño de cada elemento
+    uint16_t cantidad = mv->Registros[POS_ECX] & 0xFF;       // Cantidad de elementos
+    uint32_t EAX = mv->Registros[POS_EAX];       // Modo de salida
 
-    uint32_t dirFisica = calculaDireccionFisica(EDX);
+    uint32_t dirFisica = calculaDireccionFisica(mv, EDX);
 
     // Verificación de parámetros
     if ( tamanio!= 1 && tamanio!= 2 && tamanio!= 4) {
-        detectaError(COD_ERR_WRITE, tamanio);
+        detectaError(mv, COD_ERR_WRITE, tamanio);
         return;
     }
 
-    if (dirFisica + (tamanio*cantidad) > TAMANIO_MEMORIA) {
-        detectaError(COD_ERR_FIS, dirFisica + (tamanio * cantidad));
+    if (dirFisica + (tamanio*cantidad) > mv->TAMANIO_MEMORIA) {
+        detectaError(mv, COD_ERR_FIS, dirFisica + (tamanio * cantidad));
         return;
     }
 
     for (int i = 0; i < cantidad; i++) {
         uint32_t dirActual = dirFisica + (i * tamanio);
-        printf("[%04X]:", dirActual);
+        fprintf(mv->salida, "[%04X]:", dirActual);
 
-        uint32_t valor = leerMemoria(dirActual, tamanio);
+        uint32_t valor = leerMemoria(mv, dirActual, tamanio);
 
         // Mostrar hexadecimal
         if (EAX & 0x08) {
-            printf(" 0x%X", valor);
+            fprintf(mv->salida, " 0x%X", valor);
         }
 
         // Mostrar octal
         if (EAX & 0x04) {
-            printf(" 0o%o", valor);
+            fprintf(mv->salida, " 0o%o", valor);
         }
 
         // Mostrar caracteres
         if (EAX & 0x02) {
-            printf(" ");
+            fprintf(mv->salida, " ");
             // Leer y mostrar los bytes en orden de memoria
             for (int j = 0; j < tamanio; j++) {
-                uint8_t c = MemoriaPrincipal[dirActual+j];
+                uint8_t c = mv->MemoriaPrincipal[dirActual+j];
                 if (c >= 32 && c <= 126) {
-                    printf("%c", c);
+                    fprintf(mv->salida, "%c", c);
                 } else {
-                    printf(".");
+                    fprintf(mv->salida, ".");
                 }
             }
         }
 
         // Mostrar decimal
         if (EAX & 0x01) {
-            printf(" ");
+            fprintf(mv->salida, " ");
             switch (tamanio) {
-                case 1: printf("%d", (int8_t)valor); break;
-                case 2: printf("%d", (int16_t)valor); break;
-                case 4: printf("%d", (int32_t)valor); break;
+                case 1: fprintf(mv->salida, "%d", (int8_t)valor); break;
+                case 2: fprintf(mv->salida, "%d", (int16_t)valor); break;
+                case 4: fprintf(mv->salida, "%d", (int32_t)valor); break;
             }
         }
-        printf("\n");
+        fprintf(mv->salida, "\n");
     }
 }
 
-void readSYS() {
-    uint32_t EDX = Registros[POS_EDX], dirFisica;
+void readSYS(MaquinaVirtual *mv) {
+    uint32_t EDX = mv->Registros[POS_EDX], dirFisica;
     int32_t valor;
-    uint16_t tamanio = Registros[POS_ECX] >> 16 & 0xFF; // Tamaño de cada elemento
-    uint16_t cantidad = Registros[POS_ECX] & 0xFF;        // Cantidad de elementos
-    uint32_t EAX = Registros[POS_EAX];        // Tipo de entrada
+    uint16_t tamanio = mv->Registros[POS_ECX] >> 16 & 0xFF; // Tamaño de cada elemento
+    uint16_t cantidad = mv->Registros[POS_ECX] & 0xFF;        // Cantidad de elementos
+    uint32_t EAX = mv->Registros[POS_EAX];        // Tipo de entrada
     char binario[MAX];
 
-    dirFisica = calculaDireccionFisica(EDX);
-    if (dirFisica + (tamanio * cantidad) > TAMANIO_MEMORIA) {
-        detectaError(COD_ERR_READ, EAX);
+    dirFisica = calculaDireccionFisica(mv, EDX);
+    if (dirFisica + (tamanio * cantidad) > mv->TAMANIO_MEMORIA) {
+        detectaError(mv, COD_ERR_READ, EAX);
         return;
     }
 
@@ -1328,12 +1554,12 @@ void readSYS() {
         int intentoValido = 0,intento=0;
         uint32_t direccionMemoria = dirFisica + (i * tamanio);
         while(intento<3 && !intentoValido){
-            printf("[%04X]: ", direccionMemoria);
-            fflush(stdout); // Asegura que se muestre el prompt
+            fprintf(mv->salida, "[%04X]: ", direccionMemoria);
+            fflush(mv->salida); // Asegura que se muestre el prompt
 
             switch (EAX) {
                 case 0x10: { // BINARIO
-                    if (scanf("%s", binario) == 1) {
+                    if (fscanf(mv->entrada, "%s", binario) == 1) {
                         valor = 0;
                         int j = 0;
                         while (binario[j] == '0' || binario[j] == '1') {
@@ -1345,55 +1571,61 @@ void readSYS() {
                     break;
                 }
                 case 0x01: { // DECIMAL
-                    if (scanf("%d", &valor) == 1) {
+                    if (fscanf(mv->entrada, "%d", &valor) == 1) {
                         valor = (uint32_t)valor;
                         intentoValido=1;
                     }
                     break;
                 }
                 case 0x02: { // CARÁCTER
-                        valor = getchar();
-                        if (valor != '\n') intentoValido=1;
+                        valor = getc(mv->entrada);
+                        if (valor != '\n' && valor != EOF) intentoValido=1;
                     break;
                 }
                 case 0x04: { // OCTAL
-                        if (scanf("%o", &valor) == 1) intentoValido=1;;
+                        if (fscanf(mv->entrada, "%o", &valor) == 1) intentoValido=1;;
                     break;
                 }
                 case 0x08: { // HEX
-                        if (scanf("%X", &valor) == 1) intentoValido=1;
+                        if (fscanf(mv->entrada, "%X", &valor) == 1) intentoValido=1;
                     break;
                 }
                 default:
-                    detectaError(COD_ERR_READ, EAX);
+                    detectaError(mv, COD_ERR_READ, EAX);
                     return;
             }
-            while (getchar() != '\n'); // limpiar buffer de entrada
+            if (!intentoValido && (feof(mv->entrada) || ferror(mv->entrada))) {
+                // Se termino la entrada: reintentar no va a leer nada
+                detectaError(mv, COD_ERR_READ, EAX);
+                return;
+            }
+            int c;
+            while ((c = getc(mv->entrada)) != '\n' && c != EOF); // limpiar buffer de entrada
 
             if (!intentoValido && intento < 2) {
-                printf("Entrada inválida. Reintente.\n");
+                fprintf(mv->salida, "Entrada inválida. Reintente.\n");
             }
             intento++;
         }
         if (!intentoValido) {
-            detectaError(COD_ERR_READ, EAX);
+            detectaError(mv, COD_ERR_READ, EAX);
             return;
         }
 
-        escribirMemoria(direccionMemoria, valor, tamanio);
+        escribirMemoria(mv, direccionMemoria, valor, tamanio);
     }
 }
 
-void writeSTR(){
-    uint32_t EDX = Registros[POS_EDX];
-    uint32_t dirFisica = calculaDireccionFisica(EDX);
+void writeSTR(MaquinaVirtual *mv){
+    uint32_t EDX = mv->Registros[POS_EDX];
+    uint32_t dirFisica = calculaDireccionFisica(mv, EDX);
 
-    printf("%s",(char*)MemoriaPrincipal+dirFisica);
+    fprintf(mv->salida, "%s",(char*)mv->MemoriaPrincipal+dirFisica);
 }
 
-void readSTR() {
-    uint32_t EDX = Registros[POS_EDX];
-    uint16_t CX = Registros[POS_ECX] & 0xFFFF;
+void readSTR(MaquinaVirtual *mv) {
+    uint32_t EDX = mv->Registros[POS_EDX];
+    uint16_t CX = mv->Registros[POS_ECX] & 0xFFFF;
 
     // Limitar CX a 255 para evitar desbordamiento
     if (CX > 255) {
@@ -1402,46 +1634,57 @@ void readSTR() {
 
     char cadena[256];
 
-    if (fgets(cadena, CX + 1, stdin) == NULL) {
+    if (fgets(cadena, CX + 1, mv->entrada) == NULL) {
         cadena[0] = '\0'; // Si hay error de lectura, usamos cadena vacía
     }
 
     cadena[strcspn(cadena, "\n")] = '\0';
 
-    uint32_t dirFisica = calculaDireccionFisica(EDX);
+    uint32_t dirFisica = calculaDireccionFisica(mv, EDX);
 
     size_t len = strlen(cadena);
 
     // Verificar que hay espacio en MemoriaPrincipal para escribir cadena + '\0'
-    if (dirFisica + len >= TAMANIO_MEMORIA) {
-        detectaError(COD_ERR_FIS, dirFisica + len);
+    if (dirFisica + len >= mv->TAMANIO_MEMORIA) {
+        detectaError(mv, COD_ERR_FIS, dirFisica + len);
         return;
     }
 
     // Copiar a memoria
-    memcpy((char*)MemoriaPrincipal + dirFisica, cadena, len + 1); // Incluye '\0'
+    verificaCompartidos(mv, dirFisica, len + 1);
+    memcpy((char*)mv->MemoriaPrincipal + dirFisica, cadena, len + 1); // Incluye '\0'
+    marcaPaginaSucia(mv, dirFisica, len + 1);
+    if (dirFisica < mv->cacheFinCS && dirFisica + len + 1 > mv->cacheBaseCS) {
+        invalidaCacheDecodificada(mv, dirFisica, len + 1);
+    }
 }
 
-void mostrarMenu(char *op){
-    printf("\n\tBREAKPOINT\t\n");
-    printf("\t g: Continuar ejecucion\n");
-    printf("\t q: Salir y mantener el breakpoint\n");
-    printf("\t Enter: Ejecutar paso a paso\n");
-    *op=getchar();
+void mostrarMenu(MaquinaVirtual *mv, int *op){
+    fprintf(mv->salida, "\n\tBREAKPOINT\t\n");
+    fprintf(mv->salida, "\t g: Continuar ejecucion\n");
+    fprintf(mv->salida, "\t q: Salir y mantener el breakpoint\n");
+    fprintf(mv->salida, "\t Enter: Ejecutar paso a paso\n");
+    *op=getc(mv->entrada);
     int c;
-    while ((c = getchar()) != '\n' && c != EOF);
+    while ((c = getc(mv->entrada)) != '\n' && c != EOF);
 
 }
 
-void breakPoint(){
-    char op;
+void breakPoint(MaquinaVirtual *mv){
+    int op;
     int muestra=1,salir=0;
-    while(continuarEjecucion != 0 && salir!=1){
+    while(mv->continuarEjecucion != 0 && salir!=1){
         if(muestra==1)
-            mostrarMenu(&op);
+            mostrarMenu(mv, &op);
         else{
-            op=getchar();
-            while (getchar() != '\n');
+            op=getc(mv->entrada);
+            int c;
+            while ((c = getc(mv->entrada)) != '\n' && c != EOF);
+        }
+        if (op == EOF) {
+            // Sin entrada no hay opcion que leer
+            detectaError(mv, COD_ERR_READ, 0);
+            break;
         }
 
         switch(op){
@@ -1450,17 +1693,17 @@ void breakPoint(){
                 break;
             }
             case 'q':{
-                continuarEjecucion=0;
+                mv->continuarEjecucion=0;
                 break;
             }
             case '\n':{
-                disassemblerPasoAPaso();
-                ejecutarInstruccion();
+                disassemblerPasoAPaso(mv);
+                ejecutarInstruccion(mv);
                 muestra=0;
                 break;
             }
             default:{
-                printf("opcion invalida\n");
+                fprintf(mv->salida, "opcion invalida\n");
                 muestra=1;
                 break;
             }
@@ -1468,40 +1711,79 @@ void breakPoint(){
     }
 }
 
-void ejecutarSYS(uint32_t operandoA){
+// IP vuelve a la instruccion SYS (OP1 tiene su operando)
+static void vuelveASYS(MaquinaVirtual *mv){
+    mv->Registros[POS_IP] -= 1 + operandoSize(mv->Registros[POS_OP1] >> 24);
+}
+
+// Con cuota una lectura sin datos no bloquea al hilo del planificador: IP
+// vuelve a la instruccion SYS y la maquina cede
+static int cedeSinEntrada(MaquinaVirtual *mv){
+    if (mv->cuota == SIN_CUOTA || entradaDisponible(mv->entrada)) {
+        return 0;
+    }
+    vuelveASYS(mv);
+    cedeMaquina(mv, PAUSA_ENTRADA);
+    return 1;
+}
+
+// Una plantilla se detiene en su punto de copia (ver COPIAS DE UNA PLANTILLA en mv.h).
+// En una lectura IP vuelve al SYS para que cada copia lea de su entrada
+static int cedeEnPuntoCopia(MaquinaVirtual *mv, uint8_t punto){
+    if (mv->puntoCopia != punto) {
+        return 0;
+    }
+    if (punto == PUNTO_LECTURA) {
+        vuelveASYS(mv);
+    }
+    cedeMaquina(mv, PAUSA_PUNTO);
+    return 1;
+}
+
+void ejecutarSYS(MaquinaVirtual *mv, uint32_t operandoA){
     switch(operandoA){
         case SYS_READ:{
-            readSYS(); // Leer de memoria
+            if (cedeEnPuntoCopia(mv, PUNTO_LECTURA) || cedeSinEntrada(mv)) {
+                break;
+            }
+            readSYS(mv); // Leer de memoria
             break;
         }
         case SYS_WRITE:{
-            writeSYS(); // Escribir en memoria
+            writeSYS(mv); // Escribir en memoria
             break;
         }
         case SYS_STR_READ:{ //Lectura de string
-            readSTR();
-            printf("\n");
+            if (cedeEnPuntoCopia(mv, PUNTO_LECTURA) || cedeSinEntrada(mv)) {
+                break;
+            }
+            readSTR(mv);
+            fprintf(mv->salida, "\n");
             break;
         }
         case SYS_STR_WRITE:{ //Escritura de string
-            writeSTR();
+            writeSTR(mv);
             break;
         }
         case SYS_CLEAR:{
-            system("cls||clear"); //cls es para windows
+            if (mv->salida == stdout) //en un lote la salida es un archivo
+                system("cls||clear"); //cls es para windows
             break;
         }
         case SYS_BREAKPOINT:{
-            if (archivo_vmi != NULL){
-                guardarImagenVMI(archivo_vmi);
-                breakPoint();
+            if (cedeEnPuntoCopia(mv, PUNTO_BREAKPOINT)) {
+                break;
+            }
+            if (mv->archivo_vmi != NULL){
+                guardarImagenBreakpoint(mv);
+                breakPoint(mv);
             }
             else
-                printf("Breakpoint alcanzado, pero no se especificó archivo .vmi\n");
+                fprintf(mv->salida, "Breakpoint alcanzado, pero no se especificó archivo .vmi\n");
             break;
         }
         default:{
-            detectaError(COD_ERR_OPE,0x0);
+            detectaError(mv, COD_ERR_OPE,0x0);
             return;
         }
     }
@@ -1519,24 +1801,25 @@ uint32_t convertirBigEndian32(uint32_t val) {
 }
 
 //-------------------FUNCIONES DE EJECUCION-------------------------
-int ejecutarInstruccion(){
-    uint8_t posCS = Registros[POS_CS] >> 16;
-    uint32_t offsetIP = Registros[POS_IP] & 0xFFFF;
+int ejecutarInstruccion(MaquinaVirtual *mv){
+    materializaInternos(mv);
+    uint8_t posCS = mv->Registros[POS_CS] >> 16;
+    uint32_t offsetIP = mv->Registros[POS_IP] & 0xFFFF;
 
     // Verificar si IP está dentro del code segment
-    if (offsetIP >= tablaSegmentos[posCS].tamanio) {
-        continuarEjecucion = 0;
+    if (offsetIP >= mv->tablaSegmentos[posCS].tamanio) {
+        mv->continuarEjecucion = 0;
         return 0;
     }
 
-    uint32_t direccionFisica = calculaDireccionFisica(Registros[POS_IP]); // Calcular la direccion fisica
+    uint32_t direccionFisica = calculaDireccionFisica(mv, mv->Registros[POS_IP]); // Calcular la direccion fisica
 
-    if(direccionFisica > TAMANIO_MEMORIA){
-        detectaError(COD_ERR_FIS,direccionFisica);
+    if(direccionFisica > mv->TAMANIO_MEMORIA){
+        detectaError(mv, COD_ERR_FIS,direccionFisica);
         return 1;
     }
 
-    uint8_t codigo = leerMemoria(direccionFisica, 1);
+    uint8_t codigo = leerMemoria(mv, direccionFisica, 1);
     uint8_t codOp = codigo & 0x1F;
     uint8_t cantOperandos = (codigo >> 4) & 0x01;
     uint8_t tipoA = OP_NING, tipoB =OP_NING, tamA=0, tamB=0;
@@ -1544,102 +1827,106 @@ int ejecutarInstruccion(){
     uint32_t operandoA=0, operandoB=0;
     // Decodifico el codigo de operacion y tipo de operandos
 
-    Registros[POS_IP]++; // IP apunta a siguiente instruccion
-    Registros[POS_OPC] = codOp;
+    mv->Registros[POS_IP]++; // IP apunta a siguiente instruccion
+    mv->Registros[POS_OPC] = codOp;
 
     if((codOp!= OP_STOP) && (codOp!=OP_RET)){
         if(cantOperandos == 0x01){
             tipoB = (codigo >> 6) & 0x03;
             tipoA = (codigo >> 4) & 0x03;
-            operandoB = obtenerOperando(tipoB, &Registros[POS_IP], &tamB, 2);
-            operandoA = obtenerOperando(tipoA, &Registros[POS_IP], &tamA, 1);
+            operandoB = obtenerOperando(mv, tipoB, &mv->Registros[POS_IP], &tamB, 2);
+            operandoA = obtenerOperando(mv, tipoA, &mv->Registros[POS_IP], &tamA, 1);
         }else{
             tipoA = (codigo >> 6) & 0x03;
-            operandoA = obtenerOperando(tipoA, &Registros[POS_IP], &tamA, 1);
-            Registros[POS_OP2] = 0; // No hay operando B
+            operandoA = obtenerOperando(mv, tipoA, &mv->Registros[POS_IP], &tamA, 1);
+            mv->Registros[POS_OP2] = 0; // No hay operando B
         
         }
     }else { //ningun operando, quedan en 0 OP1 y OP2
-        Registros[POS_OP1] = 0; 
-        Registros[POS_OP2] = 0; 
+        mv->Registros[POS_OP1] = 0; 
+        mv->Registros[POS_OP2] = 0; 
     }
 
-    // Ejecuta la instruccion
+    return ejecutarOperacion(mv, codOp, tipoA, operandoA, tipoB, operandoB, tamA, tamB);
+}
+
+int ejecutarOperacion(MaquinaVirtual *mv, uint8_t codOp, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB, uint8_t tamA, uint8_t tamB){
+    // Ejecuta la instruccion ya decodificada (comun a todos los motores)
     switch(codOp){
         case OP_MOV:
-            ejecutarMOV(tipoA, operandoA, tipoB, operandoB, tamA, tamB);
+            ejecutarMOV(mv, tipoA, operandoA, tipoB, operandoB, tamA, tamB);
             break;
         case OP_ADD:
-            ejecutarADD(tipoA, operandoA, tipoB, operandoB, tamA, tamB);
+            ejecutarADD(mv, tipoA, operandoA, tipoB, operandoB, tamA, tamB);
             break;
         case OP_SUB:
-            ejecutarSUB(tipoA, operandoA, tipoB, operandoB, tamA, tamB);
+            ejecutarSUB(mv, tipoA, operandoA, tipoB, operandoB, tamA, tamB);
             break;
         case OP_SWAP:
-            ejecutarSWAP(tipoA, operandoA, tipoB, operandoB, tamA, tamB);
+            ejecutarSWAP(mv, tipoA, operandoA, tipoB, operandoB, tamA, tamB);
             break;
         case OP_MUL:
-            ejecutarMUL(tipoA, operandoA, tipoB, operandoB, tamA, tamB);
+            ejecutarMUL(mv, tipoA, operandoA, tipoB, operandoB, tamA, tamB);
             break;
         case OP_DIV:
-            ejecutarDIV(tipoA, operandoA, tipoB, operandoB, tamA, tamB);
+            ejecutarDIV(mv, tipoA, operandoA, tipoB, operandoB, tamA, tamB);
             break;
         case OP_CMP:
-            ejecutarCMP(tipoA, operandoA, tipoB, operandoB, tamA, tamB);
+            ejecutarCMP(mv, tipoA, operandoA, tipoB, operandoB, tamA, tamB);
             break;
         case OP_SHL:
-            ejecutarSHL(tipoA, operandoA, tipoB, operandoB, tamA, tamB);
+            ejecutarSHL(mv, tipoA, operandoA, tipoB, operandoB, tamA, tamB);
             break;
         case OP_SHR:
-            ejecutarSHR(tipoA, operandoA, tipoB, operandoB, tamA, tamB);
+            ejecutarSHR(mv, tipoA, operandoA, tipoB, operandoB, tamA, tamB);
             break;
         case OP_SAR: 
-            ejecutarSAR(tipoA, operandoA, tipoB, operandoB, tamA, tamB);  
+            ejecutarSAR(mv, tipoA, operandoA, tipoB, operandoB, tamA, tamB);  
             break;
         case OP_AND:
-            ejecutarAND(tipoA, operandoA, tipoB, operandoB, tamA, tamB);
+            ejecutarAND(mv, tipoA, operandoA, tipoB, operandoB, tamA, tamB);
             break;
         case OP_OR:
-            ejecutarOR(tipoA, operandoA, tipoB, operandoB, tamA, tamB);
+            ejecutarOR(mv, tipoA, operandoA, tipoB, operandoB, tamA, tamB);
             break;
         case OP_XOR:
-            ejecutarXOR(tipoA, operandoA, tipoB, operandoB, tamA, tamB);
+            ejecutarXOR(mv, tipoA, operandoA, tipoB, operandoB, tamA, tamB);
             break;
         case OP_LDL:
-            ejecutarLDL(tipoA, operandoA,tipoB, operandoB, tamA, tamB);
+            ejecutarLDL(mv, tipoA, operandoA,tipoB, operandoB, tamA, tamB);
             break;
         case OP_LDH:
-            ejecutarLDH(tipoA, operandoA, tipoB, operandoB, tamA, tamB);
+            ejecutarLDH(mv, tipoA, operandoA, tipoB, operandoB, tamA, tamB);
             break;
         case OP_RND:
-            ejecutarRND(tipoA, operandoA, tipoB, operandoB, tamA, tamB);
+            ejecutarRND(mv, tipoA, operandoA, tipoB, operandoB, tamA, tamB);
             break;
         case OP_SYS:
-            ejecutarSYS(operandoA);
+            ejecutarSYS(mv, operandoA);
             break;
         case OP_JMP:
-            ejecutarJMP(tipoA, operandoA, tamA);
+            ejecutarJMP(mv, tipoA, operandoA, tamA);
             break;
         case OP_JZ:
-            ejecutarJZ(tipoA, operandoA, tamA);
+            ejecutarJZ(mv, tipoA, operandoA, tamA);
             break;
         case OP_JP:
-            ejecutarJP(tipoA, operandoA, tamA);
+            ejecutarJP(mv, tipoA, operandoA, tamA);
             break;
         case OP_JN:
-            ejecutarJN(tipoA, operandoA, tamA);
+            ejecutarJN(mv, tipoA, operandoA, tamA);
             break;
         case OP_JNZ:
-            ejecutarJNZ(tipoA, operandoA, tamA);
+            ejecutarJNZ(mv, tipoA, operandoA, tamA);
             break;
         case OP_JNP:
-            ejecutarJNP(tipoA, operandoA, tamA);
+            ejecutarJNP(mv, tipoA, operandoA, tamA);
             break;
         case OP_JNN:
-            ejecutarJNN(tipoA, operandoA, tamA);
+            ejecutarJNN(mv, tipoA, operandoA, tamA);
             break;
         case OP_NOT:{
-            ejecutarNOT(tipoA, operandoA, tamA);
+            ejecutarNOT(mv, tipoA, operandoA, tamA);
             break;
         }
         case OP_PUSH:{
@@ -1648,49 +1935,104 @@ int ejecutarInstruccion(){
                 valor = operandoA;
             }
             else{
-                valor = obtenerValorOperando(tipoA, operandoA, tamA);
+                valor = obtenerValorOperando(mv, tipoA, operandoA, tamA);
             }
-            ejecutarPUSH(valor);
+            ejecutarPUSH(mv, valor);
             break;
         }
         case OP_POP:{
             int error=0;
-            uint32_t valor = ejecutarPOP(&error);
+            uint32_t valor = ejecutarPOP(mv, &error);
             if(error==0){
-                escribirValorOperando(tipoA, operandoA, valor, tamA);
+                escribirValorOperando(mv, tipoA, operandoA, valor, tamA);
             }
             break;
         }
         case OP_CALL:{
-            uint32_t dirRedireccion = obtenerValorOperando(tipoA, operandoA,tamA);
-            ejecutarCALL(dirRedireccion);
+            uint32_t dirRedireccion = obtenerValorOperando(mv, tipoA, operandoA,tamA);
+            ejecutarCALL(mv, dirRedireccion);
             break;
         }
         case OP_RET:{
-            ejecutarRET();
+            ejecutarRET(mv);
             break;
         }
         case OP_STOP:{
-            Registros[POS_IP] = -1;
-            continuarEjecucion = 0; // Detener la ejecucion
+            mv->Registros[POS_IP] = -1;
+            mv->continuarEjecucion = 0; // Detener la ejecucion
             break;
         }
         default:{
-            detectaError(COD_ERR_INS,codOp); // Error en la instruccion
+            detectaError(mv, COD_ERR_INS,codOp); // Error en la instruccion
             return 1;
         }
     }
     return 0;
 }
 
-int ejecutarPrograma () {
-    while(continuarEjecucion){
-        if(ejecutarInstruccion()!=0)
-            return 1;
+int ejecutarPrograma(MaquinaVirtual *mv) {
+    // Una maquina que cedio (EJECUCION POR CUOTAS) sigue con las caches que ya tenia
+    if (perfilActivo) {
+        // El perfil se toma sobre el motor predecodificado, instruccion por instruccion
+        if (mv->cacheDecodificada == NULL)
+            preparaCacheDecodificada(mv);
+        int resultado = ejecutarProgramaPerfilado(mv);
+        if (mv->pausa == PAUSA_NINGUNA)
+            muestraPerfilPares(mv, stderr);
+        return resultado;
+    }
+    switch(motorEjecucion){
+        case MOTOR_REFERENCIA:
+            while(mv->continuarEjecucion){
+                if(cuotaAgotada(mv, 1))
+                    break;
+                if(ejecutarInstruccion(mv)!=0)
+                    return 1;
+            }
+            break;
+        case MOTOR_PREDECODIFICADO:
+            if (mv->cacheDecodificada == NULL)
+                preparaCacheDecodificada(mv);
+            while(mv->continuarEjecucion){
+                if(cuotaAgotada(mv, 1))
+                    break;
+                if(ejecutarDecodificada(mv)!=0)
+                    return 1;
+            }
+            break;
+        case MOTOR_HILADO:
+            if (mv->cuota == SIN_CUOTA) {
+                if (mv->cacheDecodificada == NULL)
+                    preparaCacheDecodificada(mv);
+                return ejecutarProgramaHilado(mv);
+            }
+            // Con cuota se usan los mismos manejadores por bloques: el motor
+            // hilado no tiene un punto entre bloques donde ceder
+            // fallthrough
+        default: {
+            if (mv->cacheDecodificada == NULL)
+                preparaCacheDecodificada(mv);
+            if (mv->mapaBloques == NULL)
+                preparaBloques(mv);
+            int resultado = ejecutarProgramaBloques(mv);
+            if (informeNiveles && mv->pausa == PAUSA_NINGUNA) {
+                muestraNivelesBloques(mv, stderr);
+            }
+            return resultado;
+        }
     }
     return 0;
 }
 
+int ejecutarCuota(MaquinaVirtual *mv, uint32_t cuota){
+    if (mv->pausa != PAUSA_NINGUNA) {
+        mv->pausa = PAUSA_NINGUNA;
+        mv->continuarEjecucion = 1;
+    }
+    mv->cuota = cuota;
+    return ejecutarPrograma(mv);
+}
+
 //---------------FUNCIONES PARA DISASSEMBLER---------------
 // Funcion auxiliar para determinar tamanio del operando
 int operandoSize(uint8_t tipo) {
@@ -1702,80 +2044,80 @@ int operandoSize(uint8_t tipo) {
     }
 }
 
-void decodificarOperando(uint32_t punt, int operandoSize,uint8_t codOp) {
+void decodificarOperando(MaquinaVirtual *mv, uint32_t punt, int operandoSize,uint8_t codOp) {
 uint8_t sector, numReg, codReg;
 uint32_t valor;
 int32_t offset;
 
 switch (operandoSize) {
     case 1: { //Registro
-        numReg = MemoriaPrincipal[punt] & 0x1F;
-        sector = (MemoriaPrincipal[punt] >> 6) & 0x03;
+        numReg = mv->MemoriaPrincipal[punt] & 0x1F;
+        sector = (mv->MemoriaPrincipal[punt] >> 6) & 0x03;
         switch (sector) {
-            case 0x00: printf("%-s", NOMBRES_REGISTROS[numReg]);break;
-            case 0x01: printf("%cL", NOMBRES_REGISTROS[numReg][1]);break; // Byte bajo (AL)
-            case 0x02: printf("%cH", NOMBRES_REGISTROS[numReg][1]);break; // Byte alto (AH)
-            case 0x03: printf("%cX", NOMBRES_REGISTROS[numReg][1]);break; // 16 bits (AX)
+            case 0x00: fprintf(mv->salida, "%-s", NOMBRES_REGISTROS[numReg]);break;
+            case 0x01: fprintf(mv->salida, "%cL", NOMBRES_REGISTROS[numReg][1]);break; // Byte bajo (AL)
+            case 0x02: fprintf(mv->salida, "%cH", NOMBRES_REGISTROS[numReg][1]);break; // Byte alto (AH)
+            case 0x03: fprintf(mv->salida, "%cX", NOMBRES_REGISTROS[numReg][1]);break; // 16 bits (AX)
         }
         break;
     }
     case 2: { //Inmediato
-        valor = (MemoriaPrincipal[punt] << 8) | MemoriaPrincipal[punt+1];
+        valor = cargaBE16(&mv->MemoriaPrincipal[punt]);
         if (valor & 0x8000) {
                 valor |= 0xFFFF0000;
         }
         if(codOp==OP_JMP || codOp==OP_JN || codOp==OP_JNN || codOp==OP_JNP || codOp==OP_JNZ || codOp==OP_JP || codOp==OP_JZ){
-            printf("%04X", valor);
+            fprintf(mv->salida, "%04X", valor);
         }else{
-            printf("%-4d", (int32_t)valor);
+            fprintf(mv->salida, "%-4d", (int32_t)valor);
         }
         break;
     }
     case 3: { //Memoria
-        offset = (MemoriaPrincipal[punt+1] << 8) | MemoriaPrincipal[punt + 2];
+        offset = cargaBE16(&mv->MemoriaPrincipal[punt + 1]);
         // Extender el signo para el offset
         if (offset & 0x8000) {
             offset |= 0xFFFF0000;
         }
-        codReg = MemoriaPrincipal[punt]& 0x1F;
+        codReg = mv->MemoriaPrincipal[punt]& 0x1F;
 
-        if(versionPrograma==2){
-            uint8_t modMem = (MemoriaPrincipal[punt] >>6) & 0x03;
+        if(mv->versionPrograma==2){
+            uint8_t modMem = (mv->MemoriaPrincipal[punt] >>6) & 0x03;
             switch(modMem){
-                case MOD_BYTE: printf("b"); break;
-                case MOD_WORD: printf("w"); break;
-                case MOD_LONG: printf("l"); break;
+                case MOD_BYTE: fprintf(mv->salida, "b"); break;
+                case MOD_WORD: fprintf(mv->salida, "w"); break;
+                case MOD_LONG: fprintf(mv->salida, "l"); break;
             }
         }
 
-        printf("[");
+        fprintf(mv->salida, "[");
         if (codReg < NUM_REGISTROS && NOMBRES_REGISTROS[codReg][0] != '\0') {
-            printf("%s", NOMBRES_REGISTROS[codReg]);
+            fprintf(mv->salida, "%s", NOMBRES_REGISTROS[codReg]);
             if (offset != 0) {
-                printf("%+d", offset);
+                fprintf(mv->salida, "%+d", offset);
             }
         }else{
-            printf("%d", offset);
+            fprintf(mv->salida, "%d", offset);
         }
-        printf("]");
+        fprintf(mv->salida, "]");
         break;
     }
-    default: printf("?? ");break;
+    default: fprintf(mv->salida, "?? ");break;
 }
 }
 
-void disassemblerInstruccion(uint32_t *ip) {
+void disassemblerInstruccion(MaquinaVirtual *mv, uint32_t *ip) {
     uint32_t ip0=(*ip)+1, offsetA, offsetB;
-    uint8_t codigo = MemoriaPrincipal[*ip];
+    uint8_t codigo = mv->MemoriaPrincipal[*ip];
     uint8_t codOp = codigo & 0x1F;
     uint8_t tipoA = 0, tipoB = 0;
     char bytesStr[32] = ""; //Buffer para los bytes de la instruccion
     int bytesLen = 0;
 
-    if(versionPrograma==1) {// Imprimir direccion
-        printf("[%04X] ", *ip);
-    } else if(versionPrograma==2){
-        printf("[%04X] ", *ip - tablaSegmentos[Registros[POS_CS] >> 16].base);
+    if(mv->versionPrograma==1) {// Imprimir direccion
+        fprintf(mv->salida, "[%04X] ", *ip);
+    } else if(mv->versionPrograma==2){
+        fprintf(mv->salida, "[%04X] ", *ip - mv->tablaSegmentos[mv->Registros[POS_CS] >> 16].base);
     }
 
     //Bytes de la instruccion
@@ -1783,17 +2125,17 @@ void disassemblerInstruccion(uint32_t *ip) {
 
     // Determinar formato de instruccion
     if(codOp == OP_STOP || codOp == OP_RET){ // Instruccion sin operandos
-        printf("%-24s | %-6s", bytesStr, MNEMONICOS[codOp]);
+        fprintf(mv->salida, "%-24s | %-6s", bytesStr, MNEMONICOS[codOp]);
         (*ip)++;
     }
     else if (codOp <= OP_CALL) {// Instruccion con 1 operando (modificar para version 2)
         tipoA = (codigo >> 6) & 0x03;
         // Imprimir bytes
         for (int i = 0; i < operandoSize(tipoA); i++) {
-            bytesLen += sprintf(bytesStr + bytesLen, " %02X", MemoriaPrincipal[(*ip)+1+i]);
+            bytesLen += sprintf(bytesStr + bytesLen, " %02X", mv->MemoriaPrincipal[(*ip)+1+i]);
         }
-        printf("%-24s | %-6s ", bytesStr, MNEMONICOS[codOp]); // Imprimir operando A
-        decodificarOperando(ip0, operandoSize(tipoA),codOp);
+        fprintf(mv->salida, "%-24s | %-6s ", bytesStr, MNEMONICOS[codOp]); // Imprimir operando A
+        decodificarOperando(mv, ip0, operandoSize(tipoA),codOp);
         (*ip) = operandoSize(tipoA)+ip0;
     }
     else {// Instruccion con 2 operandos
@@ -1802,37 +2144,37 @@ void disassemblerInstruccion(uint32_t *ip) {
 
         //Agregar bytes de la instruccion B
         for (int i = 0; i < operandoSize(tipoB); i++) {
-            bytesLen += sprintf(bytesStr + bytesLen," %02X", MemoriaPrincipal[(*ip) +1+i]);
+            bytesLen += sprintf(bytesStr + bytesLen," %02X", mv->MemoriaPrincipal[(*ip) +1+i]);
         }
         //Agregar bytes de la instruccion A
         for (int i = 0; i < operandoSize(tipoA); i++) {
-            bytesLen += sprintf(bytesStr + bytesLen," %02X", MemoriaPrincipal[(*ip) + operandoSize(tipoB) +1+i]);
+            bytesLen += sprintf(bytesStr + bytesLen," %02X", mv->MemoriaPrincipal[(*ip) + operandoSize(tipoB) +1+i]);
         }
-        printf("%-24s | %-6s", bytesStr, MNEMONICOS[codOp]);
+        fprintf(mv->salida, "%-24s | %-6s", bytesStr, MNEMONICOS[codOp]);
 
         // Imprimir operandos
         offsetB = ip0;
         offsetA = ip0 + operandoSize(tipoB);
-        decodificarOperando(offsetA, operandoSize(tipoA), codOp);
-        printf(", ");
-        decodificarOperando(offsetB, operandoSize(tipoB), codOp);
+        decodificarOperando(mv, offsetA, operandoSize(tipoA), codOp);
+        fprintf(mv->salida, ", ");
+        decodificarOperando(mv, offsetB, operandoSize(tipoB), codOp);
         (*ip) = offsetA + operandoSize(tipoA);
     }
-    printf("\n");
+    fprintf(mv->salida, "\n");
 }
 
-void disassembleKS() {
-    if (Registros[POS_KS] == 0xFFFFFFFF) return;
+void disassembleKS(MaquinaVirtual *mv) {
+    if (mv->Registros[POS_KS] == 0xFFFFFFFF) return;
 
-    uint8_t posKS = Registros[POS_KS]>>16;
-    uint32_t base = tablaSegmentos[posKS].base;
-    uint32_t tam = tablaSegmentos[posKS].tamanio;
+    uint8_t posKS = mv->Registros[POS_KS]>>16;
+    uint32_t base = mv->tablaSegmentos[posKS].base;
+    uint32_t tam = mv->tablaSegmentos[posKS].tamanio;
 
-    printf("Constant Segment (KS):\n");
+    fprintf(mv->salida, "Constant Segment (KS):\n");
 
     for (uint32_t i = 0; i < tam;) {
         uint32_t dir = base + i;
-        char *str = (char*)&MemoriaPrincipal[dir];
+        char *str = (char*)&mv->MemoriaPrincipal[dir];
 
         // Asegurar que haya un '\0' dentro del segmento
         int len = strnlen(str, tam - i);
@@ -1840,89 +2182,89 @@ void disassembleKS() {
         len++; // incluir el '\0'
 
         // Mostrar dirección física (4 dígitos hex)
-        printf("[%04X] ", dir);
+        fprintf(mv->salida, "[%04X] ", dir);
 
         // Mostrar hasta 6 bytes hex + ".." si hay más
         for (int j = 0; j < len && j < 6; j++) {
-            printf("%02X ", (uint8_t)str[j]);
+            fprintf(mv->salida, "%02X ", (uint8_t)str[j]);
         }
-        if (len > 6) printf("..");
+        if (len > 6) fprintf(mv->salida, "..");
 
         // Relleno si < 6 bytes (para alinear el '|')
         if (len <= 6) {
             for (int j = len; j < 6; j++) {
-                printf("   ");
+                fprintf(mv->salida, "   ");
             }
         }
 
         // Mostrar cadena entre comillas con . si no imprimible
-        printf(" | \"");
+        fprintf(mv->salida, " | \"");
         for (int j = 0; j < len - 1; j++) {
             char c = str[j];
-            printf("%c", (c >= 32 && c <= 126) ? c : '.');
+            fprintf(mv->salida, "%c", (c >= 32 && c <= 126) ? c : '.');
         }
-        printf("\"\n");
+        fprintf(mv->salida, "\"\n");
 
         i += len;
     }
 }
 
-void disassembleProgramaMV1() {
+void disassembleProgramaMV1(MaquinaVirtual *mv) {
     uint32_t ip = 0;
-    uint32_t tamCod = tablaSegmentos[SEG_CS].tamanio;
+    uint32_t tamCod = mv->tablaSegmentos[SEG_CS].tamanio;
 
-    printf("Maquina Virtual MV1 - Desensamblado\n");
-    printf("Tamanio del codigo: %d bytes\n\n", tamCod);
+    fprintf(mv->salida, "Maquina Virtual MV1 - Desensamblado\n");
+    fprintf(mv->salida, "Tamanio del codigo: %d bytes\n\n", tamCod);
 
     while (ip < tamCod) {
-        disassemblerInstruccion(&ip);
+        disassemblerInstruccion(mv, &ip);
     }
 }
 
-void disassembleProgramaMV2() {
-    uint8_t posCode = Registros[POS_CS]>>16;
-    uint32_t tamCode = tablaSegmentos[posCode].tamanio;
-    uint32_t baseCode = tablaSegmentos[posCode].base;
+void disassembleProgramaMV2(MaquinaVirtual *mv) {
+    uint8_t posCode = mv->Registros[POS_CS]>>16;
+    uint32_t tamCode = mv->tablaSegmentos[posCode].tamanio;
+    uint32_t baseCode = mv->tablaSegmentos[posCode].base;
 
-    uint8_t posKS = Registros[POS_KS]>>16;
-    uint32_t tam = tablaSegmentos[posKS].tamanio;
+    uint8_t posKS = mv->Registros[POS_KS]>>16;
+    uint32_t tam = mv->tablaSegmentos[posKS].tamanio;
 
     // Mostrar información del header
-    printf("Maquina Virtual MV2 - Desensamblado\n");
-    printf("Code Segment: %d bytes\n", tamCode);
-    printf("Const Segment: %d bytes\n\n", tam);
+    fprintf(mv->salida, "Maquina Virtual MV2 - Desensamblado\n");
+    fprintf(mv->salida, "Code Segment: %d bytes\n", tamCode);
+    fprintf(mv->salida, "Const Segment: %d bytes\n\n", tam);
 
     // Desensamblar strings constantes (Const Segment)
-    disassembleKS();
+    disassembleKS(mv);
 
     // Desensamblar código (Code Segment)
-    printf("\n Code Segment\n");
+    fprintf(mv->salida, "\n Code Segment\n");
     uint32_t ip = baseCode;
 
     while (ip < baseCode + tamCode) {
         uint32_t offsetCS = ip - baseCode;
-        printf("%c", offsetCS == entryPoint ? '>' : ' ');
-        disassemblerInstruccion(&ip);
+        fprintf(mv->salida, "%c", offsetCS == mv->entryPoint ? '>' : ' ');
+        disassemblerInstruccion(mv, &ip);
     }
 }
 
-void disassemblerPasoAPaso() {
-    uint32_t ip = Registros[POS_IP] & 0xFFFF,baseCS = tablaSegmentos[Registros[POS_CS] >> 16].base,ipFis;
+void disassemblerPasoAPaso(MaquinaVirtual *mv) {
+    uint32_t ip = mv->Registros[POS_IP] & 0xFFFF,baseCS = mv->tablaSegmentos[mv->Registros[POS_CS] >> 16].base,ipFis;
     ipFis=ip+baseCS;
-    entryPoint=ipFis;
-    disassemblerInstruccion(&ipFis);
+    mv->entryPoint=ipFis;
+    disassemblerInstruccion(mv, &ipFis);
 }
 
-void muestraDesensamblador(uint8_t version){
+void muestraDesensamblador(MaquinaVirtual *mv, uint8_t version){
     switch(version){
         case 1:
-            disassembleProgramaMV1();
+            disassembleProgramaMV1(mv);
             break;
         case 2:
-            disassembleProgramaMV2();
+            disassembleProgramaMV2(mv);
             break;
         default:
-            printf("Error: Version de desensamblador no soportada\n");
+            fprintf(mv->salida, "Error: Version de desensamblador no soportada\n");
             break;
     }
 }
\ No newline at end of file
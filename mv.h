@@ -2,6 +2,7 @@
 #define MV_H_INCLUDED
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 //------------------CONSTANTES Y ESTRUCTURAS----------
 // Cantidad de registros
@@ -145,116 +146,663 @@ typedef struct{ //Header para archivos .vmi
     uint16_t tamanio_mem;   //Tamanio en KiB
 } VMIHeader;
 
-//-------------DECLARO VARIABLES GLOBALES QUE ESTAN EN OTRO ARCHIVO---------------
-//-------------EXTERN---------------
-// Memoria principal
-extern uint8_t *MemoriaPrincipal;
-extern uint32_t TAMANIO_MEMORIA;
-extern uint32_t entryPoint; // Entry point del programa
-// Tabla de Registros
-extern uint32_t Registros[NUM_REGISTROS];
-extern DescriptoresSegmentos tablaSegmentos[NUM_SEG];
-extern char *archivo_vmi;
+//-------------TRADUCCION DE DIRECCIONES---------------
+//Cada segmento guarda su traduccion ya calculada: un acceso de hasta 4 bytes en
+//direccionLogica es valido si (direccionLogica - inicio) < limite. El limite ya
+//descuenta el tamanio del segmento y el final de la memoria, y una direccion de
+//un segmento inexistente (>= NUM_SEG) nunca queda por debajo de ningun limite.
+//Lo que no pasa esa comparacion va por el camino verificado, que informa el error
+typedef struct{
+    uint32_t inicio;    //numero de segmento << 16
+    uint32_t limite;    //offsets para los que el acceso no necesita verificacion
+    uint32_t base;      //direccion fisica del segmento
+} TraduccionSegmento;
+
+//-------------PAGINAS DE LAS IMAGENES INCREMENTALES---------------
+//La memoria se divide en paginas de 4 KiB (independientes de las del sistema)
+//para saber cuales cambiaron desde la ultima imagen guardada
+#define BITS_PAGINA_IMAGEN 12
+#define TAMANIO_PAGINA_IMAGEN (1u << BITS_PAGINA_IMAGEN)
+#define MAX_PAGINAS_IMAGEN ((1024u * 1024u) >> BITS_PAGINA_IMAGEN) //m=1024 como maximo
+
+//Hijos que pueden estar guardando imagenes a la vez (asincronico=N)
+#define MAX_IMAGENES_EN_CURSO 16
+
+//-------------ESTADO DE UNA MAQUINA VIRTUAL---------------
+//Todo lo que cambia al ejecutar un programa vive aca, asi varias maquinas
+//pueden convivir en el mismo proceso. Las opciones de la linea de comandos
+//(motor, umbrales, -jit, -rapido, -perfil) siguen siendo globales de solo lectura
+struct InstruccionDecodificada;
+struct Bloque;
+
+typedef struct MaquinaVirtual{
+    // Memoria principal
+    uint8_t *MemoriaPrincipal;
+    uint32_t TAMANIO_MEMORIA; //tamanio en bytes
+    uint32_t memoriaReservada; //bytes reservados en MemoriaPrincipal
+    void *mapeoImagen;         //si no es NULL, MemoriaPrincipal esta dentro del mapeo de una imagen .vmi o de una plantilla
+    size_t tamMapeoImagen;
+    // Paginas del KS y el CS compartidas de solo lectura con otras maquinas del
+    // proceso (-compartir): rango fisico [inicioCompartido, finCompartido), vacio si no hay
+    struct SegmentosCompartidos *compartidos;
+    uint32_t inicioCompartido, finCompartido;
+    uint32_t entryPoint; // Entry point del programa
+    // Tabla de Registros
+    uint32_t Registros[NUM_REGISTROS];
+    DescriptoresSegmentos tablaSegmentos[NUM_SEG];
+    TraduccionSegmento traduccion[NUM_SEG]; //se recalcula al cambiar la tabla o la memoria
+    uint8_t versionPrograma;
+    int continuarEjecucion; //para controlar el bucle
+    int codigoError;        //ultimo COD_ERR_* detectado, -1 si no hubo
+    char *archivo_vmi;
+    // Imagenes incrementales: paginas escritas desde la ultima imagen guardada.
+    // Si cadenaImagen esta en 1, archivo_vmi y sus diferencias (largoDiferencias
+    // bytes) tienen el estado del momento en que se limpiaron las paginas
+    uint8_t paginasSucias[MAX_PAGINAS_IMAGEN];
+    int cadenaImagen;
+    uint32_t largoDiferencias;
+    // Imagenes en segundo plano: hijos que todavia estan guardando, del mas viejo
+    // al mas nuevo, y el extremo de la tuberia por la que avisa el mas nuevo
+    int pidImagenes[MAX_IMAGENES_EN_CURSO];
+    uint32_t imagenesEnCurso;
+    int avisoUltimaImagen;
+    uint32_t imagenesGuardadas, imagenesFallidas;
+    uint64_t pausaImagenes, pausaMaximaImagen; //nanosegundos detenida en cada breakpoint
+    // Entrada y salida del programa (stdin y stdout salvo en los lotes)
+    FILE *entrada;
+    FILE *salida;
+    // Ejecucion por cuotas (planificador de lotes)
+    uint32_t cuota;         //instrucciones que quedan antes de ceder, SIN_CUOTA si no hay limite
+    uint8_t pausa;          //PAUSA_* por la que la maquina cedio
+    uint8_t puntoCopia;     //PUNTO_* en el que se detiene una plantilla
+
+    // Codigos de condicion diferidos
+    int32_t resultadoCC;
+    int ccPendiente;
+
+    // Modo rapido: registros internos pendientes de calcular
+    const struct InstruccionDecodificada *instruccionPendiente; //da OPC, OP1 y OP2
+    int accesoPendiente;
+    uint32_t accesoPendienteLAR;                                //da LAR, MAR y MBR
+
+    // Cache de instrucciones predecodificadas
+    struct InstruccionDecodificada *cacheDecodificada;
+    uint32_t cacheBaseCS, cacheFinCS; //rango fisico del CS cubierto por la cache
+    uint8_t cachePosCS;
+    uint32_t cacheTamCS;
+
+    // Bloque traducido que empieza en cada offset del CS (NULL si no hay)
+    struct Bloque **mapaBloques;
+    uint32_t tamMapa;
+    // Bloques vigentes y bloques invalidados que todavia se pueden estar ejecutando
+    struct Bloque *bloquesVivos;
+    struct Bloque *bloquesRetirados;
+    // Entradas a cada offset del CS mientras no tiene bloque traducido (motor=niveles)
+    uint64_t *contadorEntradas;
+
+    // Perfil de pares de instrucciones (-perfil)
+    uint64_t perfilPares[32][32];
+    uint64_t perfilInstrucciones;
+} MaquinaVirtual;
+
+MaquinaVirtual *creaMaquinaVirtual();
+void reiniciaMaquinaVirtual(MaquinaVirtual *mv);
+void liberaMaquinaVirtual(MaquinaVirtual *mv);
 
 //-------------FUNCION PARA DETECCION DE ERROR---------------
-void detectaError(int8_t cod, int32_t er);
+void detectaError(MaquinaVirtual *mv, int8_t cod, int32_t er);
 
 //-------------DECLARACIONES DE FUNCIONES PARA VIRTUAL MACHINE---------------
-void inicializaMemoria();
+void inicializaMemoria(MaquinaVirtual *mv);
+
+//-------------MEMORIA PRINCIPAL---------------
+//En sistemas POSIX la memoria se pide con mmap y el sistema reserva y pone en
+//cero cada pagina recien cuando se usa: muchas maquinas con m=1024 solo ocupan
+//lo que sus programas tocan. En el resto se usa calloc
+#if !defined(_WIN32) && !defined(MV_SIN_MMAP)
+#define MEMORIA_DIFERIDA 1
+#else
+#define MEMORIA_DIFERIDA 0
+#endif
+
+extern int informeMemoria;
+uint8_t *reservaMemoria(uint32_t tamanio);
+void liberaMemoria(MaquinaVirtual *mv);
+void limpiaMemoria(MaquinaVirtual *mv);
+int mapeaMemoriaImagen(MaquinaVirtual *mv, const char *nombre, uint32_t desplazamiento);
+uint32_t paginasResidentes(MaquinaVirtual *mv, uint32_t *total);
+void muestraMemoriaResidente(MaquinaVirtual *mv, FILE *salida);
+int compartirMemoria(MaquinaVirtual *mv);
+int mapeaMemoriaCompartida(MaquinaVirtual *mv, int descriptor);
+
+//-------------SEGMENTOS COMPARTIDOS---------------
+//Con -compartir las paginas enteras del KS y el CS de un programa se mapean de
+//un unico archivo sin nombre por proceso, de solo lectura, en todas las maquinas
+//que cargan el mismo programa con la misma disposicion. El programa no lo nota:
+//una escritura sobre esas paginas (codigo automodificable) las copia antes a
+//memoria propia de la maquina
+extern int segmentosCompartidos;
+void compartirSegmentos(MaquinaVirtual *mv, uint32_t inicio, uint32_t fin);
+void privatizaSegmentos(MaquinaVirtual *mv);
+void liberaSegmentosCompartidos(MaquinaVirtual *mv);
+
+static inline void verificaCompartidos(MaquinaVirtual *mv, uint32_t direccionFisica, uint32_t tamanio){
+    if (direccionFisica < mv->finCompartido && direccionFisica + tamanio > mv->inicioCompartido) {
+        privatizaSegmentos(mv);
+    }
+}
+
+//Archivo de solo lectura mapeado en memoria (o leido entero si no se puede mapear)
+typedef struct{
+    const uint8_t *datos;
+    size_t tamanio;
+    int mapeado;
+} ArchivoMapeado;
+
+int mapeaArchivo(const char *nombre, ArchivoMapeado *archivo);
+void liberaArchivoMapeado(ArchivoMapeado *archivo);
+
+//-------------ACCESO BIG-ENDIAN---------------
+//La memoria de la MV es big-endian y sin alinear: se copia la palabra entera y,
+//si el host es little-endian, se invierten los bytes con una sola instruccion
+#if defined(__GNUC__) && defined(__BYTE_ORDER__)
+    #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        #define DESDE_BE16(x) __builtin_bswap16(x)
+        #define DESDE_BE32(x) __builtin_bswap32(x)
+    #else
+        #define DESDE_BE16(x) (x)
+        #define DESDE_BE32(x) (x)
+    #endif
+    #define ACCESO_POR_PALABRA 1
+#else
+    #define ACCESO_POR_PALABRA 0
+#endif
+
+static inline uint16_t cargaBE16(const uint8_t *p){
+#if ACCESO_POR_PALABRA
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return DESDE_BE16(v);
+#else
+    return (uint16_t)((p[0] << 8) | p[1]);
+#endif
+}
+
+static inline uint32_t cargaBE32(const uint8_t *p){
+#if ACCESO_POR_PALABRA
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return DESDE_BE32(v);
+#else
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+#endif
+}
+
+static inline void guardaBE16(uint8_t *p, uint16_t valor){
+#if ACCESO_POR_PALABRA
+    valor = DESDE_BE16(valor);
+    memcpy(p, &valor, sizeof(valor));
+#else
+    p[0] = valor >> 8;
+    p[1] = valor & 0xFF;
+#endif
+}
+
+static inline void guardaBE32(uint8_t *p, uint32_t valor){
+#if ACCESO_POR_PALABRA
+    valor = DESDE_BE32(valor);
+    memcpy(p, &valor, sizeof(valor));
+#else
+    p[0] = valor >> 24;
+    p[1] = (valor >> 16) & 0xFF;
+    p[2] = (valor >> 8) & 0xFF;
+    p[3] = valor & 0xFF;
+#endif
+}
 
 //-------------FUNCIONES DE MEMORIA---------------
-uint32_t calculaDireccionFisica(uint32_t direccionLogica);
-int32_t leerMemoria(uint32_t direccionFisica, uint8_t tamanio);
-void escribirMemoria(uint32_t direccionFisica, int32_t valor, uint8_t tamanio);
+void actualizaTraduccion(MaquinaVirtual *mv);
+uint32_t calculaDireccionFisicaVerificada(MaquinaVirtual *mv, uint32_t direccionLogica);
+uint32_t traduceAccesoVerificado(MaquinaVirtual *mv, uint32_t direccionLogica, uint8_t tamanio);
+int32_t leerMemoria(MaquinaVirtual *mv, uint32_t direccionFisica, uint8_t tamanio);
+void escribirMemoria(MaquinaVirtual *mv, uint32_t direccionFisica, int32_t valor, uint8_t tamanio);
+void escribeMemoriaTraducida(MaquinaVirtual *mv, uint32_t direccionFisica, int32_t valor, uint8_t tamanio);
+
+static inline uint32_t calculaDireccionFisica(MaquinaVirtual *mv, uint32_t direccionLogica){
+    const TraduccionSegmento *t = &mv->traduccion[(direccionLogica >> 16) & (NUM_SEG - 1)];
+    uint32_t offset = direccionLogica - t->inicio;
+    if (offset < t->limite) {
+        return t->base + offset;
+    }
+    return calculaDireccionFisicaVerificada(mv, direccionLogica);
+}
+
+// Traduce un acceso de tamanio bytes incluyendo la verificacion del final de la
+// memoria que hace leerMemoria/escribirMemoria: la direccion devuelta se puede
+// usar sin volver a verificarla (con un error devuelve 0)
+static inline uint32_t traduceAcceso(MaquinaVirtual *mv, uint32_t direccionLogica, uint8_t tamanio){
+    const TraduccionSegmento *t = &mv->traduccion[(direccionLogica >> 16) & (NUM_SEG - 1)];
+    uint32_t offset = direccionLogica - t->inicio;
+    if (offset < t->limite) {
+        return t->base + offset;
+    }
+    return traduceAccesoVerificado(mv, direccionLogica, tamanio);
+}
+
+// Lectura big-endian con extension de signo, sin verificar la direccion
+static inline int32_t leeMemoriaTraducida(MaquinaVirtual *mv, uint32_t direccionFisica, uint8_t tamanio){
+    const uint8_t *p = mv->MemoriaPrincipal + direccionFisica;
+    switch(tamanio){
+        case 1: return (int8_t)p[0];
+        case 2: return (int16_t)cargaBE16(p);
+        default: return (int32_t)cargaBE32(p);
+    }
+}
 
 //-------------INICIALIZACIONES PARA VERSION 1---------------
-void inicializaSegmentosV1(uint16_t tamanioCodigo);
-void inicializaTablaRegistrosV1();
+void inicializaSegmentosV1(MaquinaVirtual *mv, uint16_t tamanioCodigo);
+void inicializaTablaRegistrosV1(MaquinaVirtual *mv);
 
 //-------------FUNCIONES PARA PARAM SEGMENT---------------
 uint32_t calculaTamanioParametros(char **parametros, int cantParam);
-uint32_t inicializaParamSegment(char **parametros, int cantParam);
+uint32_t inicializaParamSegment(MaquinaVirtual *mv, char **parametros, int cantParam);
 
 
 //-------------INICIALIZACIONES PARA VERSION 2---------------
-void inicializaTablasV2(VMXHeaderV2 encabezado, char **parametros, int cantParam);
+void inicializaTablasV2(MaquinaVirtual *mv, VMXHeaderV2 encabezado, char **parametros, int cantParam);
 
 
 //-------------LECTURA DEL ARCHIVO---------------
 //-------------CARGA PROGRAMA PARA VERSION 1---------------
-int cargaProgramaV1(FILE *arch);
+int cargaProgramaV1(MaquinaVirtual *mv, const uint8_t *archivo, size_t tamanio);
 
 //-------------CARGA PROGRAMA PARA VERSION 2---------------
-int cargaProgramaV2(FILE *arch, char **parametros, int cantParam);
+int cargaProgramaV2(MaquinaVirtual *mv, const uint8_t *archivo, size_t tamanio, char **parametros, int cantParam);
 
 //-------------CARGA PROGRAMA SEGUN LA VERSION---------------
-int cargaPrograma(const char *nombreArchivo, char **parametros, int cantParam);
+int cargaPrograma(MaquinaVirtual *mv, const char *nombreArchivo, char **parametros, int cantParam);
 
 //-------------CARGA O CREA ARCHIVO VMI---------------
-int cargarImagenVMI(const char *filename);
-int guardarImagenVMI(const char *filename);
+int cargarImagenVMI(MaquinaVirtual *mv, const char *filename);
+int guardarImagenVMI(MaquinaVirtual *mv, const char *filename);
+int escribeImagenVMI(MaquinaVirtual *mv, const char *filename);
+int escribeEstadoVMI(MaquinaVirtual *mv, FILE *archivo);
+void convierteEstadoVMI(MaquinaVirtual *mv);
+
+//-------------IMAGENES INCREMENTALES---------------
+//Con -incremental cada breakpoint agrega a imagen.vmi.dif solo las paginas que
+//cambiaron desde el anterior, con los registros y la tabla de segmentos. Cargar
+//la imagen aplica las diferencias en orden y -compactar las junta en la imagen
+#define TAMANIO_ESTADO_VMI (NUM_REGISTROS * 4 + NUM_SEG * 4)
+
+extern int imagenIncremental;
+
+int guardarImagenIncremental(MaquinaVirtual *mv, const char *filename);
+void aplicaDiferenciasVMI(MaquinaVirtual *mv, const char *filename);
+void descartaDiferenciasVMI(const char *filename);
+int compactaImagenVMI(MaquinaVirtual *mv, const char *filename);
+
+//-------------IMAGENES COMPRIMIDAS---------------
+//La version 2 de la imagen guarda la memoria en bloques de TAMANIO_PAGINA_IMAGEN
+//bytes despues de un indice con, por bloque, donde empieza, cuanto ocupa (0 si
+//es todo cero, el largo del bloque si no se pudo comprimir) y su suma Adler-32.
+//Se guarda asi con -comprimir; la version 1 se sigue leyendo igual que antes
+#define VERSION_VMI 1
+#define VERSION_VMI_COMPRIMIDA 2
+#define TAMANIO_ENTRADA_INDICE 12
+
+extern int imagenComprimida;
+
+int escribeMemoriaComprimida(MaquinaVirtual *mv, FILE *archivo);
+int cargaMemoriaComprimida(MaquinaVirtual *mv, FILE *archivo);
+
+//-------------IMAGENES EN SEGUNDO PLANO---------------
+//Con asincronico=N el breakpoint hace fork y el hijo guarda la imagen (o la
+//diferencia) sobre su copia copy-on-write de la memoria mientras el padre sigue.
+//Cada hijo espera el aviso del anterior antes de escribir, asi las imagenes
+//quedan en el orden en que se pidieron; con N hijos en curso el padre espera
+#if !defined(_WIN32) && !defined(MV_SIN_FORK)
+#define IMAGEN_ASINCRONICA 1
+#else
+#define IMAGEN_ASINCRONICA 0
+#endif
+
+extern uint32_t imagenesAsincronicas; //0: la imagen se guarda en el breakpoint
+
+int guardarImagenBreakpoint(MaquinaVirtual *mv);
+void esperaImagenesEnCurso(MaquinaVirtual *mv);
+void muestraImagenesAsincronicas(MaquinaVirtual *mv, FILE *salida);
+
+// Solo se lleva la cuenta con -incremental: sin eso las paginas no se miran
+static inline void marcaPaginaSucia(MaquinaVirtual *mv, uint32_t direccionFisica, uint32_t tamanio){
+    if (!imagenIncremental) {
+        return;
+    }
+    mv->paginasSucias[direccionFisica >> BITS_PAGINA_IMAGEN] = 1;
+    mv->paginasSucias[(direccionFisica + tamanio - 1) >> BITS_PAGINA_IMAGEN] = 1;
+}
 
 //-------------FUNCIONES DE REGISTROS---------------
-int verificaRegistro(uint8_t numReg, uint8_t sector);
-int32_t obtenerValorRegistro(uint8_t numReg, uint8_t sector);
-void escribirEnRegistro(uint8_t numReg, uint8_t sector, int32_t valor);
-uint32_t calculaDireccionSalto(uint8_t tipoA, uint32_t operandoA,uint8_t tamA);
-void actualizarCC(int32_t resultado);
+int verificaRegistro(MaquinaVirtual *mv, uint8_t numReg, uint8_t sector);
+int32_t obtenerValorRegistro(MaquinaVirtual *mv, uint8_t numReg, uint8_t sector);
+void escribirEnRegistro(MaquinaVirtual *mv, uint8_t numReg, uint8_t sector, int32_t valor);
+uint32_t calculaDireccionSalto(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA,uint8_t tamA);
+void actualizarCC(MaquinaVirtual *mv, int32_t resultado);
+
+//-------------CODIGOS DE CONDICION DIFERIDOS---------------
+//Las instrucciones solo guardan su resultado: los bits N y Z de CC se calculan
+//cuando alguien los mira (saltos condicionales, CC como operando, imagen VMI)
+
+static inline void materializaCC(MaquinaVirtual *mv){
+    if (mv->ccPendiente) {
+        mv->Registros[POS_CC] = (mv->Registros[POS_CC] & ~(CC_N | CC_Z)) | ((uint32_t)mv->resultadoCC & CC_N) | (mv->resultadoCC == 0 ? CC_Z : 0);
+        mv->ccPendiente = 0;
+    }
+}
 
 //-------------FUNCIONES DE OPERANDOS---------------
-void guardaRegistroOP(uint8_t tipo, uint32_t operando, uint8_t tipoOP_AB);
-uint32_t obtenerOperando(uint8_t tipo, unsigned int *ip, uint8_t *tam, uint8_t tipoOP);
-int32_t obtenerValorOperando(uint8_t tipoOp, uint32_t operando, uint8_t tamanio);
-void escribirValorOperando(uint8_t tipoOp, uint32_t operando, int32_t valor,uint8_t tamA);
+void guardaRegistroOP(MaquinaVirtual *mv, uint8_t tipo, uint32_t operando, uint8_t tipoOP_AB);
+uint32_t obtenerOperando(MaquinaVirtual *mv, uint8_t tipo, unsigned int *ip, uint8_t *tam, uint8_t tipoOP);
+int32_t obtenerValorOperando(MaquinaVirtual *mv, uint8_t tipoOp, uint32_t operando, uint8_t tamanio);
+void escribirValorOperando(MaquinaVirtual *mv, uint8_t tipoOp, uint32_t operando, int32_t valor,uint8_t tamA);
 
 //-------------FUNCIONES DE INSTRUCCIONES---------------
-void ejecutarMOV(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA,uint8_t tamB);;
-void ejecutarADD(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
-void ejecutarSUB(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
-void ejecutarMUL(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
-void ejecutarDIV(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
-void ejecutarCMP(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
-void ejecutarSHL(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
-void ejecutarSHR(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
-void ejecutarSAR(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
-void ejecutarAND(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
-void ejecutarOR(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
-void ejecutarXOR(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
-void ejecutarSWAP(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
-void ejecutarLDL(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
-void ejecutarLDH(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
-void ejecutarRND(uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
-void ejecutarJMP(uint8_t tipoA, uint32_t operandoA,uint8_t tamA);
-void ejecutarJZ(uint8_t tipoA, uint32_t operandoA,uint8_t tamA);
-void ejecutarJP(uint8_t tipoA, uint32_t operandoA,uint8_t tamA);
-void ejecutarJN(uint8_t tipoA, uint32_t operandoA,uint8_t tamA);
-void ejecutarJNZ(uint8_t tipoA, uint32_t operandoA,uint8_t tamA);
-void ejecutarJNP(uint8_t tipoA, uint32_t operandoA,uint8_t tamA);
-void ejecutarJNN(uint8_t tipoA, uint32_t operandoA,uint8_t tamA);
-void ejecutarNOT(uint8_t tipoA, uint32_t operandoA,uint8_t tamA);
-void ejecutarPUSH(int32_t valorPush);
-int32_t ejecutarPOP(int *error);
-void ejecutarCALL(uint32_t destino);
-void ejecutarRET();
+void ejecutarMOV(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA,uint8_t tamB);;
+void ejecutarADD(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
+void ejecutarSUB(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
+void ejecutarMUL(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
+void ejecutarDIV(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
+void ejecutarCMP(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
+void ejecutarSHL(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
+void ejecutarSHR(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
+void ejecutarSAR(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
+void ejecutarAND(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
+void ejecutarOR(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
+void ejecutarXOR(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
+void ejecutarSWAP(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
+void ejecutarLDL(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
+void ejecutarLDH(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
+void ejecutarRND(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB,uint8_t tamA, uint8_t tamB);
+void ejecutarJMP(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA,uint8_t tamA);
+void ejecutarJZ(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA,uint8_t tamA);
+void ejecutarJP(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA,uint8_t tamA);
+void ejecutarJN(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA,uint8_t tamA);
+void ejecutarJNZ(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA,uint8_t tamA);
+void ejecutarJNP(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA,uint8_t tamA);
+void ejecutarJNN(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA,uint8_t tamA);
+void ejecutarNOT(MaquinaVirtual *mv, uint8_t tipoA, uint32_t operandoA,uint8_t tamA);
+void ejecutarPUSH(MaquinaVirtual *mv, int32_t valorPush);
+int32_t ejecutarPOP(MaquinaVirtual *mv, int *error);
+void ejecutarCALL(MaquinaVirtual *mv, uint32_t destino);
+void ejecutarRET(MaquinaVirtual *mv);
 
 //-------------INICIALIZO LA PILA PARA LA SUBRUTINA---------------
-void inicializarPilaMain(int cantParam, uint32_t dirParam);
+void inicializarPilaMain(MaquinaVirtual *mv, int cantParam, uint32_t dirParam);
 
 //-------------LLAMADA A SYS---------------
-void writeSYS();
-void readSYS();
-void writeSTR();
-void readSTR();
+void writeSYS(MaquinaVirtual *mv);
+void readSYS(MaquinaVirtual *mv);
+void writeSTR(MaquinaVirtual *mv);
+void readSTR(MaquinaVirtual *mv);
 
 uint16_t convertirBigEndian16(uint16_t val);
 uint32_t convertirBigEndian32(uint32_t val);
-int ejecutarInstruccion();
-void mostrarMenu(char *op);
-void breakPoint();
-void ejecutarSYS(uint32_t operandoA);
+int ejecutarInstruccion(MaquinaVirtual *mv);
+int ejecutarOperacion(MaquinaVirtual *mv, uint8_t codOp, uint8_t tipoA, uint32_t operandoA, uint8_t tipoB, uint32_t operandoB, uint8_t tamA, uint8_t tamB);
+void mostrarMenu(MaquinaVirtual *mv, int *op);
+void breakPoint(MaquinaVirtual *mv);
+void ejecutarSYS(MaquinaVirtual *mv, uint32_t operandoA);
 
 //-------------FUNCIONES DE EJECUCION---------------
-int ejecutarPrograma ();
+int ejecutarPrograma(MaquinaVirtual *mv);
+
+//-------------CACHE DE INSTRUCCIONES PREDECODIFICADAS---------------
+//Estados de una entrada de la cache
+#define PRE_VACIA 0 //todavia no decodificada (o invalidada por una escritura en el CS)
+#define PRE_OK 1    //decodificada, se ejecuta directamente desde el registro
+#define PRE_LENTA 2 //se ejecuta por el camino de referencia (ejecutarInstruccion)
+
+//Chequeos que el verificador de carga ya hizo sobre una entrada PRE_OK. Que la
+//entrada este en PRE_OK ya prueba el codigo de operacion y los registros (el
+//numero tiene 5 bits y el sector 2, no hay codigos fuera de rango): solo queda
+//marcar lo que depende del tamanio del CS
+#define VERIF_DESTINO 0x01 //salto o CALL inmediato con destino dentro del CS
+
+//Longitud maxima de una instruccion: codigo + dos operandos de memoria
+#define MAX_LONG_INSTRUCCION 7
+//Bytes que puede abarcar una superinstruccion (hasta tres instrucciones fusionadas)
+#define MAX_LONG_FUSION (3*MAX_LONG_INSTRUCCION)
+
+typedef struct InstruccionDecodificada{ //Instruccion decodificada, indexada por su offset en el Code Segment
+    uint8_t estado;
+    uint8_t manejador;              //indice en la tabla de manejadores del motor hilado
+    uint8_t codOp;
+    uint8_t tipoA, tipoB;
+    uint8_t tamA, tamB;
+    uint8_t regA, regB;             //registro base de los operandos de memoria
+    uint8_t verificada;             //VERIF_*: chequeos que ya no se repiten al ejecutar
+    uint32_t operandoA, operandoB;  //byte de registro, inmediato extendido u offset de memoria
+    uint32_t valorOP1, valorOP2;    //contenido de OP1 y OP2 luego de decodificar
+    uint16_t siguiente;             //offset en el CS de la instruccion siguiente
+} InstruccionDecodificada;
+
+
+void decodificaInstruccion(MaquinaVirtual *mv, uint32_t offset, InstruccionDecodificada *ins);
+void preparaCacheDecodificada(MaquinaVirtual *mv);
+void invalidaCacheDecodificada(MaquinaVirtual *mv, uint32_t direccionFisica, uint32_t tamanio);
+void liberaCacheDecodificada(MaquinaVirtual *mv);
+int ejecutarDecodificada(MaquinaVirtual *mv);
+
+//-------------CACHE DE PROGRAMAS EN DISCO---------------
+//Con cache=DIR la cache predecodificada de un CS (ya fusionada) se guarda en
+//DIR/<hash del CS>.mvc y la proxima vez que se prepara el mismo codigo se lee
+//en lugar de decodificarlo. El archivo guarda los bytes del CS y la firma de
+//la MV que lo escribio, y una suma de los registros: si algo no coincide se
+//decodifica y se vuelve a guardar.
+//Hay que subir VERSION_CACHE_PROGRAMA al cambiar lo que produce el decodificador
+#define VERSION_CACHE_PROGRAMA 3
+extern const char *dirCachePrograma;
+
+// Direccion logica de un operando de memoria: segmento del registro base y
+// offset del registro mas el desplazamiento (igual que obtenerOperando)
+static inline uint32_t direccionOperando(MaquinaVirtual *mv, uint8_t reg, uint32_t desplazamiento){
+    return (mv->Registros[reg] & 0xFFFF0000) | (desplazamiento + (mv->Registros[reg] & 0xFFFF));
+}
+
+//-------------MODO RAPIDO---------------
+//Con -rapido los motores hilados no actualizan LAR, MAR, MBR, OPC, OP1 ni OP2 en
+//cada instruccion: recuerdan la ultima instruccion y el ultimo acceso long a
+//memoria y los calculan cuando alguien los consulta (breakpoint, imagen VMI,
+//camino de referencia o una instruccion que los nombra)
+extern int modoRapido;
+
+void calculaRegistrosInternos(MaquinaVirtual *mv);
+
+static inline void materializaInternos(MaquinaVirtual *mv){
+    if (mv->instruccionPendiente != NULL || mv->accesoPendiente) {
+        calculaRegistrosInternos(mv);
+    }
+}
+
+//-------------MOTORES DE EJECUCION---------------
+#define MOTOR_REFERENCIA 0      //decodifica en cada paso y despacha con el switch de ejecutarOperacion
+#define MOTOR_PREDECODIFICADO 1 //toma la instruccion de la cache y despacha con el switch
+#define MOTOR_HILADO 2          //cada manejador salta directamente al de la instruccion siguiente
+#define MOTOR_BLOQUES 3         //motor hilado sobre bloques basicos traducidos y encadenados
+#define MOTOR_NIVELES 4         //cada bloque empieza interpretado y sube de nivel a medida que se usa
+
+extern int motorEjecucion;
+
+//Manejadores del motor hilado. El primero tiene que ser DECODIFICAR (entrada vacia de la cache)
+//FIN_BLOQUE es el centinela que cierra cada bloque traducido
+#define LISTA_MANEJADORES(X) \
+    X(DECODIFICAR) X(REFERENCIA) X(GENERICO) \
+    X(MOV) X(ADD) X(SUB) X(MUL) X(DIV) X(CMP) X(SHL) X(SHR) X(SAR) \
+    X(AND) X(OR) X(XOR) X(SWAP) X(LDL) X(LDH) X(RND) \
+    X(SYS) X(CALL) X(JMP) X(JZ) X(JP) X(JN) X(JNZ) X(JNP) X(JNN) \
+    X(NOT) X(RET) X(STOP) X(FIN_BLOQUE)
+
+//Manejadores especializados por forma de operandos, elegidos al decodificar:
+//  RR: registro, registro   RI: registro, inmediato   RM: registro, memoria (long)
+//  MR: memoria (long), registro   MI: memoria (long), inmediato
+//Los registros tienen que ser de 32 bits (sector 0)
+#define FORMAS_COMPLETAS(X, op) X(op, RR) X(op, RI) X(op, RM) X(op, MR) X(op, MI)
+#define FORMAS_REGISTRO(X, op) X(op, RR) X(op, RI)
+#define LISTA_ESPECIALIZADOS(X) \
+    FORMAS_COMPLETAS(X, MOV) FORMAS_COMPLETAS(X, ADD) FORMAS_COMPLETAS(X, SUB) \
+    FORMAS_COMPLETAS(X, MUL) FORMAS_COMPLETAS(X, CMP) FORMAS_COMPLETAS(X, AND) \
+    FORMAS_COMPLETAS(X, OR) FORMAS_COMPLETAS(X, XOR) \
+    FORMAS_REGISTRO(X, SHL) FORMAS_REGISTRO(X, SHR) FORMAS_REGISTRO(X, SAR)
+
+//Superinstrucciones: secuencias frecuentes ejecutadas por un solo manejador
+//  CMP reg,(reg|inm) + Jcc inm
+//  (ADD|SUB) reg,inm + CMP reg,(reg|inm) + Jcc inm  (fin de bucle con contador)
+//  MOV reg,(reg|inm|mem) + ADD mismo reg,(reg|inm)
+#define SALTOS_FUSION(X, prefijo) X(prefijo, JMP) X(prefijo, JZ) X(prefijo, JP) X(prefijo, JN) \
+    X(prefijo, JNZ) X(prefijo, JNP) X(prefijo, JNN)
+#define LISTA_FUSIONES(X) \
+    SALTOS_FUSION(X, CMP_RR) SALTOS_FUSION(X, CMP_RI) \
+    SALTOS_FUSION(X, ADD_CMP_RR) SALTOS_FUSION(X, ADD_CMP_RI) \
+    SALTOS_FUSION(X, SUB_CMP_RR) SALTOS_FUSION(X, SUB_CMP_RI) \
+    X(MOV_RR, ADD_RR) X(MOV_RR, ADD_RI) X(MOV_RI, ADD_RR) \
+    X(MOV_RI, ADD_RI) X(MOV_RM, ADD_RR) X(MOV_RM, ADD_RI)
+
+#define ENUM_MANEJADOR(m) MANEJ_##m,
+#define ENUM_ESPECIALIZADO(op, forma) MANEJ_##op##_##forma,
+#define ENUM_FUSION(primera, ultima) MANEJ_##primera##_##ultima,
+enum { LISTA_MANEJADORES(ENUM_MANEJADOR) LISTA_ESPECIALIZADOS(ENUM_ESPECIALIZADO) LISTA_FUSIONES(ENUM_FUSION) CANT_MANEJADORES };
+
+uint8_t seleccionaManejador(const InstruccionDecodificada *ins);
+void fusionaInstruccion(MaquinaVirtual *mv, InstruccionDecodificada *cache, uint32_t tamCS, uint32_t offset);
+int instruccionesFusionadas(uint8_t manejador);
+
+//-------------EJECUCION POR CUOTAS---------------
+//El planificador de lotes ejecuta cada maquina de a una cuota de instrucciones.
+//Al agotarla, o en un SYS READ sin datos en la entrada, la maquina cede:
+//continuarEjecucion queda en 0 con pausa indicando el motivo, el estado queda
+//entre dos instrucciones y ejecutarCuota la reanuda donde quedo
+#define SIN_CUOTA UINT32_MAX
+#define PAUSA_NINGUNA 0
+#define PAUSA_CUOTA 1   //se agoto la cuota
+#define PAUSA_ENTRADA 2 //SYS READ o STR_READ bloquearia: IP queda en la instruccion SYS
+#define PAUSA_PUNTO 3   //una plantilla llego a su punto de copia
+
+static inline void cedeMaquina(MaquinaVirtual *mv, uint8_t motivo){
+    mv->pausa = motivo;
+    mv->continuarEjecucion = 0;
+}
+
+// Descuenta n instrucciones de la cuota. Si ya estaba agotada cede la maquina
+// y devuelve 1. Los motores por bloques descuentan el bloque entero al entrar
+static inline int cuotaAgotada(MaquinaVirtual *mv, uint32_t n){
+    if (mv->cuota == SIN_CUOTA) {
+        return 0;
+    }
+    if (mv->cuota == 0) {
+        cedeMaquina(mv, PAUSA_CUOTA);
+        return 1;
+    }
+    mv->cuota = mv->cuota > n ? mv->cuota - n : 0;
+    return 0;
+}
+
+int ejecutarCuota(MaquinaVirtual *mv, uint32_t cuota);
+int entradaDisponible(FILE *entrada);
+
+//-------------CACHE DE BLOQUES BASICOS---------------
+//Un bloque termina en un salto, CALL, RET, STOP, SYS, en una instruccion que
+//escribe IP o en una que va por el camino de referencia
+#define MAX_INSTRUCCIONES_BLOQUE 256
+
+//Codigo nativo de un bloque: devuelve el indice de la instruccion del bloque
+//por la que sigue el interprete (cantidad si el bloque termino)
+typedef uint32_t (*CodigoNativo)(uint32_t *registros, uint8_t *memoria, const TraduccionSegmento *traduccion);
+
+typedef struct Bloque{
+    uint16_t inicio, fin;           //bytes del CS traducidos: [inicio, fin)
+    uint16_t cantidad;              //instrucciones, sin contar el centinela
+    uint8_t valido;                 //0 cuando una escritura en el CS lo invalido
+    struct Bloque *sucesores[2];    //ultimos bloques a los que se salio (encadenamiento)
+    struct Bloque *siguienteLista;  //lista de bloques vivos o retirados
+    uint32_t ejecuciones;           //veces que se entro al bloque (con -jit o motor=niveles)
+    CodigoNativo nativo;            //NULL mientras lo ejecute el interprete
+    uint32_t tamNativo;
+    InstruccionDecodificada instrucciones[]; //copia de la cache terminada en FIN_BLOQUE
+} Bloque;
+
+void preparaBloques(MaquinaVirtual *mv);
+Bloque *encadenaBloque(MaquinaVirtual *mv, Bloque *actual, uint32_t offset);
+void invalidaBloques(MaquinaVirtual *mv, uint32_t desde, uint32_t hasta);
+void liberaBloques(MaquinaVirtual *mv);
+int ejecutarProgramaBloques(MaquinaVirtual *mv);
+
+//-------------COMPILADOR JIT---------------
+//Bloques que se ejecutan mas de UMBRAL_JIT veces se compilan a x86-64. Solo en
+//hosts x86-64 con convencion System V (Linux, macOS); en el resto (o compilando con
+//-DMV_SIN_JIT) se ignora -jit
+#if defined(__x86_64__) && !defined(_WIN32) && !defined(MV_SIN_JIT)
+#define JIT_DISPONIBLE 1
+#else
+#define JIT_DISPONIBLE 0
+#endif
+#define UMBRAL_JIT 50
+
+extern int jitActivo;
+extern uint32_t umbralJit;
+int compilaBloque(MaquinaVirtual *mv, Bloque *bloque);
+void liberaCodigoNativo(Bloque *bloque);
+
+//-------------EJECUCION POR NIVELES---------------
+//Con motor=niveles se cuentan las entradas a cada bloque (offset del CS al que
+//se llega por un salto o al terminar el bloque anterior). Un bloque se ejecuta
+//interpretado hasta cruzar los umbrales, configurables con niveles=P,B[,J]
+#define NIVEL_INTERPRETE 0      //ejecutarInstruccion: no decodifica nada de antemano
+#define NIVEL_PREDECODIFICADO 1 //ejecutarDecodificada, instruccion por instruccion
+#define NIVEL_BLOQUES 2         //bloque traducido: motor hilado con superinstrucciones
+#define NIVEL_NATIVO 3          //bloque compilado por el JIT (con -jit)
+#define UMBRAL_PREDECODIFICADO 2
+#define UMBRAL_BLOQUES 16
+
+extern uint32_t umbralPredecodificado, umbralBloques;
+extern int informeNiveles;
+uint8_t nivelEntrada(MaquinaVirtual *mv, uint32_t offset);
+int ejecutaBloqueInterpretado(MaquinaVirtual *mv, uint32_t offset, uint8_t nivel);
+void muestraNivelesBloques(MaquinaVirtual *mv, FILE *salida);
+
+//-------------PERFIL DE PARES DE INSTRUCCIONES---------------
+extern int perfilActivo;
+int ejecutarProgramaPerfilado(MaquinaVirtual *mv);
+void muestraPerfilPares(MaquinaVirtual *mv, FILE *salida);
+int ejecutarProgramaHilado(MaquinaVirtual *mv);
+
+//-------------EJECUCION POR LOTES---------------
+//lote=RUTA ejecuta muchos programas en paralelo. RUTA es un directorio con .vmx
+//(y .in opcionales) o una lista con un trabajo por linea. Cada trabajo tiene su
+//maquina; cada hilo las ejecuta de a una cuota de instrucciones y roba trabajos
+//de los otros hilos cuando se queda sin nada. La salida de cada trabajo queda
+//en su propio archivo dentro de dirSalidas
+#define CUOTA_LOTE 100000
+int ejecutarLote(const char *origen, const char *dirSalidas, int hilos, uint32_t cuota);
+
+//-------------COPIAS DE UNA PLANTILLA---------------
+//Una plantilla es una maquina que se carga una vez y se ejecuta hasta su punto
+//de copia. Cada copia arranca en ese estado y ve la memoria de la plantilla
+//copy-on-write: solo las paginas que escribe pasan a ser propias. copias=RUTA
+//ejecuta una copia por cada entrada (los .in de un directorio o una lista con
+//un archivo por linea) con el planificador de lotes
+#define PUNTO_NINGUNO 0
+#define PUNTO_LECTURA 1    //antes del primer SYS READ o STR_READ: la copia hace la lectura
+#define PUNTO_BREAKPOINT 2 //despues del primer SYS 0xF
+
+typedef struct{
+    MaquinaVirtual *mv;     //estado en el punto de copia
+    int descriptor;         //archivo sin nombre con la memoria de la plantilla, -1 si no hay
+} PlantillaMaquina;
+
+int preparaPlantilla(PlantillaMaquina *plantilla, MaquinaVirtual *mv, uint8_t punto);
+int clonaMaquinaVirtual(MaquinaVirtual *mv, const PlantillaMaquina *plantilla);
+void liberaPlantilla(PlantillaMaquina *plantilla);
+int ejecutarCopias(MaquinaVirtual *mv, uint8_t punto, const char *origen, const char *dirSalidas, int hilos, uint32_t cuota);
 
 //-------------FUNCIONES PARA DISASSEMBLER---------------
 // Tabla de mnemonicos para las instrucciones
@@ -278,16 +826,16 @@ static const char* NOMBRES_REGISTROS[] = { "LAR", "MAR", "MBR", "IP", "OPC", "OP
 // Funcion auxiliar para determinar tamanio del operando
 int operandoSize(uint8_t tipo);
 
-void decodificarOperando(uint32_t punt, int operandoSize,uint8_t codOp);
+void decodificarOperando(MaquinaVirtual *mv, uint32_t punt, int operandoSize,uint8_t codOp);
 
-void disassemblerInstruccion(uint32_t *ip);
+void disassemblerInstruccion(MaquinaVirtual *mv, uint32_t *ip);
 
-void disassembleKS();
+void disassembleKS(MaquinaVirtual *mv);
 
-void disassembleProgramaMV1();
-void disassembleProgramaMV2();
-void disassemblerPasoAPaso();
+void disassembleProgramaMV1(MaquinaVirtual *mv);
+void disassembleProgramaMV2(MaquinaVirtual *mv);
+void disassemblerPasoAPaso(MaquinaVirtual *mv);
 
-void muestraDesensamblador(uint8_t version);
+void muestraDesensamblador(MaquinaVirtual *mv, uint8_t version);
 
 #endif // MV_H_INCLUDED;
\ No newline at end of file